@@ -0,0 +1,259 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <gsl/gsl_rng.h>
+
+#include "dtype.h"
+#include "sis_models.h"
+#include "update.h"
+#include "networks.h"
+#include "measurement.h"
+#include "rng.h"
+
+/* Benchmark of the stages of a sweep ('make bench'), written as JSON.
+**
+** Every case is a network at one T: network/test.edgelist and synthetic
+** Erdos-Renyi and Barabasi-Albert graphs of 10^3 ... 10^6 nodes. A case runs
+** BENCH_THERMAL untimed sweeps, then nsweep sweeps through the separate
+** stages, each timed, and nsweep fused sweeps (sweep + flip_cluster). The
+** stage times are reported per vertex of the world-line after the
+** clustering; nsweep is chosen so a case handles about BENCH_VERTICES
+** vertices. A case whose Poisson mean sweight*T exceeds BENCH_MAX_VERTICES
+** is skipped, its world-line would not fit in memory.
+**
+** The allocation counts are the calls of malloc, calloc and realloc made by
+** the program itself, counted by linking with --wrap (see the Makefile).
+*/
+#ifndef BENCH_THERMAL
+#define BENCH_THERMAL 20
+#endif
+
+#ifndef BENCH_VERTICES
+#define BENCH_VERTICES 2e7
+#endif
+
+#ifndef BENCH_MAX_VERTICES
+#define BENCH_MAX_VERTICES 8e6
+#endif
+
+#ifndef BENCH_EDGELIST
+#define BENCH_EDGELIST "network/test.edgelist"
+#endif
+
+static const double bench_alpha = 0.5;
+static const double bench_gamma = 1.0;
+static const double bench_T[] = {1.0, 4.0, 16.0};
+
+enum {
+    STAGE_REMOVE,
+    STAGE_SWAP,
+    STAGE_INSERT,
+    STAGE_BOUNDARY_INITIAL,
+    STAGE_BOUNDARY_FINAL,
+    STAGE_CLUSTERING,
+    STAGE_FLIP,
+    STAGE_MEASUREMENT,
+    STAGE_SWEEP,
+    NSTAGE
+};
+
+static const char* stage_name[NSTAGE] = {
+    "remove_vertices",
+    "swapping_graphs",
+    "insert_vertices",
+    "boundary_condition_initial_state",
+    "boundary_condition_final_state",
+    "clustering",
+    "flip_cluster",
+    "measurement",
+    "sweep+flip_cluster"
+};
+
+static unsigned long nmalloc  = 0;
+static unsigned long ncalloc  = 0;
+static unsigned long nrealloc = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t n, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size) {
+#pragma omp atomic
+    nmalloc++;
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t n, size_t size) {
+#pragma omp atomic
+    ncalloc++;
+    return __real_calloc(n,size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size) {
+#pragma omp atomic
+    nrealloc++;
+    return __real_realloc(ptr,size);
+}
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC,&t);
+    return t.tv_sec+1e-9*t.tv_nsec;
+}
+
+static long peak_rss_kb() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF,&usage);
+    return usage.ru_maxrss;
+}
+
+// one case on g at T, appended to the JSON array in out
+static void bench_case(FILE* out, const char* name, network* g, double T, int first) {
+    fprintf(out,"%s\n    {\"network\": \"%s\", \"nnode\": %d, \"nedge\": %d, \"T\": %g",
+            first ? "" : ",",name,g->nnode,g->nedge,T);
+
+    model* m = sis_model_uniform_infection(bench_alpha,bench_gamma,g);
+    double lam = (m->sweight)*T;
+    if(lam>BENCH_MAX_VERTICES) {
+        fprintf(out,", \"skipped\": \"sweight*T = %.3e exceeds BENCH_MAX_VERTICES\"}",lam);
+        free_model(m);
+        return;
+    }
+
+    int nsweep = (int)(BENCH_VERTICES/lam);
+    if(nsweep<5) nsweep=5;
+    if(nsweep>2000) nsweep=2000;
+
+    unsigned long alloc0 = nmalloc+ncalloc+nrealloc;
+
+    gsl_rng* rng = gsl_rng_alloc(rng_chain_type());
+    gsl_rng_set(rng,12345);
+    world_line* w = malloc_world_line(world_line_capacity(m,T),2*(m->mhnspin),m->nsite);
+    chain* c = malloc_chain();
+    accumulator* a = malloc_accumulator();
+    strcpy(a->prefix,"bench_");
+
+    // running mode 0: a single patient zero, the final state pinned after nif infections
+    for(int i=0;i<(w->nsite);i++) w->istate[i] = -1;
+    w->istate[nearest_nb_arg_max_degree(g)] = 1;
+    w->beta = T;
+    double pnif = 0.1;
+    int initial_type = 0;
+    int final_type   = 1;
+
+    int ntime = 101;
+    double* time_list = (double*)malloc(sizeof(double)*ntime);
+    for(int i=0;i<ntime;i++) time_list[i] = i/100.0;
+
+    for(int i=0;i<BENCH_THERMAL;i++) {
+        sweep(c,w,m,initial_type,final_type,pnif,rng);
+        flip_cluster(c,w,rng);
+    }
+
+    // the samples are recorded by flip_cluster, as in main
+    chain_observe(c,m,time_list,ntime);
+
+    // block_size above nsweep, so measurement never writes a block
+    double elapsed[NSTAGE] = {0};
+    double nvertex=0;
+    double t0,t1;
+    for(int i=0;i<nsweep;i++) {
+        t0=now(); remove_vertices(c,w);                                    t1=now(); elapsed[STAGE_REMOVE] += t1-t0;
+        t0=t1;    swapping_graphs(c,w,m,rng);                              t1=now(); elapsed[STAGE_SWAP] += t1-t0;
+        t0=t1;    insert_vertices(c,w,m,rng);                              t1=now(); elapsed[STAGE_INSERT] += t1-t0;
+        t0=t1;    boundary_condition_initial_state(c,w,m,initial_type,rng); t1=now(); elapsed[STAGE_BOUNDARY_INITIAL] += t1-t0;
+        t0=t1;    boundary_condition_final_state(c,w,m,pnif,final_type,rng); t1=now(); elapsed[STAGE_BOUNDARY_FINAL] += t1-t0;
+        t0=t1;    clustering(c,w,m);                                       t1=now(); elapsed[STAGE_CLUSTERING] += t1-t0;
+        nvertex += w->nvertices;
+        t0=t1;    flip_cluster(c,w,rng);                                   t1=now(); elapsed[STAGE_FLIP] += t1-t0;
+        t0=t1;    measurement(c,a,w,m,time_list,ntime,nsweep+1,rng);       t1=now(); elapsed[STAGE_MEASUREMENT] += t1-t0;
+    }
+
+    double nvertex_fused=0;
+    for(int i=0;i<nsweep;i++) {
+        t0=now();
+        sweep(c,w,m,initial_type,final_type,pnif,rng);
+        flip_cluster(c,w,rng);
+        elapsed[STAGE_SWEEP] += now()-t0;
+        nvertex_fused += w->nvertices;
+    }
+
+    double staged=0;
+    for(int k=0;k<STAGE_SWEEP;k++) staged += elapsed[k];
+
+    fprintf(out,", \"nsweep\": %d, \"vertices_per_sweep\": %.1f,\n     \"ns_per_vertex\": {",nsweep,nvertex/nsweep);
+    for(int k=0;k<NSTAGE;k++) {
+        double n = (k==STAGE_SWEEP) ? nvertex_fused : nvertex;
+        fprintf(out,"%s\"%s\": %.3f",k==0 ? "" : ", ",stage_name[k],(n>0) ? 1e9*elapsed[k]/n : 0.0);
+    }
+    fprintf(out,"},\n     \"vertices_per_second\": {\"staged\": %.4e, \"fused\": %.4e},",
+            nvertex/staged,nvertex_fused/elapsed[STAGE_SWEEP]);
+    fprintf(out," \"peak_rss_kb\": %ld, \"allocations\": %lu}",peak_rss_kb(),nmalloc+ncalloc+nrealloc-alloc0);
+
+    free(time_list);
+    free_accumulator(a);
+    free_chain(c);
+    free_world_line(w);
+    gsl_rng_free(rng);
+    free_model(m);
+}
+
+/**
+ * Runs the benchmark cases and writes the results as JSON.
+ *
+ * Command-line arguments:
+ *   argv[1] (optional) - output file (default bench.json).
+ *   argv[2] (optional) - largest number of nodes of the synthetic networks (default 1000000).
+ *
+ * Example Usage:
+ *   ./cpmc_bench bench.json
+ *   ./cpmc_bench quick.json 10000
+ */
+int main(int argc, char** argv) {
+    const char* filename = "bench.json";
+    if(argc>1) filename = argv[1];
+    int max_nnode = 1000000;
+    if(argc>2) max_nnode = atoi(argv[2]);
+
+    FILE* out = fopen(filename,"w");
+    if(out==NULL) {
+        printf("Can not open the file: %s\n",filename);
+        exit(1);
+    }
+
+    gsl_rng* rng = gsl_rng_alloc(gsl_rng_mt19937);
+    gsl_rng_set(rng,2024);
+    int nT = (int)(sizeof(bench_T)/sizeof(bench_T[0]));
+
+    fprintf(out,"{\n  \"alpha\": %g, \"gamma\": %g, \"rng\": \"%s\", \"thermal\": %d,\n  \"cases\": [",
+            bench_alpha,bench_gamma,rng_chain_type()->name,BENCH_THERMAL);
+
+    int first=1;
+    network* g = read_edgelist(BENCH_EDGELIST);
+    for(int k=0;k<nT;k++,first=0) bench_case(out,BENCH_EDGELIST,g,bench_T[k],first);
+    free_network(g);
+
+    for(int nnode=1000;nnode<=max_nnode;nnode*=10) {
+        char name[64];
+
+        g = network_erdos_renyi(nnode,6.0,rng);
+        snprintf(name,sizeof(name),"erdos_renyi(n=%d,k=6)",nnode);
+        for(int k=0;k<nT;k++) bench_case(out,name,g,bench_T[k],0);
+        free_network(g);
+
+        g = network_barabasi_albert(nnode,3,rng);
+        snprintf(name,sizeof(name),"barabasi_albert(n=%d,m=3)",nnode);
+        for(int k=0;k<nT;k++) bench_case(out,name,g,bench_T[k],0);
+        free_network(g);
+    }
+
+    fprintf(out,"\n  ],\n  \"peak_rss_kb\": %ld\n}\n",peak_rss_kb());
+    fclose(out);
+    gsl_rng_free(rng);
+
+    return 0;
+}
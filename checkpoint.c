@@ -0,0 +1,253 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <gsl/gsl_rng.h>
+
+#include "dtype.h"
+#include "update.h"
+#include "checkpoint.h"
+#include "output.h"
+#include "measurement.h"
+
+/* layout of a checkpoint:
+**     char magic[8]  "CPMCCKP3"
+**     checkpoint header
+**     per chain : beta, nvertices, istate[nsite], pstate[nsite],
+**                 vertex[nvertices], chain stream, cstat_counter,
+**                 nthread, thread streams (if nthread>1)
+**     int allocated, then if allocated the accumulator.
+**     int nmark, output_mark[nmark]
+** Streams are written as their size followed by gsl_rng_fwrite. The marks
+** are the lengths of the output files at the checkpoint.
+*/
+static const char checkpoint_magic[8] = {'C','P','M','C','C','K','P','3'};
+
+static void write_block(FILE* fp, const void* ptr, size_t size, size_t n, int* ok) {
+    if(n>0 && fwrite(ptr,size,n,fp)!=n) *ok=0;
+}
+
+static void read_block(FILE* fp, void* ptr, size_t size, size_t n, char* filename) {
+    if(n>0 && fread(ptr,size,n,fp)!=n) {
+        printf("Can not read the checkpoint: %s (truncated)\n",filename);
+        exit(1);
+    }
+}
+
+static void write_rng(FILE* fp, gsl_rng* rng, int* ok) {
+    size_t size = gsl_rng_size(rng);
+    write_block(fp,&size,sizeof(size_t),1,ok);
+    if(gsl_rng_fwrite(fp,rng)!=0) *ok=0;
+}
+
+// the stream is skipped with rng==NULL (a thread stream that is rederived),
+// a stream that does not fit rng was written by another generator
+static void read_rng(FILE* fp, gsl_rng* rng, char* filename) {
+    size_t size;
+    read_block(fp,&size,sizeof(size_t),1,filename);
+    if(rng!=NULL) {
+        if(size!=gsl_rng_size(rng) || gsl_rng_fread(fp,rng)!=0) {
+            printf("Can not read the checkpoint: %s (random number state)\n",filename);
+            exit(1);
+        }
+        return;
+    }
+
+    if(fseek(fp,(long)size,SEEK_CUR)!=0) {
+        printf("Can not read the checkpoint: %s (random number state)\n",filename);
+        exit(1);
+    }
+}
+
+void save_checkpoint(char* filename, checkpoint* h, world_line** ws, chain** cs, gsl_rng** rngs, accumulator* a) {
+    char tempname[1024];
+    snprintf(tempname,sizeof(tempname),"%s.%ld.tmp",filename,(long)getpid());
+
+    // the output files have to be complete up to the checkpoint, and
+    // every file the run writes is open so its length is recorded
+    measurement_open(a);
+    cluster_statistic_stream();
+    output_mark* marks = (output_mark*)malloc(sizeof(output_mark)*OUTPUT_MAX_STREAMS);
+    int nmark = output_marks(marks,OUTPUT_MAX_STREAMS);
+
+    FILE* fp = fopen(tempname,"wb");
+    if(fp==NULL) {
+        printf("Can not write the checkpoint: %s\n",tempname);
+        free(marks);
+        return;
+    }
+
+    int ok=1;
+    write_block(fp,checkpoint_magic,sizeof(checkpoint_magic),1,&ok);
+    write_block(fp,h,sizeof(checkpoint),1,&ok);
+
+    for(int i_chain=0;i_chain<(h->nchain);i_chain++) {
+        world_line* w = ws[i_chain];
+        chain* c = cs[i_chain];
+
+        vertex* sequence = w->sequenceB;
+        if(w->flag)
+            sequence = w->sequenceA;
+
+        world_line_settle(w,rngs[i_chain]);
+        write_block(fp,&(w->beta),sizeof(double),1,&ok);
+        write_block(fp,&(w->nvertices),sizeof(int),1,&ok);
+        write_block(fp,w->istate,sizeof(int),w->nsite,&ok);
+        write_block(fp,w->pstate,sizeof(int),w->nsite,&ok);
+        write_block(fp,sequence,sizeof(vertex),w->nvertices,&ok);
+
+        write_rng(fp,rngs[i_chain],&ok);
+        write_block(fp,&(c->cstat_counter),sizeof(int),1,&ok);
+        write_block(fp,&(c->nthread),sizeof(int),1,&ok);
+        if(c->nthread>1) {
+            for(int i=0;i<(c->nthread);i++) write_rng(fp,c->rngs[i],&ok);
+        }
+    }
+
+    int allocated = (a->infected_ratio!=NULL);
+    write_block(fp,&allocated,sizeof(int),1,&ok);
+    if(allocated) {
+        write_block(fp,&(a->measurement_count),sizeof(unsigned long int),1,&ok);
+        write_block(fp,a->infected_ratio,sizeof(double),h->ntime,&ok);
+        write_block(fp,&(a->total_infected_time_ave),sizeof(double),1,&ok);
+        write_block(fp,&(a->ninfection_ave),sizeof(double),1,&ok);
+        write_block(fp,&(a->nrecover_ave),sizeof(double),1,&ok);
+        write_block(fp,&(a->ntrial_ave),sizeof(double),1,&ok);
+
+        for(int j=0;j<(a->nobs);j++) {
+            estimator* e = a->est[j];
+            write_block(fp,&(e->length),sizeof(int),1,&ok);
+            write_block(fp,&(e->n),sizeof(int),1,&ok);
+            write_block(fp,e->samples,sizeof(double),e->n,&ok);
+            write_block(fp,&(e->count),sizeof(unsigned long int),1,&ok);
+            write_block(fp,e->bin_partial,sizeof(double),ESTIMATOR_NLEVEL,&ok);
+            write_block(fp,e->bin_pending,sizeof(int),ESTIMATOR_NLEVEL,&ok);
+            write_block(fp,e->bin_sum,sizeof(double),ESTIMATOR_NLEVEL,&ok);
+            write_block(fp,e->bin_sum2,sizeof(double),ESTIMATOR_NLEVEL,&ok);
+            write_block(fp,e->bin_count,sizeof(unsigned long int),ESTIMATOR_NLEVEL,&ok);
+        }
+    }
+
+    write_block(fp,&nmark,sizeof(int),1,&ok);
+    write_block(fp,marks,sizeof(output_mark),nmark,&ok);
+    free(marks);
+
+    if(fclose(fp)!=0) ok=0;
+    if(ok && rename(tempname,filename)==0) return;
+
+    printf("Can not write the checkpoint: %s\n",filename);
+    remove(tempname);
+}
+
+int load_checkpoint(char* filename, checkpoint* h, world_line** ws, chain** cs, gsl_rng** rngs, accumulator* a) {
+    FILE* fp = fopen(filename,"rb");
+    if(fp==NULL) return 0;
+
+    char magic[8];
+    checkpoint stored;
+    read_block(fp,magic,sizeof(magic),1,filename);
+    if(memcmp(magic,checkpoint_magic,sizeof(magic))!=0) {
+        printf("Can not read the checkpoint: %s (not a checkpoint)\n",filename);
+        exit(1);
+    }
+    read_block(fp,&stored,sizeof(checkpoint),1,filename);
+
+    if(stored.alpha!=h->alpha || stored.gamma!=h->gamma || stored.T!=h->T ||
+       stored.nif!=h->nif || stored.running_mode!=h->running_mode ||
+       stored.ntime!=h->ntime || stored.nchain!=h->nchain || stored.nsite!=h->nsite ||
+       stored.block_size!=h->block_size || stored.seed!=h->seed) {
+        printf("The checkpoint %s belongs to another run!\n",filename);
+        printf("checkpoint : alpha=%g gamma=%g T=%g nif=%d mode=%d nchain=%d nsite=%d block_size=%d seed=%lu\n",
+                stored.alpha,stored.gamma,stored.T,stored.nif,stored.running_mode,stored.nchain,stored.nsite,
+                stored.block_size,stored.seed);
+        printf("this run   : alpha=%g gamma=%g T=%g nif=%d mode=%d nchain=%d nsite=%d block_size=%d seed=%lu\n",
+                h->alpha,h->gamma,h->T,h->nif,h->running_mode,h->nchain,h->nsite,h->block_size,h->seed);
+        exit(1);
+    }
+
+    for(int i_chain=0;i_chain<(h->nchain);i_chain++) {
+        world_line* w = ws[i_chain];
+        chain* c = cs[i_chain];
+        int nvertices;
+
+        read_block(fp,&(w->beta),sizeof(double),1,filename);
+        read_block(fp,&nvertices,sizeof(int),1,filename);
+        read_block(fp,w->istate,sizeof(int),w->nsite,filename);
+        read_block(fp,w->pstate,sizeof(int),w->nsite,filename);
+        w->nunset   = 0;
+        w->ninitial = -1;
+
+        w->nvertices = 0;
+        realloc_world_line(w,nvertices);
+        w->nvertices = nvertices;
+        w->flag = 1;
+        read_block(fp,w->sequenceA,sizeof(vertex),nvertices,filename);
+
+        read_rng(fp,rngs[i_chain],filename);
+        read_block(fp,&(c->cstat_counter),sizeof(int),1,filename);
+
+        // the thread streams are rederived if the number of threads changed
+        int nthread;
+        read_block(fp,&nthread,sizeof(int),1,filename);
+        int restored = (nthread==(c->nthread));
+        for(int i=0;i<nthread && nthread>1;i++) {
+            read_rng(fp,restored ? c->rngs[i] : NULL,filename);
+        }
+        if(!restored && c->nthread>1) chain_threads(c,c->nthread,rngs[i_chain]);
+    }
+
+    int allocated;
+    read_block(fp,&allocated,sizeof(int),1,filename);
+    if(allocated) {
+        read_block(fp,&(a->measurement_count),sizeof(unsigned long int),1,filename);
+
+        malloc_accumulator_buffers(a,h->nsite,h->ntime,h->block_size);
+        read_block(fp,a->infected_ratio,sizeof(double),h->ntime,filename);
+        read_block(fp,&(a->total_infected_time_ave),sizeof(double),1,filename);
+        read_block(fp,&(a->ninfection_ave),sizeof(double),1,filename);
+        read_block(fp,&(a->nrecover_ave),sizeof(double),1,filename);
+        read_block(fp,&(a->ntrial_ave),sizeof(double),1,filename);
+
+        for(int j=0;j<(a->nobs);j++) {
+            estimator* e = a->est[j];
+            int length;
+            read_block(fp,&length,sizeof(int),1,filename);
+            if(length!=(e->length)) {
+                printf("The checkpoint %s was measuring with block_size=%d, not %d!\n",filename,length,e->length);
+                exit(1);
+            }
+            read_block(fp,&(e->n),sizeof(int),1,filename);
+            read_block(fp,e->samples,sizeof(double),e->n,filename);
+            read_block(fp,&(e->count),sizeof(unsigned long int),1,filename);
+            read_block(fp,e->bin_partial,sizeof(double),ESTIMATOR_NLEVEL,filename);
+            read_block(fp,e->bin_pending,sizeof(int),ESTIMATOR_NLEVEL,filename);
+            read_block(fp,e->bin_sum,sizeof(double),ESTIMATOR_NLEVEL,filename);
+            read_block(fp,e->bin_sum2,sizeof(double),ESTIMATOR_NLEVEL,filename);
+            read_block(fp,e->bin_count,sizeof(unsigned long int),ESTIMATOR_NLEVEL,filename);
+        }
+    }
+
+    int nmark;
+    read_block(fp,&nmark,sizeof(int),1,filename);
+    if(nmark<0 || nmark>OUTPUT_MAX_STREAMS) {
+        printf("Can not read the checkpoint: %s (output files)\n",filename);
+        exit(1);
+    }
+    output_mark* marks = (output_mark*)malloc(sizeof(output_mark)*(nmark+1));
+    read_block(fp,marks,sizeof(output_mark),nmark,filename);
+    fclose(fp);
+
+    // the rows written after the checkpoint are written again from here on
+    output_truncate(marks,nmark);
+    free(marks);
+
+    h->thermal_done = stored.thermal_done;
+    h->i_sweep      = stored.i_sweep;
+
+    printf("resume from checkpoint %s : thermal=%d, samples=%d\n",filename,h->thermal_done,h->i_sweep);
+
+    return 1;
+}
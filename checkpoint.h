@@ -0,0 +1,77 @@
+#ifndef checkpoint_h
+#define checkpoint_h
+
+#include <gsl/gsl_rng.h>
+
+#include "dtype.h"
+
+/* Parameters and progress of a run stored with a checkpoint. The
+** parameters have to match the run that resumes from it; thermal_done and
+** i_sweep are the thermalization sweeps done and the samples merged into
+** the measurement.
+*/
+typedef struct checkpoint {
+    double alpha;
+    double gamma;
+    double T;
+    int nif;
+    int running_mode;
+    int block_size;
+    int ntime;
+    int nchain;
+    int nsite;
+    unsigned long int seed;
+    int thermal_done;
+    int i_sweep;
+} checkpoint;
+
+/**
+ * Writes the state of all chains and the measurement accumulator to a binary checkpoint file.
+ *
+ * Parameters:
+ *   filename (char*): Path of the checkpoint file.
+ *   h (checkpoint*): Parameters and progress of the run, h->nchain chains are written.
+ *   ws (world_line**): World-lines of the chains.
+ *   cs (chain**): Per-chain state; the streams of the threads of a chain and its statistic counter are written.
+ *   rngs (gsl_rng**): Random number streams of the chains, written with gsl_rng_fwrite.
+ *   a (accumulator*): Measurement accumulator shared by the chains.
+ *
+ * Behavior:
+ *   - For every chain writes beta, istate, pstate and the active vertex sequence, followed by the state of its
+ *     random number streams. The sites the last flip left unset are drawn from the chain's stream first (see
+ *     world_line_settle), so a resumed run continues as the run that wrote the checkpoint.
+ *   - Writes the block averages, counters and autocorrelation buffer of the accumulator if measuring has started.
+ *   - Flushes the output streams first, so the output files match the checkpoint, and records the length of every
+ *     file they write (the files of measurement() and 'cluster_statistic.txt' are opened for it if need be).
+ *   - Writes to a temporary file that replaces the checkpoint only once it is complete, so a job killed while
+ *     writing keeps the previous checkpoint.
+ *
+ * Outputs:
+ *   - The checkpoint file in native byte order. A failed write is reported and the run goes on.
+ */
+void save_checkpoint(char* filename, checkpoint* h, world_line** ws, chain** cs, gsl_rng** rngs, accumulator* a);
+
+/**
+ * Restores the state written by save_checkpoint.
+ *
+ * Parameters:
+ *   filename (char*): Path of the checkpoint file.
+ *   h (checkpoint*): Parameters of the current run; thermal_done and i_sweep are set from the checkpoint.
+ *   ws (world_line**): World-lines of the chains, allocated for h->nsite sites.
+ *   cs (chain**): Per-chain state, already set up for the threads of the current run.
+ *   rngs (gsl_rng**): Random number streams of the chains, allocated with the same generator.
+ *   a (accumulator*): Freshly allocated measurement accumulator.
+ *
+ * Behavior:
+ *   - Exits with an error if the file is not a checkpoint or its parameters (block_size and seed included) differ
+ *     from the current run, or if a chain stream was written by another generator.
+ *   - The streams of the threads are rederived from the chain stream if the number of threads changed.
+ *   - Cuts the output files back to the lengths they had at the checkpoint (see output_truncate): the rows a killed
+ *     run wrote after it are written again by the resumed run, not appended twice.
+ *
+ * Outputs:
+ *   - Returns 1 if the checkpoint was restored, 0 if the file does not exist.
+ */
+int load_checkpoint(char* filename, checkpoint* h, world_line** ws, chain** cs, gsl_rng** rngs, accumulator* a);
+
+#endif
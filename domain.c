@@ -0,0 +1,985 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <gsl/gsl_rng.h>
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
+
+#include "dtype.h"
+#include "networks.h"
+#include "sis_models.h"
+#include "union_find.h"
+#include "update.h"
+#include "measurement.h"
+#include "norm.h"
+#include "output.h"
+#include "rng.h"
+#include "instrument.h"
+#include "domain.h"
+
+static void domain_rank(int* rank, int* nrank) {
+    *rank  = 0;
+    *nrank = 1;
+#ifdef USE_MPI
+    MPI_Comm_rank(MPI_COMM_WORLD,rank);
+    MPI_Comm_size(MPI_COMM_WORLD,nrank);
+#endif
+}
+
+static void domain_sum(double* x, int n) {
+#ifdef USE_MPI
+    MPI_Allreduce(MPI_IN_PLACE,x,n,MPI_DOUBLE,MPI_SUM,MPI_COMM_WORLD);
+#endif
+}
+
+static int domain_any(int x) {
+#ifdef USE_MPI
+    MPI_Allreduce(MPI_IN_PLACE,&x,1,MPI_INT,MPI_MAX,MPI_COMM_WORLD);
+#endif
+    return x;
+}
+
+static void domain_error(domain* d, const char* message) {
+    printf("rank %d : %s\n",d->rank,message);
+#ifdef USE_MPI
+    MPI_Abort(MPI_COMM_WORLD,1);
+#endif
+    exit(1);
+}
+
+static void* domain_grow(void* p, int* cap, int n, size_t size) {
+    if(n<=(*cap)) return p;
+
+    int c = 2*(*cap);
+    if(c<n) c = n;
+    p = realloc(p,size*c);
+    if(p==NULL) {
+        printf("memory allocate error : domain_grow\n");
+        exit(-1);
+    }
+    *cap = c;
+    return p;
+}
+
+/* Sends the bytes sbuf[soff[k] ... soff[k+1]-1] to neighbour k and receives
+** the message of every neighbour into *rbuf (capacity *rcap), the one of k
+** from roff[k] on. The sizes go first, then the messages, all nonblocking.
+*/
+static void domain_exchange(domain* d, const char* sbuf, const int* soff, char** rbuf, int* rcap, int* roff) {
+    int nnb = d->nneighbour;
+    roff[0] = 0;
+    if(nnb==0) return;
+
+#ifdef USE_MPI
+    int* ssize = (int*)malloc(sizeof(int)*nnb);
+    int* rsize = (int*)malloc(sizeof(int)*nnb);
+    MPI_Request* request = (MPI_Request*)malloc(sizeof(MPI_Request)*2*nnb);
+
+    for(int k=0;k<nnb;k++) {
+        ssize[k] = soff[k+1]-soff[k];
+        MPI_Irecv(&(rsize[k]),1,MPI_INT,d->neighbour[k],0,MPI_COMM_WORLD,&(request[k]));
+        MPI_Isend(&(ssize[k]),1,MPI_INT,d->neighbour[k],0,MPI_COMM_WORLD,&(request[nnb+k]));
+    }
+    MPI_Waitall(2*nnb,request,MPI_STATUSES_IGNORE);
+
+    for(int k=0;k<nnb;k++) roff[k+1] = roff[k]+rsize[k];
+    *rbuf = (char*)domain_grow(*rbuf,rcap,roff[nnb],1);
+
+    for(int k=0;k<nnb;k++) {
+        MPI_Irecv(*rbuf+roff[k],rsize[k],MPI_BYTE,d->neighbour[k],1,MPI_COMM_WORLD,&(request[k]));
+        MPI_Isend((void*)(sbuf+soff[k]),ssize[k],MPI_BYTE,d->neighbour[k],1,MPI_COMM_WORLD,&(request[nnb+k]));
+    }
+    MPI_Waitall(2*nnb,request,MPI_STATUSES_IGNORE);
+
+    free(ssize);
+    free(rsize);
+    free(request);
+#else
+    (void)sbuf;
+    (void)soff;
+    (void)rbuf;
+    (void)rcap;
+#endif
+}
+
+// splitmix64 finalizer
+static inline unsigned long long domain_mix(unsigned long long x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x^(x>>30))*0xBF58476D1CE4E5B9ULL;
+    x = (x^(x>>27))*0x94D049BB133111EBULL;
+    return x^(x>>31);
+}
+
+// uniform in [0, 1), the same on every rank for the same keys in the same sweep
+static double domain_uniform(const domain* d, unsigned long long key1, unsigned long long key2) {
+    unsigned long long x = domain_mix((unsigned long long)(d->seed)^domain_mix(d->nsweep));
+    x = domain_mix(x^key1);
+    x = domain_mix(x^key2);
+    return (x>>11)*(1.0/9007199254740992.0);
+}
+
+static unsigned long long domain_tau_key(double tau) {
+    unsigned long long key;
+    memcpy(&key,&tau,sizeof(key));
+    return key;
+}
+
+domain* malloc_domain(network* g, double alpha, double gamma, unsigned long int seed) {
+    domain* d = (domain*)malloc(sizeof(domain));
+    if(d==NULL) {
+        printf("memory allocate error : malloc_domain\n");
+        exit(-1);
+    }
+    domain_rank(&(d->rank),&(d->nrank));
+    if(d->nrank>(g->nnode)) {
+        printf("A domain-decomposed run needs a node per rank (nnode=%d, nrank=%d)!\n",g->nnode,d->nrank);
+        exit(1);
+    }
+
+    int* part = network_partition(g,d->nrank);
+    d->nnode = g->nnode;
+    d->g = network_halo(g,part,d->rank,&(d->nown),&(d->node_map),&(d->edge_map));
+    d->nlocal = d->g->nnode;
+    d->m = sis_model_uniform_infection(alpha,gamma,d->g);
+
+    int nown   = d->nown;
+    int nlocal = d->nlocal;
+    int nedge  = d->g->nedge;
+    network* h = d->g;
+
+    // the neighbours are the parts of the halo sites, in increasing rank
+    int* index = (int*)malloc(sizeof(int)*(d->nrank));
+    for(int r=0;r<(d->nrank);r++) index[r] = -1;
+    for(int i=nown;i<nlocal;i++) index[part[d->node_map[i]]] = -2;
+    d->neighbour = (int*)malloc(sizeof(int)*(d->nrank));
+    d->nneighbour = 0;
+    for(int r=0;r<(d->nrank);r++) {
+        if(index[r]==-2) {
+            index[r] = d->nneighbour;
+            d->neighbour[d->nneighbour++] = r;
+        }
+    }
+    int nnb = d->nneighbour;
+
+    d->site_partner = (int*)malloc(sizeof(int)*(nlocal>0 ? nlocal : 1));
+    for(int i=0;i<nlocal;i++) d->site_partner[i] = (i<nown) ? -1 : index[part[d->node_map[i]]];
+
+    d->edge_partner = (int*)malloc(sizeof(int)*(nedge>0 ? nedge : 1));
+    for(int e=0;e<nedge;e++) {
+        int a = h->edges[2*e+0];
+        int b = h->edges[2*e+1];
+        d->edge_partner[e] = (a>=nown) ? d->site_partner[a] : ((b>=nown) ? d->site_partner[b] : -1);
+    }
+
+    // an owned site goes to every neighbour it has a halo edge to, once
+    int* seen  = (int*)malloc(sizeof(int)*(nnb>0 ? nnb : 1));
+    int* count = (int*)malloc(sizeof(int)*(nnb+1));
+    d->send_offset = (int*)calloc(nnb+1,sizeof(int));
+    d->recv_offset = (int*)calloc(nnb+1,sizeof(int));
+    for(int pass=0;pass<2;pass++) {
+        for(int k=0;k<nnb;k++) {
+            seen[k]  = -1;
+            count[k] = d->send_offset[k];
+        }
+        for(int i=0;i<nown;i++) {
+            for(int q=h->offset[i];q<(h->offset[i+1]);q++) {
+                int j = h->adjacency[q];
+                if(j<nown || seen[d->site_partner[j]]==i) continue;
+                int k = d->site_partner[j];
+                seen[k] = i;
+                if(pass==1) d->send_site[count[k]] = i;
+                count[k]++;
+            }
+        }
+        if(pass==0) {
+            for(int k=0;k<nnb;k++) d->send_offset[k+1] = d->send_offset[k]+count[k];
+            d->send_site = (int*)malloc(sizeof(int)*(d->send_offset[nnb]+1));
+        }
+    }
+
+    // the halo sites of a neighbour, in the order it sends them
+    for(int i=nown;i<nlocal;i++) d->recv_offset[d->site_partner[i]+1]++;
+    for(int k=0;k<nnb;k++) {
+        d->recv_offset[k+1] += d->recv_offset[k];
+        count[k] = d->recv_offset[k];
+    }
+    d->recv_site = (int*)malloc(sizeof(int)*(d->recv_offset[nnb]+1));
+    for(int i=nown;i<nlocal;i++) d->recv_site[count[d->site_partner[i]]++] = i;
+    free(count);
+    free(seen);
+    free(index);
+    free(part);
+
+    d->timeline = malloc_conf(4*nlocal,nlocal);
+    d->halo     = malloc_conf(4*(nlocal-nown),nlocal-nown);
+    d->nevent    = 0;
+    d->event_cap = 0;
+    d->event     = NULL;
+    d->label_cap = 0;
+    d->gid       = NULL;
+    d->gfixed    = NULL;
+    d->shared_offset = (int*)calloc(nnb+1,sizeof(int));
+    d->shared     = NULL;
+    d->shared_cap = 0;
+    d->seed   = seed;
+    d->nsweep = 0;
+
+    return d;
+}
+
+void free_domain(domain* d) {
+    free_model(d->m);
+    free_network(d->g);
+    free(d->node_map);
+    free(d->edge_map);
+    free(d->neighbour);
+    free(d->edge_partner);
+    free(d->site_partner);
+    free(d->send_offset);
+    free(d->send_site);
+    free(d->recv_offset);
+    free(d->recv_site);
+    free_conf(d->timeline);
+    free_conf(d->halo);
+    free(d->event);
+    free(d->gid);
+    free(d->gfixed);
+    free(d->shared_offset);
+    free(d->shared);
+    free(d);
+}
+
+static int event_compare(const void* a, const void* b) {
+    double ta = ((const domain_event*)a)->tau;
+    double tb = ((const domain_event*)b)->tau;
+    return (ta>tb)-(ta<tb);
+}
+
+void domain_exchange_timelines(domain* d, world_line* w) {
+    conf* c = d->timeline;
+    world_line_to_conf(c,w,d->m);
+
+    int nnb  = d->nneighbour;
+    int nown = d->nown;
+    int nhalo = d->nlocal-nown;
+
+    // a timeline goes as its number of entries and the (state, tau) pairs, all doubles
+    int* soff = (int*)malloc(sizeof(int)*(nnb+1));
+    int* roff = (int*)malloc(sizeof(int)*(nnb+1));
+    soff[0] = 0;
+    for(int k=0;k<nnb;k++) {
+        int n=0;
+        for(int q=d->send_offset[k];q<(d->send_offset[k+1]);q++) {
+            int i = d->send_site[q];
+            n += 1+2*(c->offset[i+1]-c->offset[i]);
+        }
+        soff[k+1] = soff[k]+n*(int)sizeof(double);
+    }
+    double* sbuf = (double*)malloc(soff[nnb]+sizeof(double));
+    int n=0;
+    for(int k=0;k<nnb;k++) {
+        for(int q=d->send_offset[k];q<(d->send_offset[k+1]);q++) {
+            int i = d->send_site[q];
+            sbuf[n++] = c->offset[i+1]-c->offset[i];
+            for(int e=c->offset[i];e<(c->offset[i+1]);e++) {
+                sbuf[n++] = c->sigma[e];
+                sbuf[n++] = c->tau[e];
+            }
+        }
+    }
+
+    char* rbuf = NULL;
+    int rcap = 0;
+    domain_exchange(d,(const char*)sbuf,soff,&rbuf,&rcap,roff);
+
+    // the sizes of the halo timelines, then the entries
+    conf* h = d->halo;
+    for(int pass=0;pass<2;pass++) {
+        for(int k=0;k<nnb;k++) {
+            const double* r = (const double*)(rbuf+roff[k]);
+            const double* end = (const double*)(rbuf+roff[k+1]);
+            for(int q=d->recv_offset[k];q<(d->recv_offset[k+1]);q++) {
+                if(r>=end) domain_error(d,"a neighbour sent fewer halo timelines than expected!");
+                int i = d->recv_site[q]-nown;
+                int len = (int)r[0];
+                if(pass==0) {
+                    h->offset[i+1] = len;
+                } else {
+                    for(int e=0;e<len;e++) {
+                        h->sigma[h->offset[i]+e] = (signed char)r[1+2*e];
+                        h->tau[h->offset[i]+e]   = r[2+2*e];
+                    }
+                }
+                r += 1+2*len;
+            }
+            if(r!=end) domain_error(d,"a neighbour sent more halo timelines than expected!");
+        }
+        if(pass==0) {
+            h->offset[0] = 0;
+            for(int i=0;i<nhalo;i++) h->offset[i+1] += h->offset[i];
+            realloc_conf(h,h->offset[nhalo]);
+        }
+    }
+
+    // every entry after the first is a change of the halo site
+    int nevent = h->offset[nhalo]-nhalo;
+    d->event = (domain_event*)domain_grow(d->event,&(d->event_cap),nevent,sizeof(domain_event));
+    n=0;
+    for(int i=0;i<nhalo;i++) {
+        for(int e=h->offset[i]+1;e<(h->offset[i+1]);e++) {
+            d->event[n].tau   = h->tau[e];
+            d->event[n].site  = nown+i;
+            d->event[n].state = h->sigma[e];
+            n++;
+        }
+    }
+    d->nevent = nevent;
+    qsort(d->event,nevent,sizeof(domain_event),event_compare);
+
+    free(sbuf);
+    free(rbuf);
+    free(soff);
+    free(roff);
+}
+
+static int ghost_compare(const void* a, const void* b) {
+    const domain_ghost* ga = (const domain_ghost*)a;
+    const domain_ghost* gb = (const domain_ghost*)b;
+    if(ga->tau!=gb->tau) return (ga->tau>gb->tau)-(ga->tau<gb->tau);
+    return (ga->edge>gb->edge)-(ga->edge<gb->edge);
+}
+
+static int edge_compare(const void* a, const void* b) {
+    int ea = *(const int*)a;
+    int eb = *(const int*)b;
+    return (ea>eb)-(ea<eb);
+}
+
+// local edge (bond offset inside its type) of the edge graph v
+static inline int vertex_edge(const model* m, const vertex* v) {
+    return (v->bond)-(m->type2offset[bond_type(m,v->bond)]);
+}
+
+// swap_graph of update.c; a cross vertex draws from the hash, as its copy on the other rank does
+static void domain_swap_graph(domain* d, vertex* v, gsl_rng* rng) {
+    model* m  = d->m;
+    int type  = bond_type(m,v->bond);
+    int first = m->swap_offset[type];
+    int n     = m->swap_offset[type+1]-first;
+    if(n==0) return;
+
+    double u;
+    int e = (v->hNspin==2) ? vertex_edge(m,v) : -1;
+    if(e>=0 && d->edge_partner[e]>=0) {
+        u = domain_uniform(d,(unsigned long long)(d->edge_map[e]),domain_tau_key(v->tau));
+    } else {
+        u = rng_uniform_pos(rng);
+    }
+
+    int k = (int)(u*n);
+    if(k>=n) k=n-1;
+    int type2 = m->swap_type[first+k];
+    v->bond += m->type2offset[type2]-m->type2offset[type];
+}
+
+// vertex_candidate_state of update.c, the halo sites read from their owners' timelines
+static inline int domain_candidate_state(const model* m, vertex* v, int bond, const int* pstate, int hNspin) {
+    int packed=0;
+    for(int j=0;j<hNspin;j++) {
+        int state = pstate[bond_index(m,bond,j)];
+        vertex_set_state(v,j,state);
+        vertex_set_state(v,j+hNspin,state);
+        packed |= (state==1)<<j;
+    }
+    return packed;
+}
+
+static int domain_vertex_is_active(const vertex* v) {
+    for(int j=0;j<(v->hNspin);j++) {
+        if(vertex_state(v,j)!=vertex_state(v,j+(v->hNspin))) return 1;
+    }
+    return 0;
+}
+
+// a kept vertex: counted on the rank that samples it, its owned sites take the states above it
+static void domain_keep_vertex(domain* d, chain* c, vertex* v, int* pstate, gsl_rng* rng) {
+    model* m = d->m;
+    if(v->hNspin==1) {
+        c->nrecover++;
+    } else if(v->hNspin==2 && bond_index(m,v->bond,0)<(d->nown)) {
+        c->ninfection++;
+    }
+
+    domain_swap_graph(d,v,rng);
+    for(int j=0;j<(v->hNspin);j++) {
+        int index = bond_index(m,v->bond,j);
+        if(index<(d->nown)) pstate[index] = vertex_state(v,(v->hNspin)+j);
+    }
+}
+
+static void domain_link_leg(world_line* w, int i, int id, int weight) {
+    w->cluster[id] = id;
+    w->weight[id]  = weight;
+    if(w->first[i]==-1) {
+        w->first[i] = id;
+    } else {
+        merge(w->cluster,w->weight,w->last[i],id);
+    }
+    w->last[i] = id;
+}
+
+static void domain_label_leg(world_line* w, int idv, int* nlabel) {
+    int idr = root(w->cluster,idv);
+    if(w->label[idr]==-1) {
+        w->label[idr] = *nlabel;
+        w->cweight[*nlabel] = w->weight[idr];
+        (*nlabel)++;
+    }
+    w->label[idv] = w->label[idr];
+}
+
+/* The clusters of the local legs, as clustering() builds them, except that
+** only the world-lines of the owned sites are linked; a halo leg of a cross
+** vertex is tied to the rest of its vertex by the rule alone.
+*/
+static void domain_clustering(domain* d, world_line* w) {
+    model* m   = d->m;
+    int mnspin = w->mnspin;
+    int nown   = d->nown;
+    int* first = w->first;
+    int* last  = w->last;
+    int* final = &(w->boundary_site[w->nsite]);
+
+    vertex* sequence = w->sequenceB;
+    if(w->flag)
+        sequence = w->sequenceA;
+
+    for(int i=0;i<(w->nsite);i++) {
+        first[i] = -1;
+        last[i]  = -1;
+    }
+
+    int bweight = m->link[4*(m->mhnspin)*bond_type(m,m->nbond)+2];
+    for(int k=0;k<(w->nboundary_initial);k++) {
+        int i = w->boundary_site[k];
+        domain_link_leg(w,i,boundary_leg_initial(w,i),bweight);
+    }
+
+    for(int n=0;n<(w->nvertices);n++) {
+        vertex* v  = &(sequence[n]);
+        int hNspin = v->hNspin;
+        int* rule  = &(m->link[4*(m->mhnspin)*bond_type(m,v->bond)]);
+
+        for(int j=0;j<2*hNspin;j++) {
+            w->cluster[n*mnspin+j] = n*mnspin+rule[j];
+            w->weight[n*mnspin+j]  = rule[2*hNspin+j];
+        }
+        for(int j=0;j<hNspin;j++) {
+            int index = bond_index(m,v->bond,j);
+            if(index>=nown) continue;
+
+            int idp = n*mnspin+j;
+            int idn = n*mnspin+j+hNspin;
+            if(first[index]==-1) {
+                first[index] = idp;
+            } else {
+                merge(w->cluster,w->weight,last[index],idp);
+            }
+            last[index] = idn;
+        }
+    }
+
+    for(int k=0;k<(w->nboundary_final);k++) {
+        domain_link_leg(w,final[k],boundary_leg_final(w,final[k]),bweight);
+    }
+
+    for(int k=0;k<(w->nboundary_initial);k++) w->label[boundary_leg_initial(w,w->boundary_site[k])] = -1;
+    for(int k=0;k<(w->nboundary_final);k++) w->label[boundary_leg_final(w,final[k])] = -1;
+    for(int n=0;n<(w->nvertices);n++) {
+        for(int j=0;j<2*(sequence[n].hNspin);j++) w->label[n*mnspin+j] = -1;
+    }
+
+    int nlabel=0;
+    for(int k=0;k<(w->nboundary_initial);k++) domain_label_leg(w,boundary_leg_initial(w,w->boundary_site[k]),&nlabel);
+    for(int n=0;n<(w->nvertices);n++) {
+        for(int j=0;j<2*(sequence[n].hNspin);j++) domain_label_leg(w,n*mnspin+j,&nlabel);
+    }
+    for(int k=0;k<(w->nboundary_final);k++) domain_label_leg(w,boundary_leg_final(w,final[k]),&nlabel);
+    w->nlabel = nlabel;
+}
+
+/* The global roots of the clusters. A cluster of rank r starts as the root
+** r<<32|label; the ranks of a cross vertex hold its four legs both, so they
+** exchange the roots and fixed flags of those legs and keep the smallest
+** root and either flag, until no rank changes one. The cross vertices with
+** neighbour k are shared in time order, the same order on both ranks.
+*/
+static void domain_global_clusters(domain* d, world_line* w) {
+    model* m   = d->m;
+    int nnb    = d->nneighbour;
+    int mnspin = w->mnspin;
+    int nlabel = w->nlabel;
+
+    vertex* sequence = w->sequenceB;
+    if(w->flag)
+        sequence = w->sequenceA;
+
+    if(nlabel>(d->label_cap)) {
+        free(d->gid);
+        free(d->gfixed);
+        d->label_cap = 2*nlabel;
+        d->gid    = (long long*)malloc(sizeof(long long)*(d->label_cap));
+        d->gfixed = (unsigned char*)malloc(sizeof(unsigned char)*(d->label_cap));
+    }
+    for(int l=0;l<nlabel;l++) {
+        d->gid[l]    = (((long long)(d->rank))<<32)|l;
+        d->gfixed[l] = (w->cweight[l]<0);
+    }
+
+    int* count = (int*)calloc(nnb+1,sizeof(int));
+    for(int n=0;n<(w->nvertices);n++) {
+        if(sequence[n].hNspin!=2) continue;
+        int k = d->edge_partner[vertex_edge(m,&(sequence[n]))];
+        if(k>=0) count[k]++;
+    }
+    d->shared_offset[0] = 0;
+    for(int k=0;k<nnb;k++) d->shared_offset[k+1] = d->shared_offset[k]+count[k];
+    int nshared = d->shared_offset[nnb];
+    d->shared = (int*)domain_grow(d->shared,&(d->shared_cap),nshared,sizeof(int));
+    for(int k=0;k<nnb;k++) count[k] = d->shared_offset[k];
+    for(int n=0;n<(w->nvertices);n++) {
+        if(sequence[n].hNspin!=2) continue;
+        int k = d->edge_partner[vertex_edge(m,&(sequence[n]))];
+        if(k>=0) d->shared[count[k]++] = n;
+    }
+    free(count);
+
+    // the root and the flag of every leg of the shared vertices
+    int* soff = (int*)malloc(sizeof(int)*(nnb+1));
+    int* roff = (int*)malloc(sizeof(int)*(nnb+1));
+    for(int k=0;k<=nnb;k++) soff[k] = (d->shared_offset[k])*8*(int)sizeof(long long);
+    long long* sbuf = (long long*)malloc(sizeof(long long)*(8*nshared+1));
+    char* rbuf = NULL;
+    int rcap = 0;
+
+    int changed=1;
+    while(changed) {
+        for(int q=0;q<nshared;q++) {
+            int n = d->shared[q];
+            for(int j=0;j<4;j++) {
+                int l = w->label[n*mnspin+j];
+                sbuf[8*q+2*j+0] = d->gid[l];
+                sbuf[8*q+2*j+1] = d->gfixed[l];
+            }
+        }
+        domain_exchange(d,(const char*)sbuf,soff,&rbuf,&rcap,roff);
+
+        changed=0;
+        for(int k=0;k<nnb;k++) {
+            if(roff[k+1]-roff[k]!=soff[k+1]-soff[k]) {
+                domain_error(d,"the ranks of the cross vertices hold different sequences!");
+            }
+            const long long* r = (const long long*)(rbuf+roff[k]);
+            for(int q=d->shared_offset[k];q<(d->shared_offset[k+1]);q++) {
+                int n = d->shared[q];
+                for(int j=0;j<4;j++) {
+                    int l = w->label[n*mnspin+j];
+                    if(r[0]<(d->gid[l])) {
+                        d->gid[l] = r[0];
+                        changed = 1;
+                    }
+                    if(r[1] && !(d->gfixed[l])) {
+                        d->gfixed[l] = 1;
+                        changed = 1;
+                    }
+                    r += 2;
+                }
+            }
+        }
+        changed = domain_any(changed);
+    }
+
+    free(sbuf);
+    free(rbuf);
+    free(soff);
+    free(roff);
+}
+
+void domain_sweep(domain* d, chain* c, world_line* w, int final_type, double p, gsl_rng* rng) {
+    model* m   = d->m;
+    int nown   = d->nown;
+    int nlocal = d->nlocal;
+    int nnb    = d->nneighbour;
+
+    d->nsweep++;
+#ifdef USE_PERF
+    if(c->perf_fd[0]==-2) counters_perf_open(c);
+#endif
+    uniform_sequence_sampling(c,m,(m->sweight)*(w->beta),0,rng);
+
+    double* insert_seq = c->insert_seq;
+    int* insert_bond   = c->insert_bond;
+    int  insert_len    = c->insert_len;
+
+    if(c->insert_cap+(w->nvertices)>(w->length)) c->count.reallocs++;
+    realloc_world_line(w,c->insert_cap+(w->nvertices));
+
+    vertex* sequence1 = w->sequenceB;
+    vertex* sequence2 = w->sequenceA;
+    if(w->flag) {
+        sequence1 = w->sequenceA;
+        sequence2 = w->sequenceB;
+    }
+
+    // the halo sites start from the timelines of their owners
+    int* pstate = w->pstate;
+    for(int i=0;i<nown;i++) pstate[i] = w->istate[i];
+    for(int i=nown;i<nlocal;i++) pstate[i] = d->halo->sigma[d->halo->offset[i-nown]];
+
+    c->ninfection=0;
+    c->nrecover=0;
+    c->obs_ready=0;
+
+    // the accepted cross candidates, sent to the other rank of their edge
+    int nghost=0, ghost_cap=0;
+    domain_ghost* ghost = NULL;
+    int* ghost_partner  = NULL;
+    int partner_cap=0;
+
+    vertex* v;
+    int nvertices = w->nvertices;
+    int n=0, k=0, ev=0, naccepted=0;
+    while(k<nvertices && !domain_vertex_is_active(&(sequence1[k]))) k++;
+    double tau1 = (k<nvertices) ? (sequence1[k]).tau : 0;
+
+    for(int i=0;i<insert_len;i++) {
+        double tau2 = insert_seq[i];
+
+        while((tau1<tau2) && (k<nvertices)) {
+            v = &(sequence1[k]);
+            domain_keep_vertex(d,c,v,pstate,rng);
+            copy_vertex(&(sequence2[n]),v);
+            n++;
+
+            k++;
+            while(k<nvertices && !domain_vertex_is_active(&(sequence1[k]))) k++;
+            if(k<nvertices) tau1 = (sequence1[k]).tau;
+        }
+        while(ev<(d->nevent) && d->event[ev].tau<tau2) {
+            pstate[d->event[ev].site] = d->event[ev].state;
+            ev++;
+        }
+
+        // a graph of a part that does not own it has no weight here, the
+        // alias table could still return it by round-off
+        int bond = insert_bond[i];
+        if(tau1==tau2 || bond_weight(m,bond)<=0) continue;
+
+        int hNspin = bond_hNspin(m,bond);
+        v = &(sequence2[n]);
+        int packed = VERTEX_KERNEL(hNspin,domain_candidate_state,m,v,bond,pstate);
+
+        int type = bond_type(m,bond);
+        if(insert_accept(m,type,packed)) {
+            v->tau    = tau2;
+            v->bond   = bond;
+            v->hNspin = hNspin;
+            n++;
+            naccepted++;
+
+            int e = (hNspin==2) ? vertex_edge(m,v) : -1;
+            if(e>=0 && d->edge_partner[e]>=0) {
+                ghost = (domain_ghost*)domain_grow(ghost,&ghost_cap,nghost+1,sizeof(domain_ghost));
+                ghost_partner = (int*)domain_grow(ghost_partner,&partner_cap,nghost+1,sizeof(int));
+                ghost[nghost].tau   = tau2;
+                ghost[nghost].type  = type;
+                ghost[nghost].edge  = d->edge_map[e];
+                ghost[nghost].state = packed;
+                ghost_partner[nghost] = d->edge_partner[e];
+                nghost++;
+            }
+        }
+    }
+
+    while(k<nvertices) {
+        v = &(sequence1[k]);
+        domain_keep_vertex(d,c,v,pstate,rng);
+        copy_vertex(&(sequence2[n]),v);
+        n++;
+
+        k++;
+        while(k<nvertices && !domain_vertex_is_active(&(sequence1[k]))) k++;
+    }
+    c->count.sweeps++;
+    c->count.candidates += insert_len;
+    c->count.accepted   += naccepted;
+    c->count.removed    += nvertices-(n-naccepted);
+    w->nvertices = n;
+
+    // the boundaries of the owned sites, type 1 on the infected sites of the whole network
+    int* site = w->boundary_site;
+    for(int i=0;i<nown;i++) site[i] = i;
+    w->nboundary_initial = nown;
+
+    site = &(w->boundary_site[w->nsite]);
+    int nfinal=0;
+    if(final_type==1) {
+        double inf=0;
+        for(int i=0;i<nown;i++) inf += (pstate[i]+1)/2;
+        domain_sum(&inf,1);
+
+        double pdis = 1.0;
+        if(inf!=0) pdis=(p*(d->nnode))/inf;
+        if(inf>p*(d->nnode)) pdis=0;
+        for(int i=0;i<nown;i++) {
+            if(pstate[i]==1 && (rng_uniform_pos(rng)<pdis)) site[nfinal++] = i;
+        }
+    } else {
+        for(int i=0;i<nown;i++) {
+            if(final_type==0 || pstate[i]==-1) site[nfinal++] = i;
+        }
+    }
+    w->nboundary_final = nfinal;
+
+    // the cross candidates of the neighbours, by neighbour
+    int* soff = (int*)calloc(nnb+1,sizeof(int));
+    int* roff = (int*)malloc(sizeof(int)*(nnb+1));
+    for(int q=0;q<nghost;q++) soff[ghost_partner[q]+1]++;
+    for(int q=0;q<nnb;q++) soff[q+1] += soff[q];
+    domain_ghost* sbuf = (domain_ghost*)malloc(sizeof(domain_ghost)*(nghost+1));
+    int* fill = (int*)malloc(sizeof(int)*(nnb+1));
+    for(int q=0;q<=nnb;q++) fill[q] = soff[q];
+    for(int q=0;q<nghost;q++) sbuf[fill[ghost_partner[q]]++] = ghost[q];
+    for(int q=0;q<=nnb;q++) soff[q] *= (int)sizeof(domain_ghost);
+    free(fill);
+
+    char* rbuf = NULL;
+    int rcap = 0;
+    domain_exchange(d,(const char*)sbuf,soff,&rbuf,&rcap,roff);
+    int nrecv = roff[nnb]/(int)sizeof(domain_ghost);
+
+    if(nrecv>0 && rbuf!=NULL) {
+        // merged into the old sequence, which becomes the active one
+        realloc_world_line(w,n+nrecv);
+        sequence1 = w->sequenceB;
+        sequence2 = w->sequenceA;
+        if(w->flag) {
+            sequence1 = w->sequenceA;
+            sequence2 = w->sequenceB;
+        }
+
+        domain_ghost* recv = (domain_ghost*)rbuf;
+        qsort(recv,nrecv,sizeof(domain_ghost),ghost_compare);
+
+        int a=0, b=0, out=0;
+        while(a<n || b<nrecv) {
+            if(b==nrecv || (a<n && sequence2[a].tau<=recv[b].tau)) {
+                copy_vertex(&(sequence1[out++]),&(sequence2[a++]));
+                continue;
+            }
+
+            int* e = (int*)bsearch(&(recv[b].edge),d->edge_map,d->g->nedge,sizeof(int),edge_compare);
+            if(e==NULL) domain_error(d,"a neighbour sent a vertex on an edge of another part!");
+            v = &(sequence1[out++]);
+            v->tau    = recv[b].tau;
+            v->bond   = m->type2offset[recv[b].type]+(int)(e-(d->edge_map));
+            v->hNspin = 2;
+            for(int j=0;j<2;j++) {
+                int state = ((recv[b].state>>j)&1) ? 1 : -1;
+                vertex_set_state(v,j,state);
+                vertex_set_state(v,j+2,state);
+            }
+            b++;
+        }
+        w->nvertices = out;
+    } else {
+        w->flag = !(w->flag);
+    }
+
+    free(ghost);
+    free(ghost_partner);
+    free(sbuf);
+    free(rbuf);
+    free(soff);
+    free(roff);
+
+    domain_clustering(d,w);
+    domain_global_clusters(d,w);
+}
+
+void domain_flip_cluster(domain* d, chain* c, world_line* w, gsl_rng* rng) {
+    int mnspin = w->mnspin;
+    int* label   = w->label;
+    int* cweight = w->cweight;
+
+    vertex* sequence = w->sequenceB;
+    if(w->flag)
+        sequence = w->sequenceA;
+
+    // a cluster fixed on any rank is fixed, the free ones flip as in flip_cluster
+    for(int l=0;l<(w->nlabel);l++) {
+        if(d->gfixed[l]) {
+            cweight[l] = -1;
+        } else if(domain_uniform(d,(unsigned long long)(d->gid[l]),0)<1.0) {
+            cweight[l] =  0;
+        } else {
+            cweight[l] = -1;
+        }
+    }
+
+    for(int i=0;i<(w->nvertices);i++) {
+        vertex* v = &(sequence[i]);
+        for(int j=0;j<2*(v->hNspin);j++) {
+            if(cweight[label[i*mnspin+j]]==0) vertex_flip_state(v,j);
+        }
+    }
+
+    for(int i=0;i<(d->nown);i++) {
+        int id = w->first[i];
+        if(id==-1) {
+            w->istate[i] = (rng_uniform_pos(rng)<0.5) ? 1 : -1;
+            w->pstate[i] = w->istate[i];
+            continue;
+        }
+        if(!is_boundary_leg(w,id)) w->istate[i] = vertex_state(&(sequence[id/mnspin]),id%mnspin);
+
+        id = w->last[i];
+        if(!is_boundary_leg(w,id)) w->pstate[i] = vertex_state(&(sequence[id/mnspin]),id%mnspin);
+    }
+
+    domain_exchange_timelines(d,w);
+}
+
+// first slice at or after tau
+static int slice_lower_bound(const double* time_list, int ntime, double tau) {
+    int lo=0, hi=ntime;
+    while(lo<hi) {
+        int mid = (lo+hi)/2;
+        if(time_list[mid]<tau) lo = mid+1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+void domain_observe(domain* d, chain* c, world_line* w, const double* time_list, int ntime, double* obs) {
+    conf* t = d->timeline;
+    double* ratio = &(obs[5]);
+    for(int s=0;s<5+ntime;s++) obs[s] = 0;
+    obs[0] = c->ninfection;
+    obs[1] = c->nrecover;
+
+    // an infected stretch of a timeline adds 1 to the slices it covers,
+    // counted as +1 at its first slice and -1 after its last
+    double* diff = (double*)calloc(ntime+1,sizeof(double));
+    for(int i=0;i<(d->nown);i++) {
+        int end = t->offset[i+1];
+        for(int e=t->offset[i];e<end;e++) {
+            if(t->sigma[e]!=1) continue;
+            double tau0 = t->tau[e];
+            double tau1 = (e+1<end) ? t->tau[e+1] : 1.0;
+            obs[2] += tau1-tau0;
+            diff[slice_lower_bound(time_list,ntime,tau0)] += 1;
+            diff[(e+1<end) ? slice_lower_bound(time_list,ntime,tau1) : ntime] -= 1;
+        }
+        obs[3] += (w->istate[i]==1);
+        obs[4] += (w->pstate[i]==1);
+    }
+    double sum=0;
+    for(int s=0;s<ntime;s++) {
+        sum += diff[s];
+        ratio[s] = sum;
+    }
+    free(diff);
+
+    domain_sum(obs,5+ntime);
+}
+
+void domain_run(network* g, double alpha, double gamma, double T, int nif, int running_mode, int block_size,
+                int nblock, int thermal, int nskip, unsigned long int seed) {
+    if(running_mode!=0 && running_mode!=2) {
+        printf("A domain-decomposed run pins every site at tau=0, there is no running mode %d for it!\n",running_mode);
+        exit(1);
+    }
+    int nsweep = nblock*block_size;
+    int final_type = (running_mode==0) ? 1 : 2;
+    int nocheck = (running_mode==2);
+    double pnif = ((double)nif)/(g->nnode);
+
+    domain* d = malloc_domain(g,alpha,gamma,seed);
+    gsl_rng* rng = gsl_rng_alloc(rng_chain_type());
+    gsl_rng_set(rng,seed+(d->rank));
+    chain* c = malloc_chain();
+    world_line* w = malloc_world_line(world_line_capacity(d->m,T),2*(d->m->mhnspin),d->nlocal);
+    w->beta = T;
+
+    // the initial state of running_mode_setup on the whole network
+    int zero = nearest_nb_arg_max_degree(g);
+    for(int i=0;i<(d->nlocal);i++) {
+        w->istate[i] = (running_mode==2 || d->node_map[i]==zero) ? 1 : -1;
+        w->pstate[i] = w->istate[i];
+    }
+    domain_exchange_timelines(d,w);
+
+    double dt = T/100.0;
+    int ntime = (int)(T/dt+1);
+    double* time_list = (double*)malloc(sizeof(double)*ntime);
+    for(int i=0;i<ntime;i++) {
+        time_list[i] = (dt*i)/T;
+    }
+    double* obs = (double*)malloc(sizeof(double)*(5+ntime));
+
+    // rank 0 measures the sums, as recorded by flip_cluster
+    accumulator* a = NULL;
+    if(d->rank==0) {
+        a = malloc_accumulator();
+        a->conf_output = 0;
+        chain_observe(c,d->m,time_list,ntime);
+    }
+
+    progress thermal_progress;
+    if(d->rank==0) progress_start(&thermal_progress,"thermal",thermal);
+    for(int i=0;i<thermal;i++) {
+        domain_sweep(d,c,w,final_type,pnif,rng);
+        domain_flip_cluster(d,c,w,rng);
+        if(d->rank==0) progress_update(&thermal_progress,i+1);
+    }
+    counters_reset(&(c->count));
+
+    int ntrial=0;
+    progress sample_progress;
+    if(d->rank==0) progress_start(&sample_progress,"measurement",nsweep);
+    for(int i_sweep=0;i_sweep<nsweep;) {
+        for(int i=0;i<nskip;i++) {
+            domain_sweep(d,c,w,final_type,pnif,rng);
+            domain_flip_cluster(d,c,w,rng);
+        }
+        ntrial++;
+
+        domain_observe(d,c,w,time_list,ntime,obs);
+        if(!((obs[3]==1 && obs[4]>nif) || nocheck)) continue;
+
+        if(d->rank==0) {
+            c->ninfection = (int)obs[0];
+            c->nrecover   = (int)obs[1];
+            c->obs_infected_time = obs[2];
+            for(int s=0;s<ntime;s++) c->obs_ratio[s] = obs[5+s]/(d->nnode);
+            for(int i=0;i<(d->nlocal);i++) c->obs_state[i] = w->pstate[i];
+            c->obs_ready = 1;
+
+            a->ntrial_ave += ntrial;
+            measurement(c,a,w,d->m,time_list,ntime,block_size,rng);
+        }
+        ntrial=0;
+        i_sweep++;
+        if(d->rank==0) progress_update(&sample_progress,i_sweep);
+    }
+
+    free(obs);
+    free(time_list);
+    if(a!=NULL) free_accumulator(a);
+    free_world_line(w);
+    free_chain(c);
+    gsl_rng_free(rng);
+    free_domain(d);
+}
@@ -0,0 +1,182 @@
+#ifndef domain_h
+#define domain_h
+
+#include <gsl/gsl_rng.h>
+
+#include "dtype.h"
+#include "networks.h"
+#include "norm.h"
+
+/* A change of the state of a halo site at tau, from the timeline of the
+** rank that owns the site.
+*/
+typedef struct domain_event {
+    double tau;
+    int site;
+    int state;
+} domain_event;
+
+/* A cross vertex on the way to the other rank of its edge: the time, the
+** type, the edge of the global network and the states of its two sites
+** packed as for insert_accept.
+*/
+typedef struct domain_ghost {
+    double tau;
+    int type;
+    int edge;
+    int state;
+} domain_ghost;
+
+/* The part of the network a rank of a domain-decomposed run simulates: g is
+** the network of network_halo, the owned sites 0 ... nown-1 and the halo
+** sites nown ... nlocal-1, and m its model, on which the rank samples the
+** graphs of its own sites and edges only. node_map and edge_map give the
+** global node and edge of the local ones.
+**
+** A cross vertex, on an edge between an owned and a halo site, is held by
+** the ranks of both sites; edge_partner is the neighbour (index into
+** neighbour) on the other side of a local edge, -1 inside the part, and
+** site_partner the neighbour that owns a halo site. The owned sites a
+** neighbour k sees as halo are send_site[send_offset[k] ...
+** send_offset[k+1]-1], its sites this rank sees as halo are the recv_site
+** of k, both in the order of the global nodes.
+**
+** timeline holds the timelines of the world-line (world_line_to_conf),
+** valid for the owned sites, and halo the timelines the neighbours sent for
+** the halo sites; event is the list of the changes of the halo sites in
+** time order. gid and gfixed give every cluster of the last sweep its global
+** root and whether it is fixed anywhere. nsweep counts the sweeps, which
+** with the seed keys the decisions both ranks of a cross vertex make alike.
+*/
+typedef struct domain {
+    int rank;
+    int nrank;
+    int nnode;
+    int nown;
+    int nlocal;
+    int* node_map;
+    int* edge_map;
+    network* g;
+    model* m;
+    int nneighbour;
+    int* neighbour;
+    int* edge_partner;
+    int* site_partner;
+    int* send_offset;
+    int* send_site;
+    int* recv_offset;
+    int* recv_site;
+    conf* timeline;
+    conf* halo;
+    int nevent;
+    int event_cap;
+    domain_event* event;
+    int label_cap;
+    long long* gid;
+    unsigned char* gfixed;
+    int* shared_offset;
+    int* shared;
+    int shared_cap;
+    unsigned long int seed;
+    unsigned long int nsweep;
+} domain;
+
+/**
+ * Splits a network over the MPI ranks (see network_partition) and builds the part of this rank.
+ *
+ * Parameters:
+ *   g (network*): The whole network, read by every rank.
+ *   alpha (double), gamma (double): Infection and recovery rates.
+ *   seed (unsigned long int): Seed of the run, shared by the ranks.
+ *
+ * Behavior:
+ *   - Without USE_MPI, or with a single rank, the rank owns the whole network and has no halo.
+ *
+ * Outputs:
+ *   - The domain, released with free_domain; the model has an explicit bond table.
+ */
+domain* malloc_domain(network* g, double alpha, double gamma, unsigned long int seed);
+
+void free_domain(domain* d);
+
+/**
+ * Sends the timelines of the owned sites to the neighbours that see them as halo and receives those of the halo
+ * sites, for the next domain_sweep.
+ *
+ * Behavior:
+ *   - Converts the world-line with world_line_to_conf into d->timeline; a timeline is the initial state and the
+ *     changes of its site, so a message holds O(changes) entries rather than the vertices.
+ *   - Collects the changes of the halo sites into d->event in time order.
+ */
+void domain_exchange_timelines(domain* d, world_line* w);
+
+/**
+ * The sweep of update.c on the part of a rank, all ranks sweeping together.
+ *
+ * Parameters:
+ *   d (domain*): Part of this rank; w its world-line over the local sites, c its chain, rng its stream.
+ *   final_type (int), p (double): Boundary condition at tau=1 and target infected fraction, as for sweep; the
+ *                                 tau=0 boundary pins every site.
+ *
+ * Behavior:
+ *   - The candidates are drawn on the owned graphs and merged with the kept vertices and the changes of the halo
+ *     sites in time order, so a candidate on a cross edge is accepted on the current state of its halo site.
+ *   - A kept cross vertex redraws its graph from a hash of the seed, the sweep, its edge and its time, so its
+ *     two copies agree without a message. The accepted cross candidates are sent to the other rank of their edge,
+ *     which merges them into its sequence.
+ *   - The clusters are built as in sweep, with the world-lines of the owned sites only: a halo leg of a cross
+ *     vertex is linked through the vertex, its world-line is linked by the rank that owns it.
+ *   - The global clusters are found by a distributed union-find over the legs of the cross vertices: every local
+ *     cluster starts as its own root, and the neighbours exchange the roots and fixed flags of the clusters of the
+ *     legs they share, keeping the smallest root, until no rank changes one. The rounds grow with the number of
+ *     times a cluster crosses between parts, a message with the number of shared cross vertices.
+ *
+ * Outputs:
+ *   - The new sequence of w, its clusters and d->gid, d->gfixed; c->ninfection and c->nrecover count the kept
+ *     vertices this rank owns.
+ */
+void domain_sweep(domain* d, chain* c, world_line* w, int final_type, double p, gsl_rng* rng);
+
+/**
+ * flip_cluster for the clusters of domain_sweep, followed by domain_exchange_timelines.
+ *
+ * Behavior:
+ *   - A free cluster flips on the draw of a hash of the seed, the sweep and its global root, which every rank
+ *     holding a part of it makes alike; this stands for the decision broadcast by the owner of the root.
+ *   - The owned sites take their initial and final states from their first and last legs as in flip_cluster, an
+ *     owned site without a leg draws its state from rng.
+ */
+void domain_flip_cluster(domain* d, chain* c, world_line* w, gsl_rng* rng);
+
+/**
+ * Sums the observables of measurement() over the ranks.
+ *
+ * Parameters:
+ *   obs (double*): Set to the number of infections and recoveries, the infected time (in units of beta), the
+ *                  initial and final numbers of infected sites and, from obs[5] on, the number infected at every
+ *                  time slice, all over the whole network.
+ *
+ * Behavior:
+ *   - Every rank counts its owned sites and vertices from d->timeline; one reduction of 5+ntime numbers.
+ */
+void domain_observe(domain* d, chain* c, world_line* w, const double* time_list, int ntime, double* obs);
+
+/**
+ * Runs main.c on a network split over the MPI ranks.
+ *
+ * Parameters:
+ *   g (network*): The whole network; alpha, gamma, T, nif, running_mode, block_size, nblock, thermal, nskip and seed
+ *                 as the arguments of main.c.
+ *
+ * Behavior:
+ *   - Each rank runs one chain on its part, seeded with seed+rank, and all ranks sweep together. A sample is
+ *     checked and measured on the sums over the ranks, rank 0 measures.
+ *   - Running modes 0 and 2, whose boundary at tau=0 pins every site; exits with an error for the others.
+ *
+ * Outputs:
+ *   - The files of measurement() on rank 0, without 'conf.txt': no rank holds the configuration of every site.
+ */
+void domain_run(network* g, double alpha, double gamma, double T, int nif, int running_mode, int block_size,
+                int nblock, int thermal, int nskip, unsigned long int seed);
+
+#endif
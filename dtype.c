@@ -1,11 +1,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 #include "dtype.h"
+#include "instrument.h"
+#include "norm.h"
+
+int memory_report = 1;
 
 model* malloc_model(int nsite, int nbond, int mhnspin) {
     int maxima_number_type=20;
+
+    if(mhnspin>MHNSPIN) {
+        printf("memory allocate error : malloc_model (mhnspin=%d > MHNSPIN=%d)\n",mhnspin,MHNSPIN);
+        exit(-1);
+    }
+
     model* m = (model*)malloc(sizeof(model));
 
     m->bond2type   = (int*)malloc(sizeof(int)*nbond);
@@ -13,13 +24,26 @@ model* malloc_model(int nsite, int nbond, int mhnspin) {
     m->bond2weight = (double*)malloc(sizeof(double)*nbond);
     m->bond2index  = (int*)malloc(sizeof(int)*nbond*mhnspin);
     m->link        = (int*)malloc(sizeof(int)*mhnspin*4*maxima_number_type);
-    m->insert      = (insert_rule*)malloc(sizeof(insert_rule)*maxima_number_type);
+    m->insert_mask = (unsigned int*)malloc(sizeof(unsigned int)*maxima_number_type);
     m->cmf         = (double*)malloc(sizeof(double)*nbond);
+    m->alias_prob  = (double*)malloc(sizeof(double)*nbond);
+    m->alias       = (int*)malloc(sizeof(int)*nbond);
 
     m->nsite = nsite;
     m->nbond = nbond;
     m->mhnspin = mhnspin;
     m->sweight = 0;
+    m->network = NULL;
+    m->implicit = 0;
+    m->nedge = 0;
+    m->ntype_edge = 0;
+    m->edges = NULL;
+    m->type2weight = NULL;
+    m->type2cmf = NULL;
+    m->ntype = 0;
+    m->type2offset = (int*)malloc(sizeof(int)*maxima_number_type);
+    m->swap_offset = (int*)malloc(sizeof(int)*(maxima_number_type+1));
+    m->swap_type   = (int*)malloc(sizeof(int)*maxima_number_type*maxima_number_type);
 
     // initialization
     for(int i=0;i<nbond;i++) {
@@ -32,17 +56,23 @@ model* malloc_model(int nsite, int nbond, int mhnspin) {
         }
 
         m->cmf[i] = 0;
+        m->alias_prob[i] = 1.0;
+        m->alias[i] = i;
     }
 
+    m->swap_offset[maxima_number_type] = 0;
     for(int i=0;i<maxima_number_type;i++) {
         for(int j=0;j<4*mhnspin;j++) {
             m->link[i*4*mhnspin+j] = -1;
         }
 
-        m->insert[i] = NULL;
+        m->insert_mask[i] = 0;
+        m->type2offset[i] = 0;
+        m->swap_offset[i] = 0;
     }
 
-    if(1) {
+#if INSTRUMENT_DEBUG
+    if(memory_report) {
         printf("-------------------------------------------\n");
         printf("#\tmemory allocate : model\n");
         printf("# nsite : %d | nbond : %d | mhnspin : %d\n",nsite,nbond,mhnspin);
@@ -51,11 +81,87 @@ model* malloc_model(int nsite, int nbond, int mhnspin) {
         printf("# bond2weight : %zu bytes\n",sizeof(double)*nbond);
         printf("# bond2index  : %zu bytes\n",sizeof(int)*nbond*mhnspin);
         printf("# link        : %zu bytes\n",sizeof(int)*mhnspin*4*20);
-        printf("# insert      : %zu bytes\n",sizeof(insert_rule)*20);
+        printf("# insert_mask : %zu bytes\n",sizeof(unsigned int)*20);
         printf("# cmf         : %zu bytes\n",sizeof(double)*nbond);
+        printf("# alias_prob  : %zu bytes\n",sizeof(double)*nbond);
+        printf("# alias       : %zu bytes\n",sizeof(int)*nbond);
         printf("-------------------------------------------\n");
 
     }
+#endif
+
+    return m;
+}
+
+model* malloc_model_implicit(int nsite, int nedge, int* edges, int ntype_edge, int ntype_site, int mhnspin) {
+    int maxima_number_type=20;
+    int nbond = ntype_edge*nedge+ntype_site*nsite;
+
+    if(mhnspin>MHNSPIN) {
+        printf("memory allocate error : malloc_model_implicit (mhnspin=%d > MHNSPIN=%d)\n",mhnspin,MHNSPIN);
+        exit(-1);
+    }
+    if(ntype_edge+ntype_site>maxima_number_type) {
+        printf("memory allocate error : malloc_model_implicit (%d types > %d)\n",ntype_edge+ntype_site,maxima_number_type);
+        exit(-1);
+    }
+
+    model* m = (model*)malloc(sizeof(model));
+
+    m->bond2type   = NULL;
+    m->bond2hNspin = NULL;
+    m->bond2weight = NULL;
+    m->bond2index  = NULL;
+    m->cmf         = NULL;
+    m->alias_prob  = NULL;
+    m->alias       = NULL;
+    m->link        = (int*)malloc(sizeof(int)*mhnspin*4*maxima_number_type);
+    m->insert_mask = (unsigned int*)malloc(sizeof(unsigned int)*maxima_number_type);
+    m->type2weight = (double*)malloc(sizeof(double)*maxima_number_type);
+    m->type2cmf    = (double*)malloc(sizeof(double)*maxima_number_type);
+
+    m->nsite = nsite;
+    m->nbond = nbond;
+    m->mhnspin = mhnspin;
+    m->sweight = 0;
+    m->network = NULL;
+    m->implicit = 1;
+    m->nedge = nedge;
+    m->ntype_edge = ntype_edge;
+    m->edges = edges;
+    m->ntype = 0;
+    m->type2offset = (int*)malloc(sizeof(int)*maxima_number_type);
+    m->swap_offset = (int*)malloc(sizeof(int)*(maxima_number_type+1));
+    m->swap_type   = (int*)malloc(sizeof(int)*maxima_number_type*maxima_number_type);
+
+    // initialization
+    m->swap_offset[maxima_number_type] = 0;
+    for(int i=0;i<maxima_number_type;i++) {
+        for(int j=0;j<4*mhnspin;j++) {
+            m->link[i*4*mhnspin+j] = -1;
+        }
+
+        m->insert_mask[i] = 0;
+        m->type2offset[i] = 0;
+        m->swap_offset[i] = 0;
+        m->type2weight[i] = 0.0;
+        m->type2cmf[i] = 0.0;
+    }
+
+#if INSTRUMENT_DEBUG
+    if(memory_report) {
+        printf("-------------------------------------------\n");
+        printf("#\tmemory allocate : model (implicit bonds)\n");
+        printf("# nsite : %d | nbond : %d | mhnspin : %d\n",nsite,nbond,mhnspin);
+        printf("# edges       : %zu bytes (shared)\n",sizeof(int)*nedge*2);
+        printf("# link        : %zu bytes\n",sizeof(int)*mhnspin*4*20);
+        printf("# insert_mask : %zu bytes\n",sizeof(unsigned int)*20);
+        printf("# type2weight : %zu bytes\n",sizeof(double)*20);
+        printf("# type2cmf    : %zu bytes\n",sizeof(double)*20);
+        printf("-------------------------------------------\n");
+
+    }
+#endif
 
     return m;
 }
@@ -66,110 +172,176 @@ void free_model(model* m) {
     free(m->bond2weight);
     free(m->bond2index);
     free(m->link);
-    free(m->insert);
+    free(m->insert_mask);
     free(m->cmf);
+    free(m->alias_prob);
+    free(m->alias);
+    free(m->type2weight);
+    free(m->type2cmf);
+    free(m->type2offset);
+    free(m->swap_offset);
+    free(m->swap_type);
     free(m);
 }
 
-void copy_vertex(vertex* dist, vertex* src) {
-    dist->tau = src->tau;
-    dist->bond = src->bond;
-    dist->hNspin = src->hNspin;
-    for(int i=0;i<2*src->hNspin;i++) {
-        dist->state[i] = src->state[i];
+unsigned int insert_rule_mask(insert_rule rule, int hNspin) {
+    int lstate[MHNSPIN];
+    unsigned int mask=0;
+    for(int k=0;k<(1<<hNspin);k++) {
+        for(int j=0;j<hNspin;j++) lstate[j] = ((k>>j)&1) ? 1 : -1;
+        if(rule(lstate)) mask |= 1u<<k;
     }
+    return mask;
+}
+
+// bytes of an arena of length vertices: both sequences and four int arrays
+// per leg, the legs of the vertices and the two boundary legs of every site
+static size_t world_line_arena_size(int length, int mnspin, int nsite) {
+    return sizeof(vertex)*2*(size_t)length+sizeof(int)*4*((size_t)length*mnspin+2*(size_t)nsite);
+}
+
+// place the sequences and the per-leg arrays in the arena
+static void world_line_arena_slices(world_line* w) {
+    size_t length = w->length;
+    size_t nleg   = length*(w->mnspin)+2*(size_t)(w->nsite);
+    char* arena = (char*)(w->arena);
+
+    w->sequenceA = (vertex*)arena;
+    w->sequenceB = (vertex*)(arena+sizeof(vertex)*length);
+
+    int* legs = (int*)(arena+sizeof(vertex)*2*length);
+    w->cluster = legs;
+    w->weight  = legs+nleg;
+    w->label   = legs+2*nleg;
+    w->cweight = legs+3*nleg;
+}
+
+int world_line_capacity(model* m, double beta) {
+    // the candidates of a sweep are Poisson with mean lam, a sweep needs
+    // room for them and the kept vertices, the boundaries are not vertices
+    double lam = (m->sweight)*beta;
+    return 2*(int)(lam+sqrt(lam)*10+1024);
 }
 
 world_line* malloc_world_line(int length, int mnspin, int nsite) {
     world_line* w = (world_line*)malloc(sizeof(world_line));
 
-    w->sequenceA = (vertex*)malloc(sizeof(vertex)*length);
-    w->sequenceB = (vertex*)malloc(sizeof(vertex)*length);
-    w->cluster  = (int*)malloc(sizeof(int)*length*mnspin);
-    w->weight   = (int*)malloc(sizeof(int)*length*mnspin);
+    w->length = length;
+    w->mnspin = mnspin;
+    w->nsite  = nsite;
+    w->arena  = malloc(world_line_arena_size(length,mnspin,nsite));
+    if(w->arena==NULL) {
+        printf("memory allocate error : malloc_world_line (length=%d)\n",length);
+        exit(-1);
+    }
+    world_line_arena_slices(w);
+
     w->istate    = (int*)malloc(sizeof(int)*nsite);
     w->pstate    = (int*)malloc(sizeof(int)*nsite);
     w->first    = (int*)malloc(sizeof(int)*nsite);
     w->last     = (int*)malloc(sizeof(int)*nsite);
+    w->site_order = (int*)malloc(sizeof(int)*nsite);
+    w->site_slot  = (int*)malloc(sizeof(int)*nsite);
+    w->boundary_site = (int*)malloc(sizeof(int)*2*nsite);
+    w->infected_order = (int*)malloc(sizeof(int)*nsite);
+    w->infected_slot  = (int*)malloc(sizeof(int)*nsite);
+    w->fresh_site     = (int*)malloc(sizeof(int)*nsite);
+
+    // no site is active before the first sweep
+    for(int i=0;i<nsite;i++) {
+        w->first[i] = -1;
+        w->last[i]  = -1;
+        w->site_order[i] = i;
+        w->site_slot[i]  = i;
+        w->infected_order[i] = i;
+        w->infected_slot[i]  = i;
+    }
+    w->nactive = 0;
+    w->nunset  = 0;
+    w->nunset_infected = 0;
+    w->ninfected_set = 0;
+    w->ninitial = -1;
+    w->nfinal   = -1;
+    w->nboundary_initial = 0;
+    w->nboundary_final = 0;
+    w->pin_initial = -1;
+    w->pin_free    = -1;
+    w->pin_final   = -1;
+    w->pin_final_infected = 0;
+    w->nfresh = 0;
+    w->fresh_unset = 0;
+    w->fresh_unset_infected = 0;
 
-    w->length = length;
     w->nvertices = 0;
-    w->mnspin = mnspin;
+    w->nlabel = 0;
     w->flag = 0;
-    w->nsite = nsite;
 
-    if(1) {
+#if INSTRUMENT_DEBUG
+    if(memory_report) {
         printf("-------------------------------------------\n");
         printf("#\tmemory allocate : world_line\n");
         printf("# nsite : %d | length : %d | mnspin : %d\n",nsite,length,mnspin);
+        printf("# arena       : %zu bytes\n",world_line_arena_size(length,mnspin,nsite));
         printf("# sequenceA   : %zu bytes\n",sizeof(vertex)*length);
         printf("# sequenceB   : %zu bytes\n",sizeof(vertex)*length);
-        printf("# cluster     : %zu bytes\n",sizeof(int)*length*mnspin);
-        printf("# weight      : %zu bytes\n",sizeof(int)*length*mnspin);
+        printf("# cluster     : %zu bytes\n",sizeof(int)*(length*mnspin+2*nsite));
+        printf("# weight      : %zu bytes\n",sizeof(int)*(length*mnspin+2*nsite));
+        printf("# label       : %zu bytes\n",sizeof(int)*(length*mnspin+2*nsite));
+        printf("# cweight     : %zu bytes\n",sizeof(int)*(length*mnspin+2*nsite));
         printf("# istate      : %zu bytes\n",sizeof(int)*nsite);
         printf("# pstate      : %zu bytes\n",sizeof(int)*nsite);
         printf("# first       : %zu bytes\n",sizeof(int)*nsite);
         printf("# last        : %zu bytes\n",sizeof(int)*nsite);
+        printf("# site_order  : %zu bytes\n",sizeof(int)*nsite);
+        printf("# site_slot   : %zu bytes\n",sizeof(int)*nsite);
+        printf("# boundary    : %zu bytes\n",sizeof(int)*2*nsite);
+        printf("# infected    : %zu bytes\n",sizeof(int)*2*nsite);
+        printf("# fresh_site  : %zu bytes\n",sizeof(int)*nsite);
         printf("-------------------------------------------\n");
 
     }
+#endif
 
     return w;
 }
 
 void free_world_line(world_line* w) {
-    free(w->sequenceA);
-    free(w->sequenceB);
-    free(w->cluster);
-    free(w->weight);
+    free(w->arena);
     free(w->istate);
     free(w->pstate);
     free(w->first);
     free(w->last);
+    free(w->site_order);
+    free(w->site_slot);
+    free(w->boundary_site);
+    free(w->infected_order);
+    free(w->infected_slot);
+    free(w->fresh_site);
     free(w);
 }
 
 void realloc_world_line(world_line* w, int length) {
     if(length > (w->length)) {
-        //buffer
-        length = (int)(length*1.2);
-
-        vertex* sequence;
-        sequence = (vertex*)malloc(sizeof(vertex)*length);
-        for(int i=0;i<w->nvertices;i++) 
-            copy_vertex(&(sequence[i]),&(w->sequenceA[i]));
-
-        free(w->sequenceA);
-        w->sequenceA = sequence;
-
-        sequence = (vertex*)malloc(sizeof(vertex)*length);
-        for(int i=0;i<w->nvertices;i++) 
-            copy_vertex(&(sequence[i]),&(w->sequenceB[i]));
-
-        free(w->sequenceB);
-        w->sequenceB = sequence;
-
-        free(w->cluster);
-        free(w->weight);
-        w->cluster = (int*)malloc(sizeof(int)*length*(w->mnspin));
-        w->weight  = (int*)malloc(sizeof(int)*length*(w->mnspin));
-
-        w->length = length;
-
-        if(1) {
-            int nsite = w->nsite;
-            int mnspin = w->mnspin;
-            printf("-------------------------------------------\n");
-            printf("#\tmemory reallocate : world_line\n");
-            printf("# nsite : %d | length : %d | mnspin : %d\n",nsite,length,mnspin);
-            printf("# sequenceA   : %zu bytes\n",sizeof(vertex)*length);
-            printf("# sequenceB   : %zu bytes\n",sizeof(vertex)*length);
-            printf("# cluster     : %zu bytes\n",sizeof(int)*length*mnspin);
-            printf("# weight      : %zu bytes\n",sizeof(int)*length*mnspin);
-            printf("-------------------------------------------\n");
-
+        // grow geometrically and never shrink, the copy is amortized
+        int old = w->length;
+        int cap = 2*old;
+        if(cap<length) cap = length;
+
+        void* arena = realloc(w->arena,world_line_arena_size(cap,w->mnspin,w->nsite));
+        if(arena==NULL) {
+            printf("memory allocate error : realloc_world_line (length=%d)\n",cap);
+            exit(-1);
         }
 
+        // sequenceA stays at the start, sequenceB moves up to its new offset;
+        // the per-leg arrays are rebuilt by the next clustering
+        memmove((char*)arena+sizeof(vertex)*(size_t)cap,(char*)arena+sizeof(vertex)*(size_t)old,
+                sizeof(vertex)*(size_t)(w->nvertices));
+
+        w->arena  = arena;
+        w->length = cap;
+        w->nlabel = 0;
+        world_line_arena_slices(w);
     }
 }
 
@@ -331,23 +503,170 @@ void realloc_world_line_omp_insert(world_line_omp* w, int cap, int i_thread) {
     }
 }
 
+chain* malloc_chain() {
+    chain* c = (chain*)malloc(sizeof(chain));
+
+    // buffers are allocated on first use, when the sizes are known
+    c->insert_seq  = NULL;
+    c->insert_bond = NULL;
+    c->insert_len  = 0;
+    c->insert_cap  = 0;
+
+    c->ninfection = 0;
+    c->nrecover   = 0;
+
+    c->cstat_length  = 0;
+    c->cstat_counter = 0;
+    c->cstat_count     = NULL;
+    c->cstat_fcluster  = NULL;
+    c->cstat_infection = NULL;
+    c->cstat_taus      = NULL;
+    c->cstat_infection_size = NULL;
+
+    // one thread unless chain_threads is called
+    c->nthread = 1;
+    c->rngs    = NULL;
+    c->tfirst  = NULL;
+    c->tlast   = NULL;
+    c->tcount  = NULL;
+
+    // no conditioning of the flips unless the running mode asks for it
+    c->condition_nif    = -1;
+    c->condition_istate = NULL;
+
+    // flip_cluster only records the observables after chain_observe
+    c->obs_model     = NULL;
+    c->obs_time_list = NULL;
+    c->obs_ntime = 0;
+    c->obs_ready = 0;
+    c->obs_state = NULL;
+    c->obs_since = NULL;
+    c->obs_ratio = NULL;
+    c->obs_infected_time = 0;
+    c->obs_tau = 0;
+
+    // the hardware counters are opened by the first sweep, in its thread
+    counters_reset(&(c->count));
+    for(int i=0;i<COUNTERS_NPERF;i++) c->perf_fd[i] = -2;
+
+    return c;
+}
+
+void free_chain(chain* c) {
+    free(c->insert_seq);
+    free(c->insert_bond);
+    free(c->condition_istate);
+    free(c->obs_state);
+    free(c->obs_since);
+    free(c->obs_ratio);
+    free(c->cstat_count);
+    free(c->cstat_fcluster);
+    free(c->cstat_infection);
+    free(c->cstat_taus);
+    free(c->cstat_infection_size);
+    if(c->rngs!=NULL) {
+        for(int i=0;i<(c->nthread);i++) gsl_rng_free(c->rngs[i]);
+        free(c->rngs);
+    }
+    free(c->tfirst);
+    free(c->tlast);
+    free(c->tcount);
+    counters_perf_close(c);
+    free(c);
+}
+
+accumulator* malloc_accumulator() {
+    accumulator* a = (accumulator*)malloc(sizeof(accumulator));
+
+    // infected_ratio, infected_time and est are allocated by measurement()
+    a->measurement_count = 0;
+    a->infected_ratio = NULL;
+    a->infected_time  = NULL;
+    a->total_infected_time_ave = 0;
+    a->ninfection_ave = 0;
+    a->nrecover_ave   = 0;
+    a->ntrial_ave     = 0;
+    a->start_time     = 0;
+    a->nobs = 0;
+    a->est  = NULL;
+    a->path = NULL;
+    a->conf_output = 1;
+    a->next_nif = -1;
+    counters_reset(&(a->count));
+
+    // the output files of measurement() are named prefix+name
+    a->prefix[0] = '\0';
+
+    return a;
+}
+
+void malloc_accumulator_buffers(accumulator* a, int nsite, int ntime, int block_size) {
+    char names[4][128] = {"ninfection","nrecover","infected_time","p_next"};
+
+    a->infected_time = (double*)malloc(sizeof(double)*nsite);
+    a->infected_ratio = (double*)malloc(sizeof(double)*ntime);
+    for(int i=0;i<nsite;i++) a->infected_time[i]=0;
+    for(int i=0;i<ntime;i++) a->infected_ratio[i]=0;
+
+    a->nobs = (a->next_nif>=0) ? 4 : 3;
+    a->est  = (estimator**)malloc(sizeof(estimator*)*(a->nobs));
+    for(int i=0;i<(a->nobs);i++) a->est[i] = malloc_estimator(block_size,names[i]);
+
+    a->start_time = clock();
+}
+
+void free_accumulator(accumulator* a) {
+    free(a->infected_ratio);
+    free(a->infected_time);
+    for(int i=0;i<(a->nobs);i++) free_estimator(a->est[i]);
+    free(a->est);
+    if(a->path!=NULL) free_conf(a->path);
+    free(a);
+}
+
+// smallest power of two holding 2*length, the zero padding keeps the
+// circular correlation of the FFT from wrapping around
+static int estimator_nfft(int length) {
+    int nfft=1;
+    while(nfft<2*length) nfft*=2;
+    return nfft;
+}
+
 estimator* malloc_estimator(int length, char name[128]) {
     estimator* e = (estimator*)malloc(sizeof(estimator));
 
+    e->nfft = estimator_nfft(length);
     e->samples = (double*)malloc(sizeof(double)*length);
-    e->blocks  = (double*)malloc(sizeof(double)*8192);
-    strcpy(e->name,name);
+    e->autocorrelation = (double*)malloc(sizeof(double)*length);
+    e->fft = (double*)malloc(sizeof(double)*2*(e->nfft));
+    if(e->samples==NULL || e->autocorrelation==NULL || e->fft==NULL) {
+        printf("memory allocate error : malloc_estimator (%s)\n",name);
+        exit(-1);
+    }
+
+    strncpy(e->name,name,127);
+    e->name[127] = '\0';
     e->length = length;
     e->n = 0;
-    e->bsize  = 2;
-    e->nblock = 0;
+    e->tau = 0.5;
+    e->count = 0;
+
+    for(int i=0;i<length;i++) e->autocorrelation[i]=0;
+    for(int i=0;i<ESTIMATOR_NLEVEL;i++) {
+        e->bin_partial[i] = 0;
+        e->bin_pending[i] = 0;
+        e->bin_sum[i]  = 0;
+        e->bin_sum2[i] = 0;
+        e->bin_count[i] = 0;
+    }
 
     return e;
 }
 
 void free_estimator(estimator* e) {
     free(e->samples);
-    free(e->blocks);
+    free(e->autocorrelation);
+    free(e->fft);
     free(e);
 }
 
@@ -359,6 +678,14 @@ void realloc_estimator(estimator* e, int length) {
 
         free(e->samples);
         e->samples = samples;
+
+        free(e->autocorrelation);
+        free(e->fft);
+        e->nfft = estimator_nfft(length);
+        e->autocorrelation = (double*)malloc(sizeof(double)*length);
+        e->fft = (double*)malloc(sizeof(double)*2*(e->nfft));
+        for(int i=0;i<length;i++) e->autocorrelation[i]=0;
+
         e->length = length;
     }
 }
@@ -1,29 +1,172 @@
 #ifndef dtype_h
 #define dtype_h
 
+#include <time.h>
+#include <gsl/gsl_rng.h>
+
 typedef int (*insert_rule)(int*);
 
+struct network;
+
+/* Bond tables of a model. Bonds are numbered by type, each type a block of
+** nedge edge graphs or nsite single-site graphs from type2offset[t] on. The
+** types swap_type[swap_offset[t]] ... swap_type[swap_offset[t+1]-1] share the
+** weight of type t on the same edge or site; swapping_graphs redraws the
+** type of a vertex among them, none if the range is empty.
+*/
 typedef struct model {
     int* bond2type;
     int* bond2hNspin;
     double* bond2weight;
     double* cmf;
+    double* alias_prob;
+    int* alias;
     int* bond2index;
     int* link;
-    insert_rule* insert;
+    unsigned int* insert_mask;
     int nsite;
     int nbond;
     int mhnspin;
     double sweight;
+    struct network* network;
+    int implicit;
+    int nedge;
+    int ntype_edge;
+    int* edges;
+    double* type2weight;
+    double* type2cmf;
+    int ntype;
+    int* type2offset;
+    int* swap_offset;
+    int* swap_type;
 } model;
 
+/* Bond table accessors. With m->implicit the bond arrays are not stored:
+** bonds are laid out as ntype_edge blocks of nedge edge graphs followed by
+** blocks of nsite single-site graphs, so the type, the edge or site and the
+** weight follow from the bond number, and the endpoints are read from the
+** single edges array (two ints per edge). The weight is shared by the type,
+** in type2weight.
+*/
+static inline int bond_type(const model* m, int bond) {
+    if(!m->implicit) return m->bond2type[bond];
+
+    int n = (m->ntype_edge)*(m->nedge);
+    if(bond<n) return bond/(m->nedge);
+    return m->ntype_edge+(bond-n)/(m->nsite);
+}
+
+static inline int bond_hNspin(const model* m, int bond) {
+    if(!m->implicit) return m->bond2hNspin[bond];
+
+    return (bond<(m->ntype_edge)*(m->nedge)) ? 2 : 1;
+}
+
+static inline double bond_weight(const model* m, int bond) {
+    if(!m->implicit) return m->bond2weight[bond];
+
+    return m->type2weight[bond_type(m,bond)];
+}
+
+static inline int bond_index(const model* m, int bond, int j) {
+    if(!m->implicit) return m->bond2index[bond*(m->mhnspin)+j];
+
+    int n = (m->ntype_edge)*(m->nedge);
+    if(bond<n) return m->edges[2*(bond%(m->nedge))+j];
+    return (j==0) ? (bond-n)%(m->nsite) : -1;
+}
+
+/* Insert rules as data: bit s of m->insert_mask[t] is set if a vertex of
+** type t can be inserted on the local states packed into s, bit j of s
+** being set if site j of the bond is infected. A mask holds the 2^hNspin
+** states of a bond, so a vertex acts on 5 sites at most.
+*/
+static inline int insert_accept(const model* m, int type, int s) {
+    return (m->insert_mask[type]>>s)&1;
+}
+
+/* Largest number of sites a single vertex acts on. A vertex stores the
+** states of its 2*MHNSPIN legs (below and above tau) inline, so keep it as
+** small as the models allow; the SIS model needs 2.
+*/
+#ifndef MHNSPIN
+#define MHNSPIN 2
+#endif
+
 typedef struct vertex {
     double tau;
     int bond;
-    int hNspin;
-    int state[20];
+    signed char hNspin;
+    signed char state[2*MHNSPIN];
 } vertex;
 
+// leg j < hNspin is below tau, leg j+hNspin is the same site above tau
+static inline int vertex_state(const vertex* v, int j) {
+    return v->state[j];
+}
+
+static inline void vertex_set_state(vertex* v, int j, int state) {
+    v->state[j] = (signed char)state;
+}
+
+static inline void vertex_flip_state(vertex* v, int j) {
+    v->state[j] = -(v->state[j]);
+}
+
+/* Calls kernel(..., hNspin), a static inline function over the legs of a
+** vertex, with the number of sites of the vertex as a constant. The
+** single-site (hNspin=1) and edge (hNspin=2) vertices each get a copy of
+** the kernel with fixed loop bounds and rule offsets, which the compiler
+** unrolls; only a build with MHNSPIN > 2 keeps a loop over a runtime
+** hNspin. The expression has the type of the kernel, void included.
+*/
+#if MHNSPIN>2
+#define VERTEX_KERNEL(hNspin,kernel,...) \
+    (((hNspin)==1) ? kernel(__VA_ARGS__,1) : ((hNspin)==2) ? kernel(__VA_ARGS__,2) : kernel(__VA_ARGS__,(hNspin)))
+#else
+#define VERTEX_KERNEL(hNspin,kernel,...) \
+    (((hNspin)==1) ? kernel(__VA_ARGS__,1) : kernel(__VA_ARGS__,2))
+#endif
+
+static inline void copy_vertex(vertex* dist, vertex* src) {
+    *dist = *src;
+}
+
+/* The legs of vertex i are i*mnspin ... i*mnspin+2*hNspin-1. cluster and
+** weight are the union-find forest built by the clustering; it ends with
+** label, the dense number 0 ... nlabel-1 of the cluster of every leg in the
+** order the clusters are first met, and cweight, the weight of every
+** cluster: > 0 free, < 0 fixed and 0 once flip_cluster flips it.
+** The sequences and the per-leg arrays are slices of one arena of length
+** vertices, grown by realloc_world_line.
+** first/last are the first and last leg of every site, -1 for a site that
+** no vertex acts on. The sites with a leg are active: site_order[0] ...
+** site_order[nactive-1] in the order they were linked, the untouched sites
+** following them; site_slot[i] is the position of site i. The links are
+** reset through the active sites, so a sweep and a flip visit the sites
+** that have a leg and leave the untouched ones where they are.
+** An untouched site keeps its state from tau=0 to tau=1, so pstate equals
+** istate there. A site free at both ends gets a fresh state at the flip; the
+** untouched sites that are not drawn yet are unset: the last nunset entries
+** of site_order, nunset_infected of them infected (see site_settle). The
+** set sites infected in istate are infected_order[0] ...
+** infected_order[ninfected_set-1], at positions infected_slot. ninitial and
+** nfinal are the numbers of infected sites of istate and pstate, unset ones
+** included; ninitial is -1 after the states were set otherwise, until the
+** next sweep counts them again.
+** The boundaries are not vertices: pin_initial and pin_final are the
+** boundary types of the last sweep (see site_pinned_initial). Only the
+** active sites are pinned by legs, an untouched pinned site just keeps its
+** state. The sites pinned at tau=0 are boundary_site[0] ...
+** boundary_site[nboundary_initial-1] and those pinned at tau=1
+** boundary_site[nsite] ... boundary_site[nsite+nboundary_final-1], in the
+** order they were linked; their states are istate and pstate. Each is a
+** single leg after the legs of the vertices (see boundary_leg_initial), so
+** the per-leg arrays hold length*mnspin+2*nsite legs.
+** fresh_site[0] ... fresh_site[nfresh-1] are the set untouched sites the
+** last flip drew afresh, and fresh_unset, fresh_unset_infected the unset
+** sites it leaves, until the flip applies them.
+*/
 typedef struct world_line {
     vertex* sequenceA;
     vertex* sequenceB;
@@ -31,16 +174,79 @@ typedef struct world_line {
     int  nvertices;
     int* cluster;
     int* weight;
+    int* label;
+    int* cweight;
+    int  nlabel;
+    void* arena;
     int  mnspin;
     int  flag;
     int* istate;
     int* pstate;
     int* last;
     int* first;
+    int* site_order;
+    int* site_slot;
+    int  nactive;
+    int  nunset;
+    int  nunset_infected;
+    int* infected_order;
+    int* infected_slot;
+    int  ninfected_set;
+    int  ninitial;
+    int  nfinal;
+    int* boundary_site;
+    int  nboundary_initial;
+    int  nboundary_final;
+    int  pin_initial;
+    int  pin_free;
+    int  pin_final;
+    int  pin_final_infected;
+    int* fresh_site;
+    int  nfresh;
+    int  fresh_unset;
+    int  fresh_unset_infected;
     int  nsite;
     double beta;
 } world_line;
 
+// site i is one of the unset sites of a flip, its state is not drawn yet
+static inline int site_is_unset(const world_line* w, int i) {
+    return (w->site_slot[i])>=(w->nsite)-(w->nunset);
+}
+
+/* Site i is pinned at tau=0 by the boundary of the last sweep: type 0 pins
+** every site, type 1 the susceptible sites, except pin_free; pin_free is -1
+** for none and -2 if no site is pinned (no infected site). The state is the
+** one the sweep started from.
+*/
+static inline int site_pinned_initial(const world_line* w, int i) {
+    if(w->pin_initial==0) return 1;
+    if(w->pin_initial==1) return (w->pin_free!=-2) && (w->istate[i]==-1) && (i!=(w->pin_free));
+    return 0;
+}
+
+// site i is pinned at tau=1: type 0 pins every site, type 1 the infected
+// ones if pin_final_infected, type 2 the susceptible ones
+static inline int site_pinned_final(const world_line* w, int i) {
+    if(w->pin_final==0) return 1;
+    if(w->pin_final==1) return (w->pin_final_infected) && (w->pstate[i]==1);
+    if(w->pin_final==2) return (w->pstate[i]==-1);
+    return 0;
+}
+
+// legs of the tau=0 and tau=1 boundaries of site i
+static inline int boundary_leg_initial(const world_line* w, int i) {
+    return (w->length)*(w->mnspin)+i;
+}
+
+static inline int boundary_leg_final(const world_line* w, int i) {
+    return (w->length)*(w->mnspin)+(w->nsite)+i;
+}
+
+static inline int is_boundary_leg(const world_line* w, int id) {
+    return id>=(w->length)*(w->mnspin);
+}
+
 typedef struct world_line_omp {
     int nthread;
     vertex** sequenceA;
@@ -65,26 +271,148 @@ typedef struct world_line_omp {
     double beta;
 } world_line_omp;
 
+/* Number of hardware counters a build with USE_PERF reads per chain:
+** cycles, instructions and cache misses (see instrument.h).
+*/
+#define COUNTERS_NPERF 3
+
+/* Hot-path counters of the sweeps since the last reset (see instrument.h):
+** the candidates drawn and accepted, the vertices dropped, the legs labelled
+** and the parent steps from them to their roots, the clusters and the free
+** ones among them, the growths of the world-line and candidate buffers and
+** the conditioned flips and their rejections. perf holds the hardware
+** counters when perf_open is set.
+*/
+typedef struct counters {
+    long long sweeps;
+    long long candidates;
+    long long accepted;
+    long long removed;
+    long long legs;
+    long long root_steps;
+    long long clusters;
+    long long free_clusters;
+    long long reallocs;
+    long long condition_flips;
+    long long condition_rejected;
+    int perf_open;
+    long long perf[COUNTERS_NPERF];
+} counters;
+
+typedef struct chain {
+    double* insert_seq;
+    int* insert_bond;
+    int insert_len;
+    int insert_cap;
+    int ninfection;
+    int nrecover;
+    int  cstat_length;
+    int  cstat_counter;
+    int* cstat_count;
+    int* cstat_fcluster;
+    int* cstat_infection;
+    double* cstat_taus;
+    double* cstat_infection_size;
+    int nthread;
+    gsl_rng** rngs;
+    int* tfirst;
+    int* tlast;
+    int* tcount;
+    int condition_nif;
+    int* condition_istate;
+    const model* obs_model;
+    const double* obs_time_list;
+    int obs_ntime;
+    int obs_ready;
+    int* obs_state;
+    double* obs_since;
+    double* obs_ratio;
+    double obs_infected_time;
+    double obs_tau;
+    counters count;
+    int perf_fd[COUNTERS_NPERF];
+} chain;
+
+/* Block averages and estimators of measurement(). conf_output is 0 when
+** the world-line does not hold every site (a rank of a domain-decomposed
+** run), measurement() then writes no configuration. count sums the
+** counters of the chains over the block. With next_nif >= 0 (a point of a
+** ladder of nif) every sample also gives p_next, 1 if it has more than
+** next_nif final infections.
+*/
+typedef struct accumulator {
+    unsigned long int measurement_count;
+    double* infected_ratio;
+    double* infected_time;
+    double total_infected_time_ave;
+    double ninfection_ave;
+    double nrecover_ave;
+    double ntrial_ave;
+    clock_t start_time;
+    int nobs;
+    struct estimator** est;
+    struct conf* path;
+    int conf_output;
+    int next_nif;
+    counters count;
+    char prefix[32];
+} accumulator;
+
+/* Number of logarithmic binning levels, 2^ESTIMATOR_NLEVEL samples fill the
+** last level.
+*/
+#ifndef ESTIMATOR_NLEVEL
+#define ESTIMATOR_NLEVEL 40
+#endif
+
+/* Streaming estimator of one observable (see estimator.h).
+** samples holds the current block of length samples; when it is full its
+** autocorrelation and integrated autocorrelation time are computed once
+** with an FFT of size nfft (fft is the workspace). Every sample also goes
+** through the binning levels: level k sees the means of 2^k consecutive
+** samples, bin_partial keeps the pending first half of the next bin.
+*/
 typedef struct estimator {
     char name[128];
     double* samples;
     int length;
     int n;
-    double* blocks;
-    int bsize;
-    int nblock;
+    double* autocorrelation;
+    double tau;
+    double* fft;
+    int nfft;
+    unsigned long int count;
+    double bin_partial[ESTIMATOR_NLEVEL];
+    int bin_pending[ESTIMATOR_NLEVEL];
+    double bin_sum[ESTIMATOR_NLEVEL];
+    double bin_sum2[ESTIMATOR_NLEVEL];
+    unsigned long int bin_count[ESTIMATOR_NLEVEL];
 } estimator;
 
+/* The allocators of a debug build print the memory they take unless this is 0. */
+extern int memory_report;
+
 model* malloc_model(
             int nsite, 
             int nbond, 
             int mhnspin);
 
+model* malloc_model_implicit(
+            int nsite, 
+            int nedge, 
+            int* edges, 
+            int ntype_edge, 
+            int ntype_site, 
+            int mhnspin);
+
 void free_model(model* m);
 
-void copy_vertex(
-            vertex* dist, 
-            vertex* src);
+/* Mask of the local states that rule accepts on a bond of hNspin sites, for
+** the models that write their rules as functions, see insert_accept.
+*/
+unsigned int insert_rule_mask(
+            insert_rule rule, 
+            int hNspin);
 
 world_line* malloc_world_line(
             int length, 
@@ -97,6 +425,14 @@ void realloc_world_line(
             world_line* w, 
             int length);
 
+/* Length of a world-line that a sweep at beta is unlikely to outgrow: the
+** Poisson mean sweight*beta of the inserted vertices plus a tail margin,
+** twice over for the kept vertices, and the boundaries of all sites.
+*/
+int world_line_capacity(
+            model* m, 
+            double beta);
+
 world_line_omp* malloc_world_line_omp(
             int cap, 
             int mnspin, 
@@ -117,6 +453,20 @@ void realloc_world_line_omp_insert(
             int cap, 
             int i_thread);
 
+chain* malloc_chain();
+
+void free_chain(chain* c);
+
+accumulator* malloc_accumulator();
+
+void malloc_accumulator_buffers(
+            accumulator* a, 
+            int nsite, 
+            int ntime, 
+            int block_size);
+
+void free_accumulator(accumulator* a);
+
 estimator* malloc_estimator(
             int length, 
             char name[128]);
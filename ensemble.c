@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <gsl/gsl_rng.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "dtype.h"
+#include "sis_models.h"
+#include "update.h"
+#include "networks.h"
+#include "estimator.h"
+#include "output.h"
+#include "measurement.h"
+#include "rng.h"
+#include "ensemble.h"
+#include "instrument.h"
+
+ensemble_job* read_jobs(const char* filename, int* njob) {
+    FILE* file = fopen(filename,"r");
+    if(file==NULL) {
+        printf("Can not open the job list: %s\n",filename);
+        exit(1);
+    }
+
+    int n=0;
+    int cap=16;
+    ensemble_job* job = (ensemble_job*)malloc(sizeof(ensemble_job)*cap);
+
+    char line[1024];
+    int nline=0;
+    while(fgets(line,sizeof(line),file)!=NULL) {
+        nline++;
+        char* p = line;
+        while(*p==' ' || *p=='\t') p++;
+        if(*p=='#' || *p=='\n' || *p=='\r' || *p=='\0') continue;
+
+        if(n==cap) {
+            cap *= 2;
+            job = (ensemble_job*)realloc(job,sizeof(ensemble_job)*cap);
+        }
+        ensemble_job* j = &(job[n]);
+        char name[ENSEMBLE_NAME_LENGTH];
+        if(sscanf(p,"%255s %lf %lf %lf %lu",name,&(j->alpha),&(j->gamma),&(j->T),&(j->seed))!=5) {
+            printf("The line %d of the job list %s is not \"network alpha gamma T seed\"!\n",nline,filename);
+            exit(1);
+        }
+        strcpy(j->network,name);
+        j->model = -1;
+        j->cost  = 0;
+        n++;
+    }
+    fclose(file);
+
+    *njob = n;
+    return job;
+}
+
+static double ensemble_wtime() {
+#ifdef _OPENMP
+    return omp_get_wtime();
+#else
+    return (double)clock()/CLOCKS_PER_SEC;
+#endif
+}
+
+// one chain of main.c, measured into the files job<k>_
+static void run_job(ensemble_job* job, int k, model* m, network* g, const ensemble_setting* s) {
+    double start = ensemble_wtime();
+    int nsweep = (s->nblock)*(s->block_size);
+    double pnif = ((double)(s->nif))/(g->nnode);
+
+    gsl_rng* rng = gsl_rng_alloc(rng_chain_type());
+    gsl_rng_set(rng,job->seed);
+    world_line* w = malloc_world_line(world_line_capacity(m,job->T),2*(m->mhnspin),m->nsite);
+    chain* c = malloc_chain();
+    accumulator* a = malloc_accumulator();
+    snprintf(a->prefix,sizeof(a->prefix),"job%d_",k);
+
+    int initial_type=0;
+    int final_type=0;
+    int nocheck=0;
+    running_mode_setup(w,g,s->running_mode,&initial_type,&final_type,&nocheck);
+    w->beta = job->T;
+    if(s->running_mode==3 || s->running_mode==4) c->condition_nif = s->nif;
+
+    double dt = (job->T)/100.0;
+    int ntime = (int)((job->T)/dt+1);
+    double* time_list = (double*)malloc(sizeof(double)*ntime);
+    for(int i=0;i<ntime;i++) {
+        time_list[i] = (dt*i)/(job->T);
+    }
+
+    for(int i=0;i<(s->thermal);i++) {
+        sweep(c,w,m,initial_type,final_type,pnif,rng);
+        flip_cluster(c,w,rng);
+    }
+    counters_reset(&(c->count));
+
+    chain_observe(c,m,time_list,ntime);
+    int ntrial=0;
+    unsigned long int ntrial_total=0;
+    for(int i_sweep=0;i_sweep<nsweep;) {
+        for(int i=0;i<(s->nskip);i++) {
+            sweep(c,w,m,initial_type,final_type,pnif,rng);
+            flip_cluster(c,w,rng);
+        }
+        ntrial++;
+
+        if((ninfected_initial_state(w)==1 && ninfected_final_state(w)>(s->nif)) || nocheck) {
+            a->ntrial_ave += ntrial;
+            ntrial_total  += ntrial;
+            ntrial=0;
+
+            // measurement prints a block at once
+#ifdef _OPENMP
+#pragma omp critical (measurement)
+#endif
+            measurement(c,a,w,m,time_list,ntime,s->block_size,rng);
+            i_sweep++;
+        }
+    }
+
+    FILE* file = output_stream("ensemble.txt","a");
+    char line[1024];
+    int n = snprintf(line,sizeof(line),"%d %s %.12e %.12e %.12e %lu %d",
+                     k,job->network,job->alpha,job->gamma,job->T,job->seed,nsweep);
+    for(int j=0;j<(a->nobs);j++) {
+        n += snprintf(line+n,sizeof(line)-n," %.12e %.12e",estimator_mean(a->est[j]),estimator_binned_error(a->est[j]));
+    }
+    snprintf(line+n,sizeof(line)-n," %.12e %.6e\n",(nsweep>0) ? (double)ntrial_total/nsweep : 0.0,ensemble_wtime()-start);
+    fputs(line,file);
+
+    output_close_prefix(a->prefix);
+    free(time_list);
+    free_accumulator(a);
+    free_chain(c);
+    free_world_line(w);
+    gsl_rng_free(rng);
+}
+
+// the jobs with the largest cost first, ties in the order of the list
+static int compare_cost(const void* x, const void* y) {
+    const ensemble_job* a = *(const ensemble_job* const*)x;
+    const ensemble_job* b = *(const ensemble_job* const*)y;
+    if(a->cost>b->cost) return -1;
+    if(a->cost<b->cost) return  1;
+    return (a<b) ? -1 : (a>b);
+}
+
+void ensemble_run(const char* filename, const ensemble_setting* s, int nthread) {
+    int njob;
+    ensemble_job* job = read_jobs(filename,&njob);
+    if(njob==0) {
+        printf("The job list %s is empty!\n",filename);
+        exit(1);
+    }
+
+    // the distinct networks and (network, alpha, gamma) of the batch
+    int nnetwork=0;
+    int nmodel=0;
+    network** networks = (network**)malloc(sizeof(network*)*njob);
+    int* job_network   = (int*)malloc(sizeof(int)*njob);
+    model** models     = (model**)malloc(sizeof(model*)*njob);
+    int* model_job     = (int*)malloc(sizeof(int)*njob);
+    for(int k=0;k<njob;k++) {
+        int i=0;
+        while(i<k && strcmp(job[i].network,job[k].network)!=0) i++;
+        if(i==k) {
+            networks[nnetwork] = load_network(job[k].network);
+            job_network[k] = nnetwork++;
+        } else {
+            job_network[k] = job_network[i];
+        }
+
+        int l=0;
+        while(l<nmodel && !(job_network[model_job[l]]==job_network[k] &&
+                            job[model_job[l]].alpha==job[k].alpha && job[model_job[l]].gamma==job[k].gamma)) l++;
+        if(l==nmodel) {
+            models[nmodel] = sis_model_build(job[k].alpha,job[k].gamma,networks[job_network[k]]);
+            model_job[nmodel++] = k;
+        }
+        job[k].model = l;
+
+        double lam = (models[l]->sweight)*(job[k].T);
+        job[k].cost = lam*((double)(s->thermal)+(double)(s->nblock)*(s->block_size)*(s->nskip));
+    }
+    printf("%d jobs on %d networks with %d models\n",njob,nnetwork,nmodel);
+    memory_report = 0;
+
+    ensemble_job** order = (ensemble_job**)malloc(sizeof(ensemble_job*)*njob);
+    for(int k=0;k<njob;k++) order[k] = &(job[k]);
+    qsort(order,njob,sizeof(ensemble_job*),compare_cost);
+
+    int ndone=0;
+    progress job_progress;
+    progress_start(&job_progress,"jobs",njob);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic,1) num_threads(nthread)
+#endif
+    for(int i=0;i<njob;i++) {
+        ensemble_job* j = order[i];
+        int k = (int)(j-job);
+        run_job(j,k,models[j->model],networks[job_network[k]],s);
+
+#ifdef _OPENMP
+#pragma omp critical (measurement)
+#endif
+        {
+            ndone++;
+            progress_update(&job_progress,ndone);
+        }
+    }
+
+    memory_report = 1;
+    output_close();
+    for(int l=0;l<nmodel;l++) free_model(models[l]);
+    for(int i=0;i<nnetwork;i++) free_network(networks[i]);
+    free(models);
+    free(model_job);
+    free(networks);
+    free(job_network);
+    free(order);
+    free(job);
+}
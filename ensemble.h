@@ -0,0 +1,78 @@
+#ifndef ensemble_h
+#define ensemble_h
+
+#include "dtype.h"
+#include "networks.h"
+
+/* Longest network file name of a job. */
+#ifndef ENSEMBLE_NAME_LENGTH
+#define ENSEMBLE_NAME_LENGTH 256
+#endif
+
+/* One job of a batch: a chain on a network at (alpha, gamma, T), seeded with
+** seed. model is the index of its model among the distinct (network, alpha,
+** gamma) of the batch; cost orders the jobs, see ensemble_run.
+*/
+typedef struct ensemble_job {
+    char network[ENSEMBLE_NAME_LENGTH];
+    double alpha;
+    double gamma;
+    double T;
+    unsigned long int seed;
+    int model;
+    double cost;
+} ensemble_job;
+
+/* The settings shared by all jobs of a batch, as in the arguments of main.c. */
+typedef struct ensemble_setting {
+    int nif;
+    int running_mode;
+    int block_size;
+    int nblock;
+    int thermal;
+    int nskip;
+} ensemble_setting;
+
+/**
+ * Reads the jobs of a batch from a text file.
+ *
+ * Parameters:
+ *   filename (const char*): Job list, one "network alpha gamma T seed" per line; empty lines and lines starting
+ *                           with '#' are skipped.
+ *   njob (int*): Number of jobs read.
+ *
+ * Behavior:
+ *   - Exits with an error if the file can not be opened or a line is not a job.
+ *
+ * Outputs:
+ *   - The jobs, released with free.
+ */
+ensemble_job* read_jobs(const char* filename, int* njob);
+
+/**
+ * Runs a batch of independent chains, many small networks swept over their parameters in one process.
+ *
+ * Parameters:
+ *   filename (const char*): Job list, see read_jobs.
+ *   s (const ensemble_setting*): nif, running mode, block size, number of blocks, thermalization and nskip of every job.
+ *   nthread (int): Number of OpenMP threads running the jobs.
+ *
+ * Behavior:
+ *   - Every distinct network is read once and every distinct (network, alpha, gamma) builds its model once; the
+ *     jobs share them read-only. The memory reports of the allocators are turned off for the batch.
+ *   - A job is one chain with its own world-line, random number stream and accumulator: thermal sweeps, then
+ *     nblock*block_size measured samples every nskip sweeps, as a single chain of main.c without the cluster
+ *     statistic.
+ *   - The jobs are handed to the threads one at a time by a dynamic schedule, the most expensive first (the number of
+ *     vertices forecast from sweight*T times the number of sweeps), so an idle thread takes the next job and the
+ *     small jobs fill in at the end.
+ *
+ * Outputs:
+ *   - Job k writes the files of measurement() with the prefix job<k>_, closed when the job is done.
+ *   - 'ensemble.txt' gets a line per finished job: k, network, alpha, gamma, T, seed, the number of samples, the mean
+ *     and binned error of ninfection, nrecover and the infected time, the average number of trials and the wall
+ *     time of the job in seconds.
+ */
+void ensemble_run(const char* filename, const ensemble_setting* s, int nthread);
+
+#endif
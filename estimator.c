@@ -1,70 +1,106 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
+#include <gsl/gsl_fft_complex.h>
 
+#include "dtype.h"
+#include "estimator.h"
 
-static int filled_flag=0;
-static int sequence_tag=0;
-static int sequence_nobs=0;
-static int sequence_size=0;
-static double* sequence=NULL;
-static double* autocorrelation=NULL;
+void estimator_append(estimator* e, double x) {
+    // carry the bin up the levels as long as it completes a pair
+    double bin=x;
+    int level=0;
+    while(level<ESTIMATOR_NLEVEL) {
+        e->bin_sum[level]  += bin;
+        e->bin_sum2[level] += bin*bin;
+        e->bin_count[level]++;
 
-void sequence_malloc(int size, int nobs) {
-    sequence = (double*)malloc(sizeof(double)*size*nobs);
-    autocorrelation = (double*)malloc(sizeof(double)*size*nobs);
-
-    for(int i=0;i<size;i++){
-        for(int j=0;j<nobs;j++) {
-            sequence[i*nobs+j]=0;
-            autocorrelation[i*nobs+j]=0;
+        if(!(e->bin_pending[level])) {
+            e->bin_partial[level] = bin;
+            e->bin_pending[level] = 1;
+            break;
         }
+
+        bin = 0.5*(e->bin_partial[level]+bin);
+        e->bin_pending[level] = 0;
+        level++;
     }
+    e->count++;
 
-    sequence_size = size;
-    sequence_nobs = nobs;
+    e->samples[e->n] = x;
+    e->n++;
+    if(e->n==(e->length)) estimator_block(e);
 }
 
-static int sequence_append_count=0;
-void sequence_append(double* samples) {
-    int size = sequence_size;
-    int nobs = sequence_nobs;
-    int tag  = sequence_tag;
-    int index=tag*nobs;
+void estimator_block(estimator* e) {
+    int n = e->n;
+    int nfft = e->nfft;
+    double* fft = e->fft;
+    double* rho = e->autocorrelation;
+
+    for(int t=0;t<(e->length);t++) rho[t]=0;
+    e->tau = 0.5;
+    if(n==0) return;
 
-    for(int i=0;i<nobs;i++) {
-        sequence[index+i] = samples[i];
+    double mean=0;
+    for(int i=0;i<n;i++) mean += e->samples[i];
+    mean = mean/n;
+
+    for(int i=0;i<n;i++) {
+        fft[2*i+0] = e->samples[i]-mean;
+        fft[2*i+1] = 0;
+    }
+    for(int i=n;i<nfft;i++) {
+        fft[2*i+0] = 0;
+        fft[2*i+1] = 0;
     }
 
-    if(filled_flag) {
-        for(int i=1;i<(size+1);i++) {
-            index = ((tag+i)%size)*nobs;
-            for(int j=0;j<nobs;j++) {
-                autocorrelation[(size-i)*nobs+j] += samples[j]*sequence[index+j];
-            }
-        }
-        sequence_append_count++;
+    // |F(dx)|^2 transforms back to the correlation sum_i dx_i dx_{i+t}
+    gsl_fft_complex_radix2_forward(fft,1,nfft);
+    for(int i=0;i<nfft;i++) {
+        fft[2*i+0] = fft[2*i+0]*fft[2*i+0]+fft[2*i+1]*fft[2*i+1];
+        fft[2*i+1] = 0;
     }
-    sequence_tag++;
+    gsl_fft_complex_radix2_inverse(fft,1,nfft);
 
-    if(sequence_tag==size) {
-        filled_flag=1;
+    double c0 = fft[0]/n;
+    if(c0>0) {
+        for(int t=0;t<n;t++) rho[t] = fft[2*t]/(n-t)/c0;
 
-        sequence_tag=0;
+        for(int t=1;t<n;t++) {
+            e->tau += rho[t];
+            if(t>=5.0*(e->tau)) break;
+        }
+    } else {
+        rho[0] = 1.0;
     }
 
-    if(sequence_append_count==size) {
-        FILE* file_a = fopen("autocorrelation.txt","a");
-        for(int i=0;i<size;i++) {
-            for(int j=0;j<nobs;j++) {
-                autocorrelation[i*nobs+j] = autocorrelation[i*nobs+j]/sequence_append_count;
-                fprintf(file_a,"%.12e ",autocorrelation[i*nobs+j]);
+    e->n = 0;
+}
 
-                autocorrelation[i*nobs+j]=0;
-            }
-            fprintf(file_a,"\n");
-        }
-        fclose(file_a);
+double estimator_mean(estimator* e) {
+    if(e->bin_count[0]==0) return 0;
+    return e->bin_sum[0]/(e->bin_count[0]);
+}
 
-        sequence_append_count=0;
-    }
+double estimator_error(estimator* e, int level) {
+    double count = (double)(e->bin_count[level]);
+    if(count<2) return 0;
+
+    double mean = e->bin_sum[level]/count;
+    double var  = (e->bin_sum2[level]/count-mean*mean)*count/(count-1);
+    if(var<0) var=0;
+
+    return sqrt(var/count);
+}
+
+double estimator_binned_error(estimator* e) {
+    int level=0;
+    while(level+1<ESTIMATOR_NLEVEL && e->bin_count[level+1]>=ESTIMATOR_MIN_BINS) level++;
+
+    return estimator_error(e,level);
+}
+
+void estimator_write(estimator* e, FILE* file) {
+    fprintf(file,"%s %.12e %.12e %.12e %.12e\n",e->name,estimator_mean(e),estimator_error(e,0),estimator_binned_error(e),e->tau);
 }
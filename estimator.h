@@ -1,8 +1,62 @@
 #ifndef estimator_h
 #define estimator_h
 
-void sequence_malloc(int size, int nobs);
+#include "dtype.h"
 
-void sequence_append(double* samples);
+/* Binning levels with fewer bins than this are too noisy to give an error. */
+#ifndef ESTIMATOR_MIN_BINS
+#define ESTIMATOR_MIN_BINS 32
+#endif
+
+/**
+ * Appends a sample to a streaming estimator.
+ *
+ * Parameters:
+ *   e (estimator*): Pointer to the estimator.
+ *   x (double): The sample.
+ *
+ * Behavior:
+ *   - Adds x to level 0 of the logarithmic binning and carries the mean of every completed pair of bins to the
+ *     next level, which costs O(1) amortized per sample.
+ *   - Stores x in the current block; once e->length samples are stored, estimator_block is called and the block
+ *     starts over.
+ */
+void estimator_append(estimator* e, double x);
+
+/**
+ * Computes the autocorrelation of the samples of the current block and its integrated autocorrelation time.
+ *
+ * Parameters:
+ *   e (estimator*): Pointer to the estimator with e->n samples in the current block.
+ *
+ * Behavior:
+ *   - Subtracts the block mean and computes C(t) = sum_i dx_i dx_{i+t} / (n-t) with a zero padded FFT of size
+ *     e->nfft (one forward and one inverse transform), O(n log n) per block.
+ *   - Fills e->autocorrelation[t] = C(t)/C(0) for t < n and 0 beyond.
+ *   - Sets e->tau = 1/2 + sum_{t=1}^{W} rho(t), with the window W the smallest t >= 5*tau (Sokal).
+ *   - Empties the block.
+ */
+void estimator_block(estimator* e);
+
+/**
+ * Returns the mean of all samples appended so far.
+ */
+double estimator_mean(estimator* e);
+
+/**
+ * Returns the error of the mean estimated from the bins of a binning level (level 0 is the naive error), or 0
+ * if the level has less than two bins.
+ */
+double estimator_error(estimator* e, int level);
+
+/**
+ * Returns the binning error of the deepest level with at least ESTIMATOR_MIN_BINS bins.
+ */
+double estimator_binned_error(estimator* e);
+
+/**
+ * Writes one line "name mean naive_error binned_error tau" to a file.
+ */
+void estimator_write(estimator* e, FILE* file);
 
 #endif
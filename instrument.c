@@ -0,0 +1,145 @@
+#define _POSIX_C_SOURCE 200809L
+#ifdef USE_PERF
+// syscall() is not part of POSIX
+#define _DEFAULT_SOURCE
+#endif
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#ifdef USE_PERF
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#include "instrument.h"
+
+static double wall_time() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC,&t);
+    return t.tv_sec+1e-9*t.tv_nsec;
+}
+
+void progress_start(progress* p, const char* stage, long total) {
+    p->stage = stage;
+    p->total = total;
+    p->start = wall_time();
+    p->last  = p->start;
+}
+
+void progress_update(progress* p, long done) {
+    double now = wall_time();
+    if(done<(p->total) && now-(p->last)<PROGRESS_INTERVAL) return;
+    p->last = now;
+
+    double elapsed = now-(p->start);
+    double rate = (elapsed>0) ? done/elapsed : 0.0;
+    double eta  = (rate>0) ? ((p->total)-done)/rate : 0.0;
+    printf("progress stage=%s done=%ld total=%ld elapsed=%.3e rate=%.3e eta=%.3e\n",
+           p->stage,done,p->total,elapsed,rate,eta);
+    fflush(stdout);
+}
+
+void counters_reset(counters* k) {
+    memset(k,0,sizeof(counters));
+}
+
+void counters_add(counters* sum, const counters* k) {
+    sum->sweeps             += k->sweeps;
+    sum->candidates         += k->candidates;
+    sum->accepted           += k->accepted;
+    sum->removed            += k->removed;
+    sum->legs               += k->legs;
+    sum->root_steps         += k->root_steps;
+    sum->clusters           += k->clusters;
+    sum->free_clusters      += k->free_clusters;
+    sum->reallocs           += k->reallocs;
+    sum->condition_flips    += k->condition_flips;
+    sum->condition_rejected += k->condition_rejected;
+    if(k->perf_open) {
+        sum->perf_open = 1;
+        for(int i=0;i<COUNTERS_NPERF;i++) sum->perf[i] += k->perf[i];
+    }
+}
+
+#ifdef USE_PERF
+static const unsigned long long perf_config[COUNTERS_NPERF] = {
+    PERF_COUNT_HW_CPU_CYCLES,
+    PERF_COUNT_HW_INSTRUCTIONS,
+    PERF_COUNT_HW_CACHE_MISSES
+};
+#endif
+
+void counters_perf_open(chain* c) {
+    for(int i=0;i<COUNTERS_NPERF;i++) c->perf_fd[i] = -1;
+#ifdef USE_PERF
+    for(int i=0;i<COUNTERS_NPERF;i++) {
+        struct perf_event_attr attr;
+        memset(&attr,0,sizeof(attr));
+        attr.type   = PERF_TYPE_HARDWARE;
+        attr.size   = sizeof(attr);
+        attr.config = perf_config[i];
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+
+        // the calling thread on any cpu
+        int fd = (int)syscall(SYS_perf_event_open,&attr,0,-1,-1,0);
+        if(fd<0) {
+            counters_perf_close(c);
+            return;
+        }
+        c->perf_fd[i] = fd;
+    }
+#endif
+}
+
+void counters_perf_read(chain* c) {
+#ifdef USE_PERF
+    if(c->perf_fd[0]<0) return;
+
+    for(int i=0;i<COUNTERS_NPERF;i++) {
+        long long value=0;
+        if(read(c->perf_fd[i],&value,sizeof(value))!=sizeof(value)) value=0;
+        ioctl(c->perf_fd[i],PERF_EVENT_IOC_RESET,0);
+        c->count.perf[i] += value;
+    }
+    c->count.perf_open = 1;
+#endif
+}
+
+void counters_perf_close(chain* c) {
+    for(int i=0;i<COUNTERS_NPERF;i++) {
+#ifdef USE_PERF
+        if(c->perf_fd[i]>=0) close(c->perf_fd[i]);
+#endif
+        c->perf_fd[i] = -1;
+    }
+}
+
+static double counters_ratio(double a, double b) {
+    return (b>0) ? a/b : 0.0;
+}
+
+void counters_write(FILE* fp, const counters* k, long block, int samples, double trials, double seconds) {
+    fprintf(fp,"{\"block\":%ld,\"samples\":%d,\"sweeps\":%lld,\"seconds\":%.6e,",block,samples,k->sweeps,seconds);
+    fprintf(fp,"\"candidates\":%lld,\"accepted\":%lld,\"accept_rate\":%.6e,",
+            k->candidates,k->accepted,counters_ratio(k->accepted,k->candidates));
+    fprintf(fp,"\"removed\":%lld,\"removed_per_sweep\":%.6e,",k->removed,counters_ratio(k->removed,k->sweeps));
+    fprintf(fp,"\"legs\":%lld,\"root_steps\":%lld,\"root_steps_per_leg\":%.6e,",
+            k->legs,k->root_steps,counters_ratio(k->root_steps,k->legs));
+    fprintf(fp,"\"clusters\":%lld,\"free_clusters\":%lld,\"clusters_per_sweep\":%.6e,\"free_fraction\":%.6e,",
+            k->clusters,k->free_clusters,counters_ratio(k->clusters,k->sweeps),counters_ratio(k->free_clusters,k->clusters));
+    fprintf(fp,"\"reallocs\":%lld,",k->reallocs);
+    fprintf(fp,"\"trials\":%.0f,\"trial_reject_rate\":%.6e,",trials,(trials>0) ? 1.0-samples/trials : 0.0);
+    fprintf(fp,"\"condition_flips\":%lld,\"condition_rejected\":%lld,\"condition_reject_rate\":%.6e,",
+            k->condition_flips,k->condition_rejected,counters_ratio(k->condition_rejected,k->condition_flips));
+
+    const char* names[COUNTERS_NPERF] = {"cycles","instructions","cache_misses"};
+    for(int i=0;i<COUNTERS_NPERF;i++) {
+        if(k->perf_open) fprintf(fp,"\"%s\":%lld",names[i],k->perf[i]);
+        else fprintf(fp,"\"%s\":null",names[i]);
+        fprintf(fp,(i<COUNTERS_NPERF-1) ? "," : "}\n");
+    }
+}
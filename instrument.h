@@ -0,0 +1,107 @@
+#ifndef instrument_h
+#define instrument_h
+
+#include <stdio.h>
+
+#include "dtype.h"
+
+/* Instrumentation level of the build (make LEVEL=production|validate|debug).
+**   production - errors and the rate-limited progress lines only.
+**   validate   - also the consistency checks of the sweeps and measurement
+**                (time order of the vertices, site indices) and the block
+**                summaries of measurement() on stdout.
+**   debug      - also the memory reports of the allocators, the link table
+**                of the models and the prints of cluster_statistic.
+** The checks and prints of a higher level are not compiled in, so a
+** production build executes none of their branches.
+*/
+#define LEVEL_PRODUCTION 0
+#define LEVEL_VALIDATE   1
+#define LEVEL_DEBUG      2
+
+#ifndef INSTRUMENT_LEVEL
+#define INSTRUMENT_LEVEL LEVEL_PRODUCTION
+#endif
+
+#define INSTRUMENT_VALIDATE (INSTRUMENT_LEVEL>=LEVEL_VALIDATE)
+#define INSTRUMENT_DEBUG    (INSTRUMENT_LEVEL>=LEVEL_DEBUG)
+
+/* Least number of seconds between two lines of a progress logger. */
+#ifndef PROGRESS_INTERVAL
+#define PROGRESS_INTERVAL 10.0
+#endif
+
+/* Progress of one stage of a run (thermal, measurement, jobs, ...). */
+typedef struct progress {
+    const char* stage;
+    long total;
+    double start;
+    double last;
+} progress;
+
+/**
+ * Starts a progress logger for a stage of total steps.
+ */
+void progress_start(progress* p, const char* stage, long total);
+
+/**
+ * Reports that done of the total steps of the stage are done.
+ *
+ * Behavior:
+ *   - Prints one line "progress stage=<stage> done=<done> total=<total> elapsed=<s> rate=<steps/s> eta=<s>" if
+ *     PROGRESS_INTERVAL seconds of wall time passed since the last line, and always for the last step; otherwise it
+ *     only reads the clock.
+ *   - A logger belongs to one thread, the lines of several loggers are written with a single printf each.
+ */
+void progress_update(progress* p, long done);
+
+/* measurement() writes a line of 'counters.txt' per block unless this is 0. */
+#ifndef COUNTERS_OUTPUT
+#define COUNTERS_OUTPUT 1
+#endif
+
+void counters_reset(counters* k);
+
+/**
+ * Adds the counters k to sum.
+ */
+void counters_add(counters* sum, const counters* k);
+
+/**
+ * Opens the hardware counters of the chain, called by its first sweep.
+ *
+ * Behavior:
+ *   - In a build with USE_PERF (make PERF=1) opens the cycles, instructions and cache misses of the calling thread
+ *     with perf_event_open, user space only; the threads a chain starts for its clusters are not counted.
+ *   - A counter the kernel denies (perf_event_paranoid, a container without the syscall) is left closed, without
+ *     an error; the counters then stay off for the chain and its lines of 'counters.txt' hold null.
+ *   - Without USE_PERF it only marks them closed.
+ */
+void counters_perf_open(chain* c);
+
+/**
+ * Adds the hardware counts since the last read to c->count and restarts them; nothing if they are closed.
+ */
+void counters_perf_read(chain* c);
+
+void counters_perf_close(chain* c);
+
+/**
+ * Writes the counters k of a block as one JSON object on a line of fp.
+ *
+ * Parameters:
+ *   block (long): Number of the block, from 0.
+ *   samples (int), trials (double): Samples of the block and the sweeps it took to draw them, the sweeps
+ *                                   rejected by the check of the running mode included.
+ *   seconds (double): Processor time of the block.
+ *
+ * Behavior:
+ *   - The keys are the counts of k with the rates derived from them: accept_rate (accepted/candidates),
+ *     removed_per_sweep, root_steps_per_leg (the average path from a leg to its root when the clusters are
+ *     labelled), clusters_per_sweep, free_fraction (free clusters/clusters), trial_reject_rate (1-samples/trials)
+ *     and condition_reject_rate (rejected/conditioned flips), 0 when there is nothing to divide by.
+ *   - cycles, instructions and cache_misses are null unless the hardware counters were open.
+ */
+void counters_write(FILE* fp, const counters* k, long block, int samples, double trials, double seconds);
+
+#endif
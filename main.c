@@ -1,453 +1,27 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <time.h>
 #include <gsl/gsl_rng.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "dtype.h"
 #include "sis_models.h"
 #include "update.h"
 #include "networks.h"
 #include "estimator.h"
-
-// Returns the initial number of infected nodes in the world line
-int ninfected_initial_state(world_line* w) {
-    int nnode=w->nsite;  // Number of nodes in the world line
-    int ninfected=0;     // Number of infected nodes
-
-    // Iterate over all nodes in the world line
-    for(int i=0;i<nnode;i++) {
-        ninfected+=w->istate[i];  // Add 1 to ninfected for each infected node
-    }
-
-    // Return the average of ninfected and nnode, rounded up
-    return (ninfected+nnode)/2;
-}
-
-// Returns the final number of infected nodes in the world line
-int ninfected_final_state(world_line* w) {
-    int nnode=w->nsite;  // Number of nodes in the world line
-    int ninfected=0;     // Number of infected nodes
-
-    // Iterate over all nodes in the world line
-    for(int i=0;i<nnode;i++) {
-        ninfected+=w->pstate[i];  // Add 1 to ninfected for each infected node
-    }
-
-    // Return the average of ninfected and nnode, rounded up
-    return (ninfected+nnode)/2;
-}
-
-
-// Define a global variable to store the frozen list for boundary condition type 1
-int* boundary_condition_frozen_list=NULL;
-
-void boundary_condition_initial_state(world_line* w, model* m, int type, gsl_rng* rng) {
-    // Get the number of nodes and bonds in the model
-    int nnode = m->nsite;
-    int nbond = m->nbond;
-
-    // Calculate the length of the sequence after adding nodes
-    int length = nnode+(w->nvertices);
-
-    // Resize the world line sequence to fit the new nodes
-    realloc_world_line(w,length);
-
-    // Pointers to the two sequences of vertices in the world line
-    vertex* sequence1 = w->sequenceB;
-    vertex* sequence2 = w->sequenceA;
-
-    // Swap the pointers if the flag in the world line is true
-    if(w->flag) {
-        sequence1 = w->sequenceA;
-        sequence2 = w->sequenceB;
-    }
-
-    // Allocate memory for the frozen list if it hasn't been allocated yet
-    if(boundary_condition_frozen_list==NULL) {
-        boundary_condition_frozen_list = (int*)malloc(sizeof(int)*nnode);
-    }
-
-    // Counter for the number of vertices in the sequence
-    int n=0;
-
-    // Assign initial states to the vertices based on the boundary condition type
-    if(type==0) {
-        for(int i=0;i<nnode;i++) {
-            (sequence2[n]).tau      = 0.0;
-            (sequence2[n]).bond     = nbond+i;
-            (sequence2[n]).hNspin   = 1;
-            (sequence2[n]).state[0] = w->istate[i];
-            (sequence2[n]).state[1] = w->istate[i];
-            n++;
-        }
-    } else if(type==1) {
-        int ninfected=0;
-        int i_node=-1;
-        for(int i=0;i<nnode;i++) {
-            if(w->istate[i]==-1) {
-                boundary_condition_frozen_list[i]=1;
-            } else {
-                boundary_condition_frozen_list[i]=0;
-                i_node=i;
-                ninfected++;
-            }
-        }
-        if(ninfected==1) {
-            int check=1;
-            while(check) {
-                int j = nearest_nb_random_assign(i_node,rng);
-                if(boundary_condition_frozen_list[j]) {
-                    boundary_condition_frozen_list[j]=0;
-                    check=0;
-                }
-            }
-        } else if(ninfected==0) {
-            for(int i=0;i<nnode;i++) 
-                boundary_condition_frozen_list[i]=0;
-        }
-        for(int i=0;i<nnode;i++) {
-            if(boundary_condition_frozen_list[i]) {
-                (sequence2[n]).tau      = 0.0;
-                (sequence2[n]).bond     = nbond+i;
-                (sequence2[n]).hNspin   = 1;
-                (sequence2[n]).state[0] = w->istate[i];
-                (sequence2[n]).state[1] = w->istate[i];
-                n++;
-            }
-        }
-    }
-
-
-    for(int i=0;i<(w->nvertices);i++) {
-        copy_vertex(&(sequence2[n]),&(sequence1[i]));
-        n++;
-    }
-
-    w->nvertices = n;
-    w->flag = !(w->flag);
-}
-
-void boundary_condition_final_state(world_line* w, model* m, double p, int type, gsl_rng* rng) {
-    // get the number of nodes and bonds, and calculate the required length
-    int nnode = m->nsite;
-    int nbond = m->nbond;
-    int length = nnode+(w->nvertices);
-    // allocate or reallocate memory for the world line
-    realloc_world_line(w,length);
-
-    // get the appropriate sequence depending on the flag
-    vertex* sequence = w->sequenceB;
-    if(w->flag) {
-        sequence = w->sequenceA;
-    }
-
-    // get the pointer to the pstate array, and the number of vertices
-    int* pstate = w->pstate;
-    int n=w->nvertices;
-
-    // set the appropriate final state based on the type of boundary condition
-    if(type==0) {
-        // set all nodes to their initial state with tau=1
-        for(int i=0;i<nnode;i++) {
-            (sequence[n]).tau      = 1.0;
-            (sequence[n]).bond     = nbond+i;
-            (sequence[n]).hNspin   = 1;
-            (sequence[n]).state[0] = pstate[i];
-            (sequence[n]).state[1] = pstate[i];
-            n++;
-        }
-    } else if(type==1) {
-        // set boundary nodes based on the infection state of the system and the probability p
-        int inf=0;
-        for(int i=0;i<nnode;i++) inf += (pstate[i]+1)/2;
-
-        double pdis = 1.0;
-        if(inf!=0) pdis=(p*nnode)/inf;
-        if(inf>p*nnode) pdis=0;
-        
-        for(int i=0;i<nnode;i++) {
-            if(pstate[i]==1 && (gsl_rng_uniform_pos(rng)<pdis)) {
-                (sequence[n]).tau      = 1.0;
-                (sequence[n]).bond     = nbond+i;
-                (sequence[n]).hNspin   = 1;
-                (sequence[n]).state[0] = pstate[i];
-                (sequence[n]).state[1] = pstate[i];
-                n++;
-            }
-        }
-    } else if(type==2) {
-        // set frozen nodes to their final state with tau=1
-        for(int i=0;i<nnode;i++) {
-            if(pstate[i]==-1) {
-                (sequence[n]).tau      = 1.0;
-                (sequence[n]).bond     = nbond+i;
-                (sequence[n]).hNspin   = 1;
-                (sequence[n]).state[0] = pstate[i];
-                (sequence[n]).state[1] = pstate[i];
-                n++;
-            }
-        }
-    }
-
-    // update the number of vertices in the world line
-    w->nvertices = n;
-}
-
-static void print_state(int* state, int nnode) {
-    // This function prints the state of each node in the world_line.
-    // It takes as input an array of node states and the number of nodes.
-    for(int i=0;i<nnode;i++) {
-        printf("%d ",(state[i]+1)/2);
-    }
-    printf("\n");
-}
-
-static void save_state(FILE* file, int* state, int nnode) {
-    // This function writes the state of each node in the world_line to a file.
-    // It takes as input a file pointer, an array of node states, and the number of nodes.
-    for(int i=0;i<nnode;i++) {
-        fprintf(file,"%d ",(state[i]+1)/2);
-    }
-    fprintf(file,"\n");
-}
-
-void show_configuration(world_line* w, model* m, double* time_list, int ntime) {
-    // This function displays the configuration of the world_line at specified times.
-    // It takes as input a pointer to the world_line, a pointer to the model, an array of times,
-    // and the number of times to display.
-    int* pstate = w->pstate;
-    int nnode = w->nsite;
-    int mhnspin = m->mhnspin;
-
-    // Copy the initial state of the world_line nodes to pstate.
-    for(int i=0;i<nnode;i++) pstate[i] = w->istate[i];
-
-    // Get the vertex sequence to traverse.
-    vertex* sequence = w->sequenceB;
-    if(w->flag) 
-        sequence = w->sequenceA;
-
-    int i=0; // Index of current time to display
-    int index, i_node; 
-    vertex* v;
-    for(int n=0;n<(w->nvertices) && i<ntime;n++) {
-        v = &(sequence[n]);
-        if(time_list[i]<(v->tau)) { // Check if it's time to display the state
-            print_state(pstate,nnode);
-            i++;
-        }
-
-        // Update the state of nodes according to vertex information.
-        for(i_node=0;i_node<(v->hNspin);i_node++) {
-            index = m->bond2index[(v->bond)*mhnspin+i_node];
-            pstate[index] = v->state[(v->hNspin)+i_node];
-        }
-    }
-
-    // If there are remaining times to display, display the last state.
-    for(;i<ntime;i++) {
-        print_state(pstate,nnode);
-    }
-}
-
-
-void save_configuration(FILE* file, world_line* w, model* m, double* time_list, int ntime) {
-    int* pstate = w->pstate;
-    int nnode = w->nsite;
-    int mhnspin = m->mhnspin;
-
-    for(int i=0;i<nnode;i++) pstate[i] = w->istate[i];
-
-    vertex* sequence = w->sequenceB;
-    if(w->flag) 
-        sequence = w->sequenceA;
-
-    int i=0;
-    int index, i_node;
-    vertex* v;
-    for(int n=0;n<(w->nvertices) && i<ntime;n++) {
-        v = &(sequence[n]);
-        if(time_list[i]<(v->tau)) {
-            save_state(file,pstate,nnode);
-            i++;
-        }
-
-        for(i_node=0;i_node<(v->hNspin);i_node++) {
-            index = m->bond2index[(v->bond)*mhnspin+i_node];
-            pstate[index] = v->state[(v->hNspin)+i_node];
-        }
-    }
-    for(;i<ntime;i++) {
-        save_state(file,pstate,nnode);
-    }
-}
-
-/**
- * This function performs measurements for a stochastic simulation of an epidemic model using a CPMC algorithm.
- * It updates statistical measures of the simulation such as the average number of infections, recoveries, and the total infected time.
- * Additionally, it handles file outputs for recording simulation data across different stages of the simulation process.
- *
- * Parameters:
- *   w (world_line*): Pointer to the world_line structure containing the state of the simulation.
- *   m (model*): Pointer to the model structure containing the parameters and state of the epidemic model.
- *   time_list (double*): Array of time points at which measurements are taken.
- *   ntime (int): Number of time points in time_list.
- *   block_size (int): Number of simulation updates per measurement block.
- *
- * Detailed Behavior:
- *   - The function initializes memory for storing infected ratios and times if not already done.
- *   - It goes through all vertices in the sequence (either sequenceA or sequenceB based on the world_line flag),
- *     updating the state of nodes and computing the total infected time and the number of infections.
- *   - After processing all vertices, it computes the infected ratio for the remaining times in the time_list.
- *   - Every block_size number of measurements, it writes out averaged results to files and resets the averages for the next block.
- *   - It also calculates the total running time for each block and logs this information.
- *
- * Outputs:
- *   - This function writes to several files:
- *     - 'conf.txt': Configuration data of the conditional-path.
- *     - 'times.txt': Times at which measurements were taken.
- *     - 'series.txt': Infected ratios over time.
- *     - 'global.txt': Global averages of infection and recovery counts, and total infected time.
- *   - Additionally, it prints the infected ratio over time to the standard output and logs the time taken for each block.
- */
-
-static time_t start_time,end_time;
-static unsigned long int measurement_count=0;
-static double* infected_ratio=NULL;
-static double* infected_time=NULL;
-static double total_infected_time_ave=0;
-static double ninfection_ave=0;
-static double nrecover_ave=0;
-static double ntrial_ave=0;
-void measurement(world_line* w, model* m, double* time_list, int ntime, int block_size) {
-    if(infected_ratio==NULL) {
-        infected_time = (double*)malloc(sizeof(double)*(w->nsite));
-        infected_ratio = (double*)malloc(sizeof(double)*ntime);
-        for(int i=0;i<(w->nsite);i++) infected_time[i]=0;
-        for(int i=0;i<ntime;i++) infected_ratio[i]=0;
-
-        sequence_malloc(block_size,3);
-        start_time = clock();
-    }
-    int* pstate = w->pstate;
-    int nnode = w->nsite;
-    int mhnspin = m->mhnspin;
-
-    for(int i=0;i<nnode;i++) {
-        pstate[i] = w->istate[i];
-        infected_time[i] = 0;
-    }
-
-    vertex* sequence = w->sequenceB;
-    if(w->flag) 
-        sequence = w->sequenceA;
-
-    double total_infected_time=0;
-
-    int i=0;
-    int index, i_node;
-    vertex* v;
-    double tau_p=0;
-    for(int n=0;n<(w->nvertices) && i<ntime;n++) {
-        v = &(sequence[n]);
-        if(time_list[i]<(v->tau)) {
-            double ir=0;
-            for(int i_node=0;i_node<nnode;i_node++) {
-                ir+=0.5*(pstate[i_node]+1);
-            }
-            ir = ir/nnode;
-            infected_ratio[i] += ir;
-            i++;
-        }
-
-        for(i_node=0;i_node<(v->hNspin);i_node++) {
-            index = m->bond2index[(v->bond)*mhnspin+i_node];
-            if(pstate[index]==1) {
-                total_infected_time += ((v->tau)-infected_time[index]);
-            }
-            pstate[index] = v->state[(v->hNspin)+i_node];
-            if(pstate[index]==1) {
-                infected_time[index] = v->tau;
-            }
-        }
-        if(tau_p>(v->tau)) printf("tau_p > tau!\n");
-        else if((v->tau)<0) printf("tau < 0!\n");
-        else if((v->tau)>1) printf("tau > 1!\n");
-        tau_p = v->tau;
-    }
-    for(i_node=0;i_node<nnode;i_node++) {
-        if(pstate[i_node]==1)
-            total_infected_time += (1.0-infected_time[i_node]);
-    }
-
-    for(;i<ntime;i++) {
-        double ir=0;
-        for(int i_node=0;i_node<nnode;i_node++) {
-            ir+=0.5*(pstate[i_node]+1);
-        }
-        ir = ir/nnode;
-        infected_ratio[i] += ir;
-    }
-
-    // collecting the obeservable
-    total_infected_time_ave += total_infected_time;
-    ninfection_ave += ninfection_value();
-    nrecover_ave  += nrecover_value();
-    
-    double samples[3];
-    samples[0] = ninfection_value();
-    samples[1] = nrecover_value();
-    samples[2] = total_infected_time*(w->beta);
-    sequence_append(samples);
-
-    measurement_count++;
-
-    if(measurement_count==block_size) {
-        FILE* file_conf = fopen("conf.txt","a");
-        FILE* file_t = fopen("times.txt","w");
-        FILE* file_s = fopen("series.txt","a");
-        FILE* file_g = fopen("global.txt","a");
-        printf("------------------------------\n");
-        printf(" t    |    I/N\n");
-        for(i=0;i<ntime;i++) {
-            infected_ratio[i] = infected_ratio[i]/block_size;
-            printf("%.4lf  %.12lf\n",time_list[i]*w->beta,infected_ratio[i]);
-            fprintf(file_t,"%.4lf ",time_list[i]*w->beta);
-            fprintf(file_s,"%.12e ",infected_ratio[i]);
-
-            infected_ratio[i] = 0;
-        }
-        fprintf(file_t,"\n");
-        fprintf(file_s,"\n");
-        measurement_count=0;
-
-        nrecover_ave = nrecover_ave/block_size;
-        ninfection_ave = ninfection_ave/block_size;
-        ntrial_ave = ntrial_ave/block_size;
-        total_infected_time_ave = total_infected_time_ave/block_size*(w->beta);
-        fprintf(file_g,"%.12e %.12e %.12e %.12e\n",ninfection_ave,nrecover_ave,total_infected_time_ave,ntrial_ave);
-
-        printf("total infected time = %.12e\n",total_infected_time_ave);
-        printf("average # of trial  = %.12e\n",ntrial_ave);
-
-        save_configuration(file_conf,w,m,time_list,ntime);
-
-        total_infected_time_ave=0;
-        nrecover_ave=0;
-        ninfection_ave=0;
-        ntrial_ave=0;
-
-        fclose(file_conf);
-        fclose(file_t);
-        fclose(file_s);
-        fclose(file_g);
-
-        end_time = clock();
-        printf("time for this block = %.2lf(sec)\n",(double)(end_time-start_time)/CLOCKS_PER_SEC);
-        start_time = clock();
-    }
-}
+#include "checkpoint.h"
+#include "output.h"
+#include "tempering.h"
+#include "rng.h"
+#include "measurement.h"
+#include "ensemble.h"
+#include "instrument.h"
+#include "ssa.h"
+#include "domain.h"
 
 /**
  * This is the main function for a stochastic simulation of an epidemic using a CPMC algorithm.
@@ -455,21 +29,37 @@ void measurement(world_line* w, model* m, double* time_list, int ntime, int bloc
  * the simulation environment, and the system configuration.
  *
  * Command-line arguments:
- *   argv[1] - alpha (double): The rate of infection per contact.
- *   argv[2] - gamma (double): The recovery rate.
- *   argv[3] - T (double): The total simulation time.
- *   argv[4] - nif (int): The threshold number of infections.
+ *   argv[1] - alpha (double): The rate of infection per contact, or a comma separated ladder of rates.
+ *             A third column of the edgelist (a number or {'weight': w}) scales it per edge.
+ *   argv[2] - gamma (double): The recovery rate, scaled per node by the optional file <edgelist>.recovery.
+ *   argv[3] - T (double): The total simulation time, or a comma separated ladder of times.
+ *   argv[4] - nif (int): The threshold number of infections, or a comma separated ladder of thresholds (modes 3, 4).
  *   argv[5] - running_mode (int): Determines the running conditions of the simulation.
  *   argv[6] - block_size (int): The number of updates in each block during the simulation.
  *   argv[7] - nblock (int): The number of blocks in the simulation.
  *   argv[8] - thermal (int): The number of thermalization steps before measurement starts.
  *   argv[9] - nskip (int): The number of updates to skip between measurements.
  *   argv[10] - seed (unsigned long int): Seed for the random number generator.
+ *   argv[11] - nchain (int, optional): The number of independent Markov chains, one per OpenMP thread (default 1).
+ *   argv[12] - nthread (int, optional): The number of OpenMP threads used inside each chain (default 1).
+ *   argv[13] - checkpoint (char*, optional): Checkpoint file. The run resumes from it if it exists and writes it
+ *              after thermalization and at the end; with nchain = 1 also every 1000 thermalization sweeps and
+ *              after every block. With nchain > 1 the chains are never all at a sample at once, so nothing after
+ *              thermalization is checkpointed until the run ends: a killed run resumes from the thermalized
+ *              state and measures all its blocks again. Resuming cuts the output files back to their lengths at
+ *              the checkpoint. The checkpoint only resumes the run that wrote it: another seed, block_size or
+ *              model is an error.
  *
  * Running modes:
  *   0 - Patient zero is fixed, and simulation runs until the number of infections exceeds nif.
  *   1 - Patient zero moves, and simulation runs until the number of infections exceeds nif.
  *   2 - All nodes start infected, and simulation runs until all nodes recover.
+ *   3, 4 - As 0 and 1, but once a chain reaches a configuration with more than nif infections it rejects the cluster
+ *          flips that would leave them, so every later sweep is a sample of the conditioned distribution. A single
+ *          chain can not pass through small outbreaks any more and mixes slowly; a ladder of nif, e.g. -1,10,20,30,
+ *          runs a chain per threshold and swaps their world-lines, so the outbreaks of the top point decorrelate
+ *          through the lower ones. Each point measures its own conditioned distribution and the weight p_next of the
+ *          next point (see measurement.h), the product of the weights estimates P(more than nif infections).
  *
  * Outputs:
  *   The function does not return a value but performs the simulation and can output to files,
@@ -484,6 +74,22 @@ void measurement(world_line* w, model* m, double* time_list, int ntime, int bloc
  *     steady state.
  *   - During the measurement phase, the system state is updated, and statistics are collected after
  *     a specified number of skips.
+ *   - With nchain > 1, every chain owns its world_line and gsl_rng stream (seeded with seed+i_chain) and is
+ *     thermalized independently. Accepted samples of all chains are merged into the same measurement blocks.
+ *   - A ladder of alpha, T or nif (a single value is shared by all points) runs parallel tempering: every point of the
+ *     ladder is a chain with its own model, seeded with seed+k, and neighbouring points propose to swap their
+ *     world-lines every nskip sweeps (see tempering.h). Each point measures into its own files with the prefix
+ *     pt<k>_, until every point has nblock blocks. Built with 'make MPI=1' the ladder is split over the MPI ranks,
+ *     the points of a rank run as OpenMP threads. nchain and the checkpoint are not used with a ladder.
+ *   - The chain streams are the buffered xoshiro generator of rng.h; 'make RNG=mt19937' draws them from GSL
+ *     mt19937 instead. This only swaps the generator: the sweeps draw their numbers in another order than earlier
+ *     builds did, so their runs are not reproduced.
+ *   - A production build (the default, see instrument.h) writes only rate-limited progress lines to stdout;
+ *     'make LEVEL=validate' adds the consistency checks and block summaries, 'make LEVEL=debug' the memory reports,
+ *     the link table and the cluster statistics as well.
+ *   - Every block also appends the counters of its sweeps (candidates accepted, vertices removed, root paths, clusters,
+ *     reallocations, rejected trials) as a JSON line to 'counters.txt', see instrument.h; 'make PERF=1' adds the
+ *     cycles, instructions and cache misses of the chain threads where the kernel allows perf_event_open.
  *   - Optionally, snapshots of the final state can be saved.
  *   - Finally, all allocated memory is freed and resources are cleaned up.
  *
@@ -491,10 +97,67 @@ void measurement(world_line* w, model* m, double* time_list, int ntime, int bloc
  * model, and handling world-line data structures and simulations. It assumes that these functions are
  * implemented correctly and available in the project.
  *
+ * Batch mode:
+ *   ./exe batch jobs nif running_mode block_size nblock thermal nskip [nthread] runs the jobs of the file jobs, one
+ *   "network alpha gamma T seed" per line, with the other arguments as above shared by all jobs, on nthread OpenMP
+ *   threads (default 1). Each job is one chain measured into files with the prefix job<k>_ and a line of
+ *   'ensemble.txt', see ensemble.h.
+ *
+ * Exact simulation:
+ *   ./exe ssa <arguments> draws the samples from the exact SSA trajectories of the same network and rates instead
+ *   of the chains, rejecting the trajectories that miss the condition of the running mode, into the same files (see
+ *   ssa.h); thermal and nskip are not used. It validates the CPMC estimates and times them against the direct method.
+ *   ./exe auto <arguments> runs short pilots of both methods, prints their forecast costs and runs the cheaper one.
+ *   Neither takes a ladder, several chains or a checkpoint.
+ *
+ * Domain decomposition:
+ *   mpirun -np <n> ./exe domain <arguments> splits the network into n parts, one per MPI rank, which sweep a single
+ *   chain together: every rank samples the graphs of its part and exchanges with the ranks next to it the vertices
+ *   on the edges between them and the timelines of their border sites (see domain.h). Rank 0 writes the files of
+ *   measurement() except 'conf.txt'. Running modes 0 and 2 only, without a ladder, chains, threads or checkpoint;
+ *   the network is still read by every rank.
+ *
  * Example Usage:
  *   ./exe 0.5 1.0 40.0 50 0 10000 100 100000 100 123456
+ *   ./exe 0.5 1.0 40.0 50 0 10000 100 100000 100 123456 64
+ *   ./exe 0.5 1.0 40.0 50 0 10000 100 100000 100 123456 1 16
+ *   ./exe 0.5 1.0 40.0 50 0 10000 100 100000 100 123456 1 1 run.ckp
+ *   ./exe 0.40,0.45,0.50,0.55 1.0 40.0 50 0 10000 100 100000 100 123456
+ *   mpirun -np 4 ./exe 0.5 1.0 10.0,20.0,30.0,40.0 50 0 10000 100 100000 100 123456
+ *   ./exe batch jobs.txt 50 0 1000 10 10000 1 8
+ *   ./exe ssa 0.5 1.0 40.0 50 0 10000 100 100000 100 123456
+ *   mpirun -np 4 ./exe domain 0.5 1.0 40.0 50 0 10000 100 100000 100 123456
  */
 int main(int argc, char** argv) {
+    if(argc>8 && strcmp(argv[1],"batch")==0) {
+        ensemble_setting s;
+        s.nif          = atoi(argv[3]);
+        s.running_mode = atoi(argv[4]);
+        s.block_size   = atoi(argv[5]);
+        s.nblock       = atoi(argv[6]);
+        s.thermal      = atoi(argv[7]);
+        s.nskip        = atoi(argv[8]);
+        int nthread=1;
+        if(argc>9) nthread=atoi(argv[9]);
+        ensemble_run(argv[2],&s,nthread);
+        return 0;
+    }
+
+    int method = METHOD_CPMC;
+    if(argc>1 && (strcmp(argv[1],"ssa")==0 || strcmp(argv[1],"auto")==0)) {
+        method = (strcmp(argv[1],"ssa")==0) ? METHOD_SSA : METHOD_AUTO;
+        argc--;
+        argv++;
+    }
+    int domain_mode = 0;
+    if(method==METHOD_CPMC && argc>1 && strcmp(argv[1],"domain")==0) {
+        domain_mode = 1;
+        argc--;
+        argv++;
+    }
+
+    tempering_init(&argc,&argv);
+
     char filename[128] = "/hpc/home/jp549/src/ctQMC/C/projects/epidemic/network/test.edgelist";
     double alpha=atof(argv[1]);
     double gamma=atof(argv[2]);
@@ -507,19 +170,119 @@ int main(int argc, char** argv) {
     int nskip = atoi(argv[9]);
     int nsweep  = nblock*block_size;
     unsigned long int seed=atoi(argv[10]);
+    int nchain=1;
+    if(argc>11) nchain=atoi(argv[11]);
+    int nthread=1;
+    if(argc>12) nthread=atoi(argv[12]);
+    char* checkpoint_file=NULL;
+    if(argc>13) checkpoint_file=argv[13];
+
+    // a list of alpha, T or nif is a ladder for parallel tempering, every
+    // chain is one of the ladder points of this rank
+    tempering* t=NULL;
+    if(strchr(argv[1],',')!=NULL || strchr(argv[3],',')!=NULL || strchr(argv[4],',')!=NULL ||
+       (!domain_mode && tempering_nrank()>1)) {
+        if(nchain!=1 || checkpoint_file!=NULL) {
+            printf("A ladder of (alpha, T, nif) sets the chains itself and can not be checkpointed!\n");
+            exit(1);
+        }
+        t = malloc_tempering(argv[1],argv[3],argv[4],seed);
+        t->conditioned = (running_mode==3 || running_mode==4);
+        if(strchr(argv[4],',')!=NULL && !(t->conditioned)) {
+            printf("A ladder of nif takes the conditioned running modes 3 and 4!\n");
+            exit(1);
+        }
+        nchain = t->nlocal;
+    }
+    int offset = (t!=NULL) ? t->offset : 0;
 
-    int nnode;
-    int nedge;
-    int* edges = read_edgelist(filename,&nnode,&nedge);
-    double pnif = ((double)nif)/nnode;
+    if(nchain<1 || nthread<1) {
+        printf("The number of chains and threads should be positive (nchain=%d, nthread=%d)!\n",nchain,nthread);
+        exit(1);
+    }
+#ifndef _OPENMP
+    if(nchain>1) {
+        printf("Compiled without OpenMP, running nchain=%d chains sequentially is not supported!\n",nchain);
+        exit(1);
+    }
+#endif
 
+    network* g = load_network(filename);
+    double pnif = ((double)nif)/(g->nnode);
 
-    gsl_rng* rng = gsl_rng_alloc(gsl_rng_mt19937);
-    gsl_rng_set(rng,seed);
+    // the ranks split the network instead of the chains
+    if(domain_mode) {
+        if(t!=NULL || nchain!=1 || nthread!=1 || checkpoint_file!=NULL) {
+            printf("A domain-decomposed run takes a single (alpha, T) without chains, threads or checkpoint!\n");
+            exit(1);
+        }
+        domain_run(g,alpha,gamma,T,nif,running_mode,block_size,nblock,thermal,nskip,seed);
+        output_close();
+        free_network(g);
+        tempering_finalize();
+        return 0;
+    }
+
+    model* m = sis_model_build(alpha,gamma,g);
+
+    if(method!=METHOD_CPMC) {
+        if(t!=NULL || nchain!=1 || checkpoint_file!=NULL) {
+            printf("The SSA runs a single (alpha, T) without chains or checkpoint!\n");
+            exit(1);
+        }
+        if(method==METHOD_AUTO) {
+            double cost_ssa, cost_cpmc;
+            method_pilot(m,alpha,gamma,T,running_mode,nif,thermal,nskip,nsweep,seed,&cost_ssa,&cost_cpmc);
+            method = (cost_ssa<cost_cpmc) ? METHOD_SSA : METHOD_CPMC;
+            printf("method=%s cost_ssa=%.3e cost_cpmc=%.3e\n",(method==METHOD_SSA) ? "ssa" : "cpmc",cost_ssa,cost_cpmc);
+            fflush(stdout);
+        }
+        if(method==METHOD_SSA) {
+            ssa_run(m,alpha,gamma,T,nif,running_mode,block_size,nblock,seed);
+            output_close();
+            free_model(m);
+            free_network(g);
+            tempering_finalize();
+            return 0;
+        }
+    }
 
+    // the chains share the model, except the ladder points at another alpha
+    model** ms = (model**)malloc(sizeof(model*)*nchain);
+    for(int i_chain=0;i_chain<nchain;i_chain++) {
+        ms[i_chain] = m;
+        if(t!=NULL && t->alpha[offset+i_chain]!=alpha) ms[i_chain] = sis_model_build(t->alpha[offset+i_chain],gamma,g);
+    }
 
-    model* m = sis_model_uniform_infection(alpha,gamma,nnode,nedge,edges);
-    world_line* w = malloc_world_line(1024,2*(m->mhnspin),m->nsite);
+    // every chain owns its world-line and random number stream
+    gsl_rng** rngs = (gsl_rng**)malloc(sizeof(gsl_rng*)*nchain);
+    world_line** ws = (world_line**)malloc(sizeof(world_line*)*nchain);
+    chain** cs = (chain**)malloc(sizeof(chain*)*nchain);
+    for(int i_chain=0;i_chain<nchain;i_chain++) {
+        rngs[i_chain] = gsl_rng_alloc(rng_chain_type());
+        gsl_rng_set(rngs[i_chain],seed+offset+i_chain);
+
+        // sized for the sweeps at the chain's T, so the sequences hardly ever grow
+        double beta = (t!=NULL) ? t->T[offset+i_chain] : T;
+        ws[i_chain] = malloc_world_line(world_line_capacity(ms[i_chain],beta),2*(m->mhnspin),m->nsite);
+        cs[i_chain] = malloc_chain();
+        if(nthread>1) chain_threads(cs[i_chain],nthread,rngs[i_chain]);
+    }
+
+    // all chains are merged into the same measurement blocks, the
+    // ladder points measure on their own into pt<k>_ files
+    accumulator* acc = malloc_accumulator();
+    accumulator** accs = (accumulator**)malloc(sizeof(accumulator*)*nchain);
+    for(int i_chain=0;i_chain<nchain;i_chain++) {
+        accs[i_chain] = acc;
+        if(t!=NULL) {
+            accs[i_chain] = malloc_accumulator();
+            sprintf(accs[i_chain]->prefix,"pt%03d_",offset+i_chain);
+            // the weight of the next point of a ladder of nif
+            if(strchr(argv[4],',')!=NULL && offset+i_chain+1<(t->nreplica))
+                accs[i_chain]->next_nif = t->nif[offset+i_chain+1];
+        }
+    }
 
     // setup running mode and initial state
     // running mode : 0
@@ -534,62 +297,23 @@ int main(int argc, char** argv) {
     //      initial state - all get infected
     //      final state   - all get recovery
     //
+    // running mode : 3, 4
+    //      as 0, 1 with the flips conditioned on the final # of infection
+    //
 
     int initial_condition_type=0;
     int final_condition_type=0;
     int nocheck_for_measurement=0;
 
-    if(running_mode==0) {
-        for(int i=0;i<(w->nsite);i++) w->istate[i] = -1;
-        w->istate[nearest_nb_arg_max_degree()]=1;
-        //w->istate[71]=1;
-
-        initial_condition_type=0;
-        final_condition_type=1;
-        nocheck_for_measurement=0;
-    } else if(running_mode==1) {
-        for(int i=0;i<(w->nsite);i++) w->istate[i] = -1;
-        w->istate[nearest_nb_arg_max_degree()]=1;
-        //w->istate[71]=1;
-
-        initial_condition_type=1;
-        final_condition_type=1;
-        nocheck_for_measurement=0;
-    } else if(running_mode==2) {
-        for(int i=0;i<(w->nsite);i++) w->istate[i] = 1;
-
-        initial_condition_type=0;
-        final_condition_type=2;
-        nocheck_for_measurement=1;
-    } else {
-        printf("There is no such running mode %d!\n",running_mode);
-        exit(1);
+    for(int i_chain=0;i_chain<nchain;i_chain++) {
+        world_line* w = ws[i_chain];
+        running_mode_setup(w,g,running_mode,&initial_condition_type,&final_condition_type,&nocheck_for_measurement);
+        w->beta = (t!=NULL) ? t->T[offset+i_chain] : T;
     }
 
-    // thermalization
-    time_t thermal_cpu_time_start = clock();
-    time_t thermal_cpu_time_end;
-    w->beta = T;
-    for(int i=0;i<thermal;i++) {
-        remove_vertices(w);
-        swapping_graphs(w,m,rng);
-        insert_vertices(w,m,rng);
-        boundary_condition_initial_state(w,m,initial_condition_type,rng);
-        boundary_condition_final_state(w,m,pnif,final_condition_type,rng);
-        clustering(w,m);
-
-        //cluster_statistic(w,m);
-
-        flip_cluster(w,rng);
-        if((i+1)%1000==0) {
-            thermal_cpu_time_end = clock();
-            printf("themral : %d ",i+1);
-            printf("| cpu time on this block : %.6e (s) ",(double)(thermal_cpu_time_end-thermal_cpu_time_start)/CLOCKS_PER_SEC);
-            printf("| remaining time estimate : %.6e\n",(double)(thermal_cpu_time_end-thermal_cpu_time_start)/CLOCKS_PER_SEC/1000*(thermal-i));
-            thermal_cpu_time_start = clock();
-        }
+    if(running_mode==3 || running_mode==4) {
+        for(int i_chain=0;i_chain<nchain;i_chain++) cs[i_chain]->condition_nif = (t!=NULL) ? t->nif[offset+i_chain] : nif;
     }
-    printf("end of thermalization!\n");
 
     // measurement
     double dt = T/100.0;
@@ -599,44 +323,196 @@ int main(int argc, char** argv) {
         time_list[i] = (dt*i)/T;
     }
 
-    int ntrial=0;
-    for(int i_sweep=0;i_sweep<nsweep;) {
-        for(int i=0;i<nskip;i++) {
-            remove_vertices(w);
-            swapping_graphs(w,m,rng);
-            insert_vertices(w,m,rng);
-            boundary_condition_initial_state(w,m,initial_condition_type,rng);
-            boundary_condition_final_state(w,m,pnif,final_condition_type,rng);
-            clustering(w,m);
-
-            if((i+1)==nskip){
-                cluster_statistic(w,m);
+    // resume from the checkpoint if there is one
+    checkpoint h;
+    h.alpha = alpha;
+    h.gamma = gamma;
+    h.T = T;
+    h.nif = nif;
+    h.running_mode = running_mode;
+    h.block_size = block_size;
+    h.ntime = ntime;
+    h.nchain = nchain;
+    h.nsite = m->nsite;
+    h.seed = seed;
+    h.thermal_done = 0;
+    h.i_sweep = 0;
+    if(checkpoint_file!=NULL) load_checkpoint(checkpoint_file,&h,ws,cs,rngs,acc);
+
+    int i_sweep=h.i_sweep;
+    int thermal_start=h.thermal_done;
+
+    // the merged samples are logged from the first one on
+    int sample_start=i_sweep;
+    progress sample_progress;
+
+    // samples of every ladder point, shared by the chains
+    int* tempering_count = (int*)calloc(nchain,sizeof(int));
+    int tempering_running = 1;
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(nchain)
+#endif
+    {
+        int i_chain=0;
+#ifdef _OPENMP
+        i_chain = omp_get_thread_num();
+#endif
+        world_line* w = ws[i_chain];
+        gsl_rng* rng  = rngs[i_chain];
+        chain* c      = cs[i_chain];
+        model* mc     = ms[i_chain];
+
+        // the threshold of the chain's ladder point
+        int nif_c     = (t!=NULL) ? t->nif[offset+i_chain] : nif;
+        double pnif_c = ((double)nif_c)/(g->nnode);
+
+        // thermalization, chain 0 logs the progress
+        progress thermal_progress;
+        progress_start(&thermal_progress,"thermal",thermal-thermal_start);
+        for(int i=thermal_start;i<thermal;i++) {
+            sweep(c,w,mc,initial_condition_type,final_condition_type,pnif_c,rng);
+
+            //cluster_statistic(c,w,m);
+
+            flip_cluster(c,w,rng);
+            if(t!=NULL && (i+1)%nskip==0) {
+#ifdef _OPENMP
+#pragma omp barrier
+#pragma omp single
+#endif
+                tempering_swap(t,ws,ms,gamma);
+                w = ws[i_chain];
+            }
+            if((i+1)%1000==0 && checkpoint_file!=NULL && nchain==1) {
+                h.thermal_done = i+1;
+                save_checkpoint(checkpoint_file,&h,ws,cs,rngs,acc);
+            }
+            if(i_chain==0) progress_update(&thermal_progress,i+1-thermal_start);
+        }
+
+        // the samples are recorded by flip_cluster from here on, the
+        // counters of the blocks leave out the thermalization
+        chain_observe(c,mc,time_list,ntime);
+        counters_reset(&(c->count));
+
+        if(checkpoint_file!=NULL && thermal_start<thermal) {
+#ifdef _OPENMP
+#pragma omp barrier
+#pragma omp single
+#endif
+            {
+                h.thermal_done = thermal;
+                save_checkpoint(checkpoint_file,&h,ws,cs,rngs,acc);
+            }
+        }
+
+        // the ladder points measure in lockstep with a swap between the
+        // samples, until every point has nsweep samples of its own
+        int ntrial=0;
+        progress point_progress;
+        progress_start(&point_progress,"measurement",nsweep);
+        while(t!=NULL && tempering_running) {
+            for(int i=0;i<nskip;i++) {
+                sweep(c,w,mc,initial_condition_type,final_condition_type,pnif_c,rng);
+
+                if((i+1)==nskip){
+                    cluster_statistic(c,w,mc);
+                }
+
+                flip_cluster(c,w,rng);
+            }
+            ntrial++;
+
+            if(tempering_count[i_chain]<nsweep &&
+               ((ninfected_initial_state(w)==1 && ninfected_final_state(w)>nif_c) || nocheck_for_measurement)) {
+                accs[i_chain]->ntrial_ave+=ntrial;
+#ifdef _OPENMP
+#pragma omp critical (measurement)
+#endif
+                measurement(c,accs[i_chain],w,mc,time_list,ntime,block_size,rng);
+                tempering_count[i_chain]++;
+                if(i_chain==0) progress_update(&point_progress,tempering_count[i_chain]);
+                ntrial=0;
             }
 
-            flip_cluster(w,rng);
+#ifdef _OPENMP
+#pragma omp barrier
+#pragma omp single
+#endif
+            {
+                int done=1;
+                for(int k=0;k<nchain;k++) done = done && (tempering_count[k]>=nsweep);
+                tempering_swap(t,ws,ms,gamma);
+                tempering_running = !tempering_all_done(t,done);
+            }
+            w = ws[i_chain];
         }
-        ntrial++;
 
-        if((ninfected_initial_state(w)==1 && ninfected_final_state(w)>nif) || nocheck_for_measurement) {
-            ntrial_ave+=ntrial;
-            measurement(w,m,time_list,ntime,block_size);
-            i_sweep++;
+        // the chains share the measurement blocks, every accepted sample
+        // is merged through measurement() one chain at a time
+        int running=(t==NULL && i_sweep<nsweep);
+        while(running) {
+            for(int i=0;i<nskip;i++) {
+                sweep(c,w,mc,initial_condition_type,final_condition_type,pnif_c,rng);
+
+                if((i+1)==nskip){
+                    cluster_statistic(c,w,mc);
+                }
 
-            ntrial=0;
+                flip_cluster(c,w,rng);
+            }
+            ntrial++;
+
+            if((ninfected_initial_state(w)==1 && ninfected_final_state(w)>nif) || nocheck_for_measurement) {
+#ifdef _OPENMP
+#pragma omp critical (measurement)
+#endif
+                {
+                    if(i_sweep<nsweep) {
+                        if(i_sweep==sample_start) progress_start(&sample_progress,"measurement",nsweep-sample_start);
+                        acc->ntrial_ave+=ntrial;
+                        measurement(c,acc,w,mc,time_list,ntime,block_size,rng);
+                        i_sweep++;
+                        progress_update(&sample_progress,i_sweep-sample_start);
+
+                        // the other chains are still sweeping, only a single
+                        // chain is in a consistent state at the end of a block;
+                        // with nchain > 1 the run is not checkpointed again before its end
+                        if(checkpoint_file!=NULL && nchain==1 && acc->measurement_count==0) {
+                            h.i_sweep = i_sweep;
+                            save_checkpoint(checkpoint_file,&h,ws,cs,rngs,acc);
+                        }
+                    }
+                    running = (i_sweep<nsweep);
+                }
+
+                ntrial=0;
+            } else {
+#ifdef _OPENMP
+#pragma omp critical (measurement)
+#endif
+                running = (i_sweep<nsweep);
+            }
         }
     }
 
+    if(checkpoint_file!=NULL) {
+        h.thermal_done = thermal;
+        h.i_sweep = i_sweep;
+        save_checkpoint(checkpoint_file,&h,ws,cs,rngs,acc);
+    }
+
     // print the sanpshot of final state
     if(0) {
+        world_line* w = ws[0];
+        gsl_rng* rng  = rngs[0];
+        chain* c      = cs[0];
         char snapshot_filename[128];
         for(int i=0;i<10;i++){
-            remove_vertices(w);
-            swapping_graphs(w,m,rng);
-            insert_vertices(w,m,rng);
-            boundary_condition_initial_state(w,m,initial_condition_type,rng);
-            boundary_condition_final_state(w,m,pnif,final_condition_type,rng);
-            clustering(w,m);
-            flip_cluster(w,rng);
+            sweep(c,w,m,initial_condition_type,final_condition_type,pnif,rng);
+            flip_cluster(c,w,rng);
+            world_line_settle(w,rng);
 
             sprintf(snapshot_filename,"snapshot_%d.out",i);
             FILE* snapshot_file = fopen(snapshot_filename,"w");
@@ -647,11 +523,27 @@ int main(int argc, char** argv) {
         }
     }
     
+    if(t!=NULL) tempering_report(t);
+
     // free memory
-    free(infected_ratio);
     free(time_list);
-    free_world_line(w);
+    for(int i_chain=0;i_chain<nchain;i_chain++) {
+        free_world_line(ws[i_chain]);
+        free_chain(cs[i_chain]);
+        gsl_rng_free(rngs[i_chain]);
+        if(accs[i_chain]!=acc) free_accumulator(accs[i_chain]);
+        if(ms[i_chain]!=m) free_model(ms[i_chain]);
+    }
+    free(ws);
+    free(cs);
+    free(rngs);
+    free(accs);
+    free(ms);
+    free(tempering_count);
+    free_accumulator(acc);
+    output_close();
     free_model(m);
-    gsl_rng_free(rng);
-    free(edges);
+    free_network(g);
+    if(t!=NULL) free_tempering(t);
+    tempering_finalize();
 }
@@ -0,0 +1,384 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <gsl/gsl_rng.h>
+
+#include "dtype.h"
+#include "estimator.h"
+#include "output.h"
+#include "measurement.h"
+#include "instrument.h"
+#include "norm.h"
+#include "update.h"
+
+// Returns the initial number of infected nodes in the world line
+int ninfected_initial_state(world_line* w) {
+    // counted by the sweep and the flip that followed it
+    if(w->ninitial>=0) return w->ninitial;
+
+    int nnode=w->nsite;  // Number of nodes in the world line
+    int ninfected=0;     // Number of infected nodes
+
+    // Iterate over all nodes in the world line
+    for(int i=0;i<nnode;i++) {
+        if(site_is_unset(w,i)) continue;
+        ninfected+=w->istate[i];  // Add 1 to ninfected for each infected node
+    }
+
+    // Return the average of ninfected and nnode, rounded up; the unset
+    // sites of the last flip count by their number of infected ones
+    return (ninfected+nnode-(w->nunset))/2+(w->nunset_infected);
+}
+
+// Returns the final number of infected nodes in the world line
+int ninfected_final_state(world_line* w) {
+    if(w->ninitial>=0) return w->nfinal;
+
+    int nnode=w->nsite;  // Number of nodes in the world line
+    int ninfected=0;     // Number of infected nodes
+
+    // Iterate over all nodes in the world line
+    for(int i=0;i<nnode;i++) {
+        if(site_is_unset(w,i)) continue;
+        ninfected+=w->pstate[i];  // Add 1 to ninfected for each infected node
+    }
+
+    // Return the average of ninfected and nnode, rounded up; an unset
+    // site holds its initial state up to the end
+    return (ninfected+nnode-(w->nunset))/2+(w->nunset_infected);
+}
+
+
+static void print_state(int* state, int nnode) {
+    // This function prints the state of each node in the world_line.
+    // It takes as input an array of node states and the number of nodes.
+    for(int i=0;i<nnode;i++) {
+        printf("%d ",(state[i]+1)/2);
+    }
+    printf("\n");
+}
+
+static void save_state(FILE* file, int* state, int nnode) {
+    // This function writes the state of each node in the world_line to a file.
+    // It takes as input a file pointer, an array of node states, and the number of nodes.
+    for(int i=0;i<nnode;i++) {
+        fprintf(file,"%d ",(state[i]+1)/2);
+    }
+    fprintf(file,"\n");
+}
+
+static void save_state_binary(FILE* file, int* state, int nnode) {
+    // Same as save_state with one bit per node.
+    unsigned char byte=0;
+    for(int i=0;i<nnode;i++) {
+        if(state[i]==1) byte |= (unsigned char)(1<<(i%8));
+        if(i%8==7 || i==nnode-1) {
+            fputc(byte,file);
+            byte=0;
+        }
+    }
+}
+
+void show_configuration(world_line* w, model* m, double* time_list, int ntime) {
+    // This function displays the configuration of the world_line at specified times.
+    // It takes as input a pointer to the world_line, a pointer to the model, an array of times,
+    // and the number of times to display.
+    int* pstate = w->pstate;
+    int nnode = w->nsite;
+
+    // Copy the initial state of the world_line nodes to pstate.
+    for(int i=0;i<nnode;i++) pstate[i] = w->istate[i];
+
+    // Get the vertex sequence to traverse.
+    vertex* sequence = w->sequenceB;
+    if(w->flag) 
+        sequence = w->sequenceA;
+
+    int i=0; // Index of current time to display
+    int index, i_node; 
+    vertex* v;
+    for(int n=0;n<(w->nvertices) && i<ntime;n++) {
+        v = &(sequence[n]);
+        while(i<ntime && time_list[i]<(v->tau)) { // Check if it's time to display the state
+            print_state(pstate,nnode);
+            i++;
+        }
+
+        // Update the state of nodes according to vertex information.
+        for(i_node=0;i_node<(v->hNspin);i_node++) {
+            index = bond_index(m,v->bond,i_node);
+            pstate[index] = vertex_state(v,(v->hNspin)+i_node);
+        }
+    }
+
+    // If there are remaining times to display, display the last state.
+    for(;i<ntime;i++) {
+        print_state(pstate,nnode);
+    }
+}
+
+
+void save_configuration(FILE* file, world_line* w, model* m, double* time_list, int ntime, int binary) {
+    int* pstate = w->pstate;
+    int nnode = w->nsite;
+
+    for(int i=0;i<nnode;i++) pstate[i] = w->istate[i];
+
+    vertex* sequence = w->sequenceB;
+    if(w->flag) 
+        sequence = w->sequenceA;
+
+    int i=0;
+    int index, i_node;
+    vertex* v;
+    for(int n=0;n<(w->nvertices) && i<ntime;n++) {
+        v = &(sequence[n]);
+        while(i<ntime && time_list[i]<(v->tau)) {
+            if(binary) save_state_binary(file,pstate,nnode);
+            else save_state(file,pstate,nnode);
+            i++;
+        }
+
+        for(i_node=0;i_node<(v->hNspin);i_node++) {
+            index = bond_index(m,v->bond,i_node);
+            pstate[index] = vertex_state(v,(v->hNspin)+i_node);
+        }
+    }
+    for(;i<ntime;i++) {
+        if(binary) save_state_binary(file,pstate,nnode);
+            else save_state(file,pstate,nnode);
+    }
+}
+
+// output stream of the accumulator, its files are named by its prefix
+static FILE* measurement_stream(accumulator* a, const char* name, const char* mode) {
+    char filename[160];
+    snprintf(filename,sizeof(filename),"%s%s",a->prefix,name);
+    return output_stream(filename,mode);
+}
+// the observables of the world-line by a replay from the initial state,
+// it returns the infected time and adds I/N at every slice to infected_ratio
+static double replay_observables(world_line* w, model* m, double* infected_time, double* infected_ratio,
+                                 double* time_list, int ntime) {
+    int* pstate = w->pstate;
+    int nnode = w->nsite;
+
+    for(int i=0;i<nnode;i++) {
+        pstate[i] = w->istate[i];
+        infected_time[i] = 0;
+    }
+
+    vertex* sequence = w->sequenceB;
+    if(w->flag) 
+        sequence = w->sequenceA;
+
+    double total_infected_time=0;
+
+    int i=0;
+    int index, i_node;
+    vertex* v;
+#if INSTRUMENT_VALIDATE
+    double tau_p=0;
+#endif
+    for(int n=0;n<(w->nvertices) && i<ntime;n++) {
+        v = &(sequence[n]);
+        // the gap before a vertex can span several slices
+        while(i<ntime && time_list[i]<(v->tau)) {
+            double ir=0;
+            for(int i_node=0;i_node<nnode;i_node++) {
+                ir+=0.5*(pstate[i_node]+1);
+            }
+            ir = ir/nnode;
+            infected_ratio[i] += ir;
+            i++;
+        }
+
+        for(i_node=0;i_node<(v->hNspin);i_node++) {
+            index = bond_index(m,v->bond,i_node);
+            if(pstate[index]==1) {
+                total_infected_time += ((v->tau)-infected_time[index]);
+            }
+            pstate[index] = vertex_state(v,(v->hNspin)+i_node);
+            if(pstate[index]==1) {
+                infected_time[index] = v->tau;
+            }
+        }
+#if INSTRUMENT_VALIDATE
+        if(tau_p>(v->tau)) printf("tau_p > tau!\n");
+        else if((v->tau)<0) printf("tau < 0!\n");
+        else if((v->tau)>1) printf("tau > 1!\n");
+        tau_p = v->tau;
+#endif
+    }
+    for(i_node=0;i_node<nnode;i_node++) {
+        if(pstate[i_node]==1)
+            total_infected_time += (1.0-infected_time[i_node]);
+    }
+
+    for(;i<ntime;i++) {
+        double ir=0;
+        for(int i_node=0;i_node<nnode;i_node++) {
+            ir+=0.5*(pstate[i_node]+1);
+        }
+        ir = ir/nnode;
+        infected_ratio[i] += ir;
+    }
+
+    return total_infected_time;
+}
+
+void measurement_open(accumulator* a) {
+#if BINARY_OUTPUT
+    if(a->conf_output) measurement_stream(a,"conf.bin","ab");
+    measurement_stream(a,"series.bin","ab");
+#else
+    if(a->conf_output) measurement_stream(a,"conf.txt","a");
+    measurement_stream(a,"series.txt","a");
+#endif
+    measurement_stream(a,"times.txt","w");
+    measurement_stream(a,"global.txt","a");
+    measurement_stream(a,"autocorrelation.txt","a");
+    measurement_stream(a,"estimator.txt","a");
+#if COUNTERS_OUTPUT
+    measurement_stream(a,"counters.txt","a");
+#endif
+#if PATH_OUTPUT
+    measurement_stream(a,"path.bin","ab");
+#endif
+}
+
+void measurement(chain* c, accumulator* a, world_line* w, model* m, double* time_list, int ntime, int block_size,
+                 gsl_rng* rng) {
+    if(a->infected_ratio==NULL) malloc_accumulator_buffers(a,w->nsite,ntime,block_size);
+    double* infected_ratio = a->infected_ratio;
+    double total_infected_time=0;
+    int i=0;
+
+    if(c->obs_ready) {
+        // recorded by flip_cluster (see chain_observe)
+        for(i=0;i<ntime;i++) infected_ratio[i] += c->obs_ratio[i];
+        // only the active sites changed their states
+        for(int k=0;k<(w->nactive);k++) {
+            int i_node = w->site_order[k];
+            w->pstate[i_node] = c->obs_state[i_node];
+        }
+        total_infected_time = c->obs_infected_time;
+    } else {
+        world_line_settle(w,rng);
+        total_infected_time = replay_observables(w,m,a->infected_time,infected_ratio,time_list,ntime);
+    }
+
+    // collecting the obeservable
+    a->total_infected_time_ave += total_infected_time;
+    a->ninfection_ave += c->ninfection;
+    a->nrecover_ave  += c->nrecover;
+    
+    double samples[4];
+    samples[0] = c->ninfection;
+    samples[1] = c->nrecover;
+    samples[2] = total_infected_time*(w->beta);
+    if(a->nobs>3) samples[3] = (ninfected_final_state(w)>(a->next_nif));
+    for(int j=0;j<(a->nobs);j++) estimator_append(a->est[j],samples[j]);
+
+#if PATH_OUTPUT
+    if(a->path==NULL) a->path = malloc_conf(4*(w->nsite),w->nsite);
+    world_line_settle(w,rng);
+    world_line_to_conf(a->path,w,m);
+    conf_write(measurement_stream(a,"path.bin","ab"),a->path);
+#endif
+
+    // the sweeps of the chain since its last sample go to this block
+    counters_perf_read(c);
+    counters_add(&(a->count),&(c->count));
+    counters_reset(&(c->count));
+
+    a->measurement_count++;
+
+    if(a->measurement_count==block_size) {
+        // the streams stay open and buffered between the blocks
+#if BINARY_OUTPUT
+        int conf_dims[2] = {ntime,w->nsite};
+        FILE* file_conf = (a->conf_output) ? measurement_stream(a,"conf.bin","ab") : NULL;
+        FILE* file_s = measurement_stream(a,"series.bin","ab");
+        if(a->conf_output) output_binary_header(file_conf,"CPMCCONF",conf_dims,2);
+        output_binary_header(file_s,"CPMCSERI",&ntime,1);
+#else
+        FILE* file_conf = (a->conf_output) ? measurement_stream(a,"conf.txt","a") : NULL;
+        FILE* file_s = measurement_stream(a,"series.txt","a");
+#endif
+        FILE* file_t = measurement_stream(a,"times.txt","w");
+        FILE* file_g = measurement_stream(a,"global.txt","a");
+        rewind(file_t);
+#if INSTRUMENT_VALIDATE
+        printf("------------------------------\n");
+        printf(" t    |    I/N\n");
+#endif
+        for(i=0;i<ntime;i++) {
+            infected_ratio[i] = infected_ratio[i]/block_size;
+#if INSTRUMENT_VALIDATE
+            printf("%.4lf  %.12lf\n",time_list[i]*w->beta,infected_ratio[i]);
+#endif
+            fprintf(file_t,"%.4lf ",time_list[i]*w->beta);
+#if !BINARY_OUTPUT
+            fprintf(file_s,"%.12e ",infected_ratio[i]);
+#endif
+        }
+#if BINARY_OUTPUT
+        fwrite(infected_ratio,sizeof(double),ntime,file_s);
+#else
+        fprintf(file_s,"\n");
+#endif
+        for(i=0;i<ntime;i++) infected_ratio[i] = 0;
+        fprintf(file_t,"\n");
+        a->measurement_count=0;
+
+#if COUNTERS_OUTPUT
+        // the estimators count the samples across a restart from a checkpoint
+        long block = (long)(a->est[0]->count/block_size)-1;
+        counters_write(measurement_stream(a,"counters.txt","a"),&(a->count),block,block_size,a->ntrial_ave,
+                       (double)(clock()-(a->start_time))/CLOCKS_PER_SEC);
+#endif
+        counters_reset(&(a->count));
+
+        a->nrecover_ave = a->nrecover_ave/block_size;
+        a->ninfection_ave = a->ninfection_ave/block_size;
+        a->ntrial_ave = a->ntrial_ave/block_size;
+        a->total_infected_time_ave = a->total_infected_time_ave/block_size*(w->beta);
+        fprintf(file_g,"%.12e %.12e %.12e %.12e\n",a->ninfection_ave,a->nrecover_ave,a->total_infected_time_ave,a->ntrial_ave);
+
+#if INSTRUMENT_VALIDATE
+        printf("total infected time = %.12e\n",a->total_infected_time_ave);
+        printf("average # of trial  = %.12e\n",a->ntrial_ave);
+#endif
+
+        if(a->conf_output) {
+            world_line_settle(w,rng);
+            save_configuration(file_conf,w,m,time_list,ntime,BINARY_OUTPUT);
+        }
+
+        // autocorrelation of this block and the running estimates
+        FILE* file_a = measurement_stream(a,"autocorrelation.txt","a");
+        FILE* file_e = measurement_stream(a,"estimator.txt","a");
+        for(i=0;i<block_size;i++) {
+            for(int j=0;j<(a->nobs);j++) fprintf(file_a,"%.12e ",a->est[j]->autocorrelation[i]);
+            fprintf(file_a,"\n");
+        }
+        for(int j=0;j<(a->nobs);j++) {
+            estimator_write(a->est[j],file_e);
+#if INSTRUMENT_VALIDATE
+            estimator_write(a->est[j],stdout);
+#endif
+        }
+
+        a->total_infected_time_ave=0;
+        a->nrecover_ave=0;
+        a->ninfection_ave=0;
+        a->ntrial_ave=0;
+
+#if INSTRUMENT_VALIDATE
+        clock_t end_time = clock();
+        printf("time for this block = %.2lf(sec)\n",(double)(end_time-(a->start_time))/CLOCKS_PER_SEC);
+#endif
+        a->start_time = clock();
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef measurement_h
+#define measurement_h
+
+#include <stdio.h>
+#include <gsl/gsl_rng.h>
+
+#include "dtype.h"
+
+/* Write the series and the configurations in binary (-DBINARY_OUTPUT=1):
+** series.bin holds ntime doubles per block and conf.bin ntime rows of
+** nnode bits (node i in bit i%8 of byte i/8) per block, after a header of
+** an 8 character magic, the number of dimensions and the dimensions.
+*/
+#ifndef BINARY_OUTPUT
+#define BINARY_OUTPUT 0
+#endif
+
+/* Append every measured configuration as per-site timelines to path.bin
+** (-DPATH_OUTPUT=1), see conf_write in norm.h.
+*/
+#ifndef PATH_OUTPUT
+#define PATH_OUTPUT 0
+#endif
+
+/* The numbers of infected nodes in the initial and the final state; the
+** sites a flip left unset count by their number of infected ones.
+*/
+int ninfected_initial_state(world_line* w);
+
+int ninfected_final_state(world_line* w);
+
+void show_configuration(world_line* w, model* m, double* time_list, int ntime);
+
+void save_configuration(FILE* file, world_line* w, model* m, double* time_list, int ntime, int binary);
+
+/**
+ * This function performs measurements for a stochastic simulation of an epidemic model using a CPMC algorithm.
+ * It updates statistical measures of the simulation such as the average number of infections, recoveries, and the total infected time.
+ * Additionally, it handles file outputs for recording simulation data across different stages of the simulation process.
+ *
+ * Parameters:
+ *   c (chain*): Pointer to the chain that produced the sample, providing the infection and recovery counts.
+ *   a (accumulator*): Pointer to the block accumulator the sample is added to; several chains may share one.
+ *   w (world_line*): Pointer to the world_line structure containing the state of the simulation.
+ *   m (model*): Pointer to the model structure containing the parameters and state of the epidemic model.
+ *   time_list (double*): Array of time points at which measurements are taken.
+ *   ntime (int): Number of time points in time_list.
+ *   block_size (int): Number of simulation updates per measurement block.
+ *   rng (gsl_rng*): Stream of the chain, draws the sites the last flip left unset (see world_line_settle) when the
+ *                   states of the single sites are needed: the replay, the configuration of a block and path.bin.
+ *
+ * Detailed Behavior:
+ *   - The function initializes memory for storing infected ratios and times if not already done.
+ *   - If flip_cluster recorded the sample (see chain_observe), the infected ratios, the total infected time and the
+ *     final state are taken from the chain, without another pass over the world-line.
+ *   - Otherwise it goes through all vertices in the sequence (either sequenceA or sequenceB based on the world_line flag),
+ *     updating the state of nodes and computing the total infected time and the number of infections.
+ *     After processing all vertices, it computes the infected ratio for the remaining times in the time_list.
+ *   - Either way w->pstate holds the final state of the world-line afterwards.
+ *   - Every block_size number of measurements, it writes out averaged results to files and resets the averages for the next block.
+ *   - It also calculates the total running time for each block and logs this information.
+ *
+ * Outputs:
+ *   - This function writes to several files:
+     - 'conf.txt': Configuration data of the conditional-path, not written when a->conf_output is 0.
+ *     - 'times.txt': Times at which measurements were taken.
+ *     - 'series.txt': Infected ratios over time.
+ *     - 'global.txt': Global averages of infection and recovery counts, and total infected time.
+ *     - 'autocorrelation.txt': Normalized autocorrelation of ninfection, nrecover and the infected time within the block.
+ *     - 'estimator.txt': Per observable the mean, naive and binned errors over all samples so far and the
+ *       integrated autocorrelation time of the block. With a->next_nif >= 0 the last observable p_next is the
+ *       fraction of the samples with more than next_nif final infections: on a ladder of nif it is the weight
+ *       P(S_k+1 | S_k) of the next point relative to this one, and the product of p_next up to a point its weight
+ *       relative to the first one.
+ *     - 'counters.txt': One JSON line per block with the counters the chains gathered since their samples of the
+ *       previous block, see counters_write; not written with COUNTERS_OUTPUT 0.
+ *   - The file names start with the prefix of the accumulator (pt<k>_ for a point of a tempering ladder).
+ *   - The files are kept open as buffered output streams (see output.h) and are closed at the end of the run;
+ *     with BINARY_OUTPUT 'conf.txt' and 'series.txt' are replaced by 'conf.bin' and 'series.bin'.
+ *   - With PATH_OUTPUT every sample is appended to 'path.bin' as the timelines of world_line_to_conf.
+ *   - Additionally, it prints the infected ratio over time to the standard output and logs the time taken for each block.
+ */
+void measurement(chain* c, accumulator* a, world_line* w, model* m, double* time_list, int ntime, int block_size,
+                 gsl_rng* rng);
+
+/**
+ * Opens the output streams of every file measurement() writes for the accumulator, so a checkpoint taken before
+ * the first block records their lengths as well (see output_marks).
+ */
+void measurement_open(accumulator* a);
+
+#endif
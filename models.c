@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "dtype.h"
+#include "networks.h"
+#include "models.h"
+#include "instrument.h"
+
+static void create_cmf(double* cmf, double* weight, int length) {
+    int i=0;
+
+    cmf[0] = weight[i];
+    for(i=1;i<length;i++) {
+        cmf[i] = cmf[i-1]+weight[i];
+    }
+}
+
+/* Walker's alias table (Vose's construction) over the bond weights.
+** A bond is drawn in O(1) by picking a column i uniformly and keeping
+** i with probability prob[i], otherwise taking alias[i].
+*/
+static void create_alias(double* prob, int* alias, double* weight, int length) {
+    double total=0;
+    for(int i=0;i<length;i++) total += weight[i];
+
+    int* small = (int*)malloc(sizeof(int)*length);
+    int* large = (int*)malloc(sizeof(int)*length);
+    int nsmall=0;
+    int nlarge=0;
+
+    for(int i=0;i<length;i++) {
+        prob[i]  = weight[i]*length/total;
+        alias[i] = i;
+        if(prob[i]<1.0) {
+            small[nsmall++] = i;
+        } else {
+            large[nlarge++] = i;
+        }
+    }
+
+    while(nsmall>0 && nlarge>0) {
+        int s = small[--nsmall];
+        int l = large[--nlarge];
+
+        alias[s] = l;
+        prob[l]  = (prob[l]+prob[s])-1.0;
+        if(prob[l]<1.0) {
+            small[nsmall++] = l;
+        } else {
+            large[nlarge++] = l;
+        }
+    }
+
+    // the leftovers are 1 up to round-off
+    while(nlarge>0) prob[large[--nlarge]] = 1.0;
+    while(nsmall>0) prob[small[--nsmall]] = 1.0;
+
+    free(small);
+    free(large);
+}
+
+static void description_error(const model_description* d, const char* message) {
+    printf("The model description %s is not valid: %s!\n",d->name,message);
+    exit(1);
+}
+
+// number of leading edge graphs, after checking the layout of the description
+static int check_description(const model_description* d) {
+    int ngraph = d->ngraph;
+    const graph_rule* graph = d->graph;
+
+    if(ngraph<2 || ngraph>20) description_error(d,"it needs 2 ... 20 graphs");
+
+    int ntype_edge=0;
+    while(ntype_edge<ngraph && graph[ntype_edge].hNspin==2) ntype_edge++;
+    for(int t=ntype_edge;t<ngraph;t++) {
+        if(graph[t].hNspin!=1) description_error(d,"the edge graphs have to come before the single-site graphs");
+        if((graph[t].rate==GRAPH_RATE_NONE)!=(t==ngraph-1))
+            description_error(d,"the last graph, and only that one, is the boundary graph");
+    }
+    for(int t=0;t<ntype_edge;t++) {
+        if(graph[t].rate==GRAPH_RATE_NONE) description_error(d,"an edge graph can not be the boundary graph");
+    }
+
+    // a swap keeps the weight of the vertex, so it is its own reverse move
+    for(int t=0;t<ngraph;t++) {
+        for(int u=0;u<t;u++) {
+            if(graph[t].group<0 || graph[t].group!=graph[u].group) continue;
+            if(graph[t].hNspin!=graph[u].hNspin || graph[t].rate!=graph[u].rate ||
+               graph[t].num*graph[u].den!=graph[u].num*graph[t].den)
+                description_error(d,"the graphs of a group need the same sites and weight");
+        }
+    }
+
+    return ntype_edge;
+}
+
+// weight of graph t on edge or node k
+static double graph_weight(const graph_rule* r, double alpha, double gamma, network* g, int k) {
+    double rate = 0.0;
+    if(r->rate==GRAPH_RATE_INFECTION) rate = alpha*network_edge_weight(g,k);
+    if(r->rate==GRAPH_RATE_RECOVERY)  rate = gamma*network_node_recovery(g,k);
+    return rate*(r->num)/(r->den);
+}
+
+static void model_rules(model* m, const model_description* d) {
+    int mhnspin = m->mhnspin;
+    int ngraph  = d->ngraph;
+
+    for(int t=0;t<ngraph;t++) {
+        const graph_rule* r = &(d->graph[t]);
+        for(int i=0;i<4*(r->hNspin);i++) m->link[t*4*mhnspin+i] = r->link[i];
+        m->insert_mask[t] = insert_rule_mask(r->insert,r->hNspin);
+    }
+
+    // the candidates of a type are its group, in the order of the description
+    int n=0;
+    for(int t=0;t<ngraph;t++) {
+        m->swap_offset[t] = n;
+        if(d->graph[t].group<0) continue;
+        for(int u=0;u<ngraph;u++) {
+            if(d->graph[u].group==d->graph[t].group) m->swap_type[n++] = u;
+        }
+    }
+    m->swap_offset[ngraph] = n;
+
+#if INSTRUMENT_DEBUG
+    printf("--------------- check m->link ----------------\n");
+    for(int i=0;i<20;i++) {
+        for(int j=0;j<4*mhnspin;j++) {
+            if(m->link[i*4*mhnspin+j]<0) {
+                printf("%d ",m->link[i*4*mhnspin+j]);
+            } else {
+                printf(" %d ",m->link[i*4*mhnspin+j]);
+            }
+        }
+        printf("\n");
+    }
+#endif
+}
+
+model* model_build(const model_description* d, double alpha, double gamma, network* g, int implicit) {
+    int nnode = g->nnode;
+    int nedge = g->nedge;
+    int nsite = nnode;
+    int ngraph = d->ngraph;
+    const graph_rule* graph = d->graph;
+
+    int ntype_edge = check_description(d);
+    int ntype_site = ngraph-ntype_edge;
+    int nbond   = ntype_edge*nedge+(ntype_site-1)*nnode;
+    int mhnspin = (ntype_edge>0) ? 2 : 1;
+
+#if INSTRUMENT_DEBUG
+    printf("nnode=%d, nedge=%d\n",nnode,nedge);
+#endif
+
+    model* m;
+    if(implicit) {
+        if(g->weight!=NULL || g->recovery!=NULL) {
+            printf("The implicit bond table needs uniform rates, build with -DIMPLICIT_BONDS=0 for %s on this network!\n",
+                   d->name);
+            exit(1);
+        }
+        m = malloc_model_implicit(nsite,nedge,g->edges,ntype_edge,ntype_site,mhnspin);
+    } else {
+        m = malloc_model(nsite,nbond+nnode,mhnspin);
+    }
+    m->network = g;
+    m->ntype   = ngraph;
+
+    int n=0;
+    for(int t=0;t<ngraph;t++) {
+        m->type2offset[t] = n;
+        n += (t<ntype_edge) ? nedge : nnode;
+    }
+
+    if(implicit) {
+        // every graph of a type shares its weight, the boundary graph is not sampled
+        for(int t=0;t<ngraph;t++) {
+            m->type2weight[t] = graph_weight(&(graph[t]),alpha,gamma,g,0);
+            if(t==ngraph-1) continue;
+
+            int count = (t<ntype_edge) ? nedge : nnode;
+            m->sweight += count*(m->type2weight[t]);
+            m->type2cmf[t] = m->sweight;
+        }
+    } else {
+        n=0;
+        for(int t=0;t<ngraph;t++) {
+            int count = (t<ntype_edge) ? nedge : nnode;
+            for(int k=0;k<count;k++) {
+                m->bond2type[n]   = t;
+                m->bond2hNspin[n] = graph[t].hNspin;
+                m->bond2weight[n] = graph_weight(&(graph[t]),alpha,gamma,g,k);
+                m->sweight += m->bond2weight[n];
+
+                if(t<ntype_edge) {
+                    m->bond2index[n*mhnspin+0] = g->edges[2*k+0];
+                    m->bond2index[n*mhnspin+1] = g->edges[2*k+1];
+                } else {
+                    m->bond2index[n*mhnspin+0] = k;
+                    if(mhnspin>1) m->bond2index[n*mhnspin+1] = -1;
+                }
+                n++;
+            }
+        }
+    }
+
+    model_rules(m,d);
+
+    m->nsite = nsite;
+    m->nbond = nbond;
+    m->mhnspin = mhnspin;
+    if(!implicit) {
+        create_cmf(m->cmf,m->bond2weight,nbond);
+        create_alias(m->alias_prob,m->alias,m->bond2weight,nbond);
+    }
+
+    return m;
+}
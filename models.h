@@ -0,0 +1,61 @@
+#ifndef models_h
+#define models_h
+
+#include "dtype.h"
+#include "networks.h"
+
+/* What the weight of a graph is proportional to: alpha times the weight of
+** its edge, gamma times the recovery rate of its node, or nothing for the
+** boundary graph, which is never sampled.
+*/
+#define GRAPH_RATE_NONE      0
+#define GRAPH_RATE_INFECTION 1
+#define GRAPH_RATE_RECOVERY  2
+
+/* One graph of a model: an edge graph (hNspin=2) or a single-site graph
+** (hNspin=1) of weight rate*num/den, with its link rule (4*hNspin entries,
+** see link_vertex) and insert rule. The graphs of the same group (>= 0)
+** need the same hNspin and weight; swapping_graphs redraws a vertex among
+** them. -1 is a graph without swaps.
+*/
+typedef struct graph_rule {
+    const char* name;
+    int hNspin;
+    int rate;
+    int num;
+    int den;
+    const int* link;
+    insert_rule insert;
+    int group;
+} graph_rule;
+
+/* A model as a list of graphs: the edge graphs, then the single-site graphs,
+** the last of which is the boundary graph (GRAPH_RATE_NONE).
+*/
+typedef struct model_description {
+    const char* name;
+    int ngraph;
+    const graph_rule* graph;
+} model_description;
+
+/**
+ * Builds the bond tables, link rules, insert masks and swap groups of a model description on a network.
+ *
+ * Parameters:
+ *   d (const model_description*): Graphs of the model.
+ *   alpha (double), gamma (double): Infection and recovery rates.
+ *   g (network*): Network; the edge weights and node recovery rates scale alpha and gamma per edge and node.
+ *   implicit (int): With 1 the bond table is implicit (see malloc_model_implicit), which needs uniform rates.
+ *
+ * Behavior:
+ *   - The bonds are laid out graph after graph, nedge bonds for an edge graph and nsite for a single-site graph;
+ *     the boundary graph of node i is bond nbond+i.
+ *   - Exits with an error if the description is not laid out as above, if the graphs of a group differ, or if
+ *     an implicit table is asked for on a network with heterogeneous rates.
+ *
+ * Outputs:
+ *   - The model, released with free_model.
+ */
+model* model_build(const model_description* d, double alpha, double gamma, network* g, int implicit);
+
+#endif
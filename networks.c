@@ -1,178 +1,495 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <gsl/gsl_rng.h>
 
-static int* append_edge(int* edges, int* nedge, int i, int j) {
-    int buffer=1024;
-    int n = *nedge;
-    if(n==0) {
-        edges = (int*)malloc(sizeof(int)*buffer*2);
-    }
+#include "networks.h"
+#include "rng.h"
+
+static void append_edge(network* g, int* cap, int i, int j, double weight) {
+    int n = g->nedge;
 
-    if((n+1)%buffer==0) {
-        int* edges_temp = (int*)malloc(sizeof(int)*((n+1)/buffer+1)*buffer*2);
-        for(int k=0;k<2*n;k++) {
-            edges_temp[k] = edges[k];
+    // grow geometrically, the copy is amortized over the edges
+    if(n==(*cap)) {
+        *cap = (*cap==0) ? 1024 : 2*(*cap);
+        g->edges  = (int*)realloc(g->edges,sizeof(int)*(*cap)*2);
+        g->weight = (double*)realloc(g->weight,sizeof(double)*(*cap));
+        if(g->edges==NULL || g->weight==NULL) {
+            printf("memory allocate error : append_edge\n");
+            exit(-1);
         }
-        free(edges);
-        edges = edges_temp;
     }
 
-    edges[2*n+0] = i;
-    edges[2*n+1] = j;
-    n++;
-    *nedge = n;
-
-    return edges;
+    g->edges[2*n+0] = i;
+    g->edges[2*n+1] = j;
+    g->weight[n] = weight;
+    g->nedge = n+1;
 }
 
-static int nearest_nb_node=0;
-static int nearest_nb_max_degree=0;
-static int* nearest_nb_degree=NULL;
-static int* nearest_nb_list=NULL;
-
-static void nearest_nb_initialize() {
-    nearest_nb_node=100;
-    nearest_nb_max_degree=1;
+// weight in the rest of an edgelist line: a number, or the value of 'weight'
+// in a networkx attribute dict like {'weight': 0.5}; 1 for {} or nothing
+static double edge_weight(const char* data) {
+    char* end;
+    double weight = strtod(data,&end);
+    if(end!=data) return weight;
+
+    const char* s = strstr(data,"weight");
+    if(s==NULL) return 1.0;
+    s = strchr(s,':');
+    if(s==NULL) return 1.0;
+    weight = strtod(s+1,&end);
+    return (end!=s+1) ? weight : 1.0;
+}
 
-    size_t size1 = nearest_nb_node*nearest_nb_max_degree;
-    size_t size2 = nearest_nb_node;
-    nearest_nb_list   = (int*)malloc(sizeof(int)*size1);
-    nearest_nb_degree = (int*)malloc(sizeof(int)*size2);
+// build offset/adjacency from the edge pairs with a counting pass
+static void network_build_csr(network* g) {
+    int nnode = g->nnode;
+    int nedge = g->nedge;
 
-    for(int i=0;i<size1;i++) nearest_nb_list[i]=-1;
-    for(int i=0;i<size2;i++) nearest_nb_degree[i]=0;
-}
+    g->offset    = (int*)malloc(sizeof(int)*(nnode+1));
+    g->adjacency = (int*)malloc(sizeof(int)*2*nedge);
+    int* pos     = (int*)malloc(sizeof(int)*nnode);
+    g->adjacency_weight = NULL;
+    if(g->weight!=NULL) g->adjacency_weight = (double*)malloc(sizeof(double)*2*nedge);
 
-static void nearest_nb_realloc(int nnode, int degree) {
-    int nb_node=nearest_nb_node;
-    int nb_degree=nearest_nb_max_degree;
+    if(g->offset==NULL || g->adjacency==NULL || pos==NULL || (g->weight!=NULL && g->adjacency_weight==NULL)) {
+        printf("memory allocate error : network_build_csr\n");
+        exit(-1);
+    }
 
-    int check=0;
-    if(nnode>nb_node) {
-        nearest_nb_node*=2;
-        check=1;
+    for(int i=0;i<=nnode;i++) g->offset[i]=0;
+    for(int k=0;k<nedge;k++) {
+        g->offset[g->edges[2*k+0]+1]++;
+        g->offset[g->edges[2*k+1]+1]++;
     }
-    if(degree>nb_degree) {
-        nearest_nb_max_degree=degree;
-        check=1;
+    for(int i=0;i<nnode;i++) {
+        g->offset[i+1] += g->offset[i];
+        pos[i] = g->offset[i];
     }
-
-    if(check) {
-        size_t size1 = nearest_nb_node*nearest_nb_max_degree;
-        size_t size2 = nearest_nb_node;
-        int* temp1 = (int*)malloc(sizeof(int)*size1);
-        int* temp2 = (int*)malloc(sizeof(int)*size2);
-
-        for(int i=0;i<size1;i++) temp1[i]=-1;
-        for(int i=0;i<size2;i++) temp2[i]=0;
-        for(int i_node=0;i_node<nb_node;i_node++) {
-            temp2[i_node]=nearest_nb_degree[i_node];
-            for(int i_nb=0;i_nb<nb_degree;i_nb++) {
-                int i_p = i_node*nb_degree+i_nb;
-                int i_n = i_node*nearest_nb_max_degree+i_nb;
-                temp1[i_n] = nearest_nb_list[i_p];
-            }
+    for(int k=0;k<nedge;k++) {
+        int i = g->edges[2*k+0];
+        int j = g->edges[2*k+1];
+        if(g->adjacency_weight!=NULL) {
+            g->adjacency_weight[pos[i]] = g->weight[k];
+            g->adjacency_weight[pos[j]] = g->weight[k];
         }
-
-        if(nearest_nb_degree!=NULL) free(nearest_nb_degree);
-        if(nearest_nb_list!=NULL) free(nearest_nb_list);
-        nearest_nb_list = temp1;
-        nearest_nb_degree = temp2;
+        g->adjacency[pos[i]++] = j;
+        g->adjacency[pos[j]++] = i;
     }
-}
-
-static void nearest_nb_append(int i, int j) {
-    int i_degree,j_degree;
-    int u=i;
-    if(j>i) u=j;
-
-    if(i<nearest_nb_node) { 
-        i_degree = nearest_nb_degree[i]+1;
-    } else {i_degree=1;}
-
-    if(j<nearest_nb_node) {
-        j_degree = nearest_nb_degree[j]+1;
-    } else {j_degree=1;}
-
-    int u_degree=i_degree;
-    if(j_degree>i_degree) u_degree=j_degree;
-
-    nearest_nb_realloc(u,u_degree);
 
-    nearest_nb_list[i*nearest_nb_max_degree+i_degree-1] = j;
-    nearest_nb_list[j*nearest_nb_max_degree+j_degree-1] = i;
+    free(pos);
+}
 
-    nearest_nb_degree[i] = i_degree;
-    nearest_nb_degree[j] = j_degree;
+void free_network(network* g) {
+    if(g->mapped!=NULL) {
+        munmap(g->mapped,g->mapped_size);
+    } else {
+        free(g->edges);
+        free(g->offset);
+        free(g->adjacency);
+        free(g->weight);
+        free(g->adjacency_weight);
+    }
+    free(g->recovery);
+    free(g);
 }
 
-void nearest_nb_show() {
-    for(int i=0;i<nearest_nb_node;i++) {
-        if(nearest_nb_degree[i]>0) {
+void nearest_nb_show(network* g) {
+    for(int i=0;i<(g->nnode);i++) {
+        if(g->offset[i+1]>g->offset[i]) {
             printf("%d  | ",i);
-            for(int j=0;j<nearest_nb_degree[i];j++) {
-                printf("%d ",nearest_nb_list[i*nearest_nb_max_degree+j]);
+            for(int k=g->offset[i];k<g->offset[i+1];k++) {
+                printf("%d ",g->adjacency[k]);
             }
             printf("\n");
         }
     }
 }
 
-int nearest_nb_random_assign(int i, gsl_rng* rng) {
-    int k = nearest_nb_degree[i];
-    double dis=gsl_rng_uniform_pos(rng)*k;
+int nearest_nb_random_assign(network* g, int i, gsl_rng* rng) {
+    int k = g->offset[i+1]-g->offset[i];
+    double dis=rng_uniform_pos(rng)*k;
 
-    return nearest_nb_list[i*nearest_nb_max_degree+(int)dis];
+    return g->adjacency[g->offset[i]+(int)dis];
 }
 
-int nearest_nb_arg_max_degree() {
+int nearest_nb_arg_max_degree(network* g) {
     int j=0;
     int max_degree=0;
 
-    for(int i=0;i<nearest_nb_node;i++) {
-        if(max_degree<nearest_nb_degree[i]) {
+    for(int i=0;i<(g->nnode);i++) {
+        int degree = g->offset[i+1]-g->offset[i];
+        if(max_degree<degree) {
             j=i;
-            max_degree=nearest_nb_degree[i];
+            max_degree=degree;
         }
     }
 
     return j;
 }
 
-int* read_edgelist(char* filename, int* nnode, int* nedge) {
+network* read_edgelist(char* filename) {
     FILE* fp = fopen(filename,"r");
     if(fp==NULL) {
         printf("Can not find the file: %s\n",filename);
         exit(1);
     }
 
-    nearest_nb_initialize();
-
-    int* edges = NULL;
+    network* g = (network*)malloc(sizeof(network));
+    g->edges  = NULL;
+    g->weight = NULL;
+    g->recovery = NULL;
+    g->nedge  = 0;
+    g->mapped = NULL;
+    g->mapped_size = 0;
 
-    int i,j;
-    char data[128];
+    int i,j,n;
+    char line[1024];
     int nnode_temp = 0;
-    *nedge = 0;
-    while(fscanf(fp,"%d %d %s",&i,&j,data)==3) {
-        if(nnode_temp<i) {
-            nnode_temp=i;
-        } else if(nnode_temp<j) {
-            nnode_temp=j;
-        }
-        
-        edges = append_edge(edges,nedge,i,j);
-        nearest_nb_append(i,j);
+    int cap   = 0;
+    int weighted = 0;
+    while(fgets(line,sizeof(line),fp)!=NULL) {
+        if(sscanf(line,"%d %d%n",&i,&j,&n)!=2) continue;
+        if(nnode_temp<i) nnode_temp=i;
+        if(nnode_temp<j) nnode_temp=j;
+
+        double weight = edge_weight(line+n);
+        weighted |= (weight!=1.0);
+        append_edge(g,&cap,i,j,weight);
     }
+    fclose(fp);
+
+    // keep the unweighted networks on the uniform code paths
+    if(!weighted) {
+        free(g->weight);
+        g->weight = NULL;
+    }
+
+    g->nnode = nnode_temp+1;
+    network_build_csr(g);
+
+    //nearest_nb_show(g);
+
+    return g;
+}
+
+/* Binary cache of the CSR next to the edgelist (<filename>.csr):
+**     char   magic[8]  "CPMCCSR3"
+**     int    nnode, nedge, weighted, 0
+**     long long size, mtime_sec, mtime_nsec   (of the edgelist it was built from)
+**     double weight[nedge], adjacency_weight[2*nedge]   (if weighted)
+**     int    edges[2*nedge], offset[nnode+1], adjacency[2*nedge]
+** in native byte order, the doubles first so they stay aligned. It is used when the size and the modification
+** time, to the nanosecond, of the edgelist match the ones it records, and is mapped read-only, so loading costs no
+** parsing and no copy. An edgelist rewritten within the second its cache was built is then not taken for it.
+*/
+static const char network_cache_magic[8] = {'C','P','M','C','C','S','R','3'};
+
+static size_t network_cache_size(int nnode, int nedge, int weighted) {
+    return sizeof(network_cache_magic)+sizeof(int)*(4+2*(size_t)nedge+(nnode+1)+2*(size_t)nedge)
+          +sizeof(long long)*3+(weighted ? sizeof(double)*3*(size_t)nedge : 0);
+}
+
+// the size and modification time of the edgelist, as the cache records them
+static void network_cache_stamp(const struct stat* st, long long stamp[3]) {
+    stamp[0] = (long long)(st->st_size);
+    stamp[1] = (long long)(st->st_mtim.tv_sec);
+    stamp[2] = (long long)(st->st_mtim.tv_nsec);
+}
+
+static network* network_cache_map(char* cachename, const struct stat* st_text) {
+    struct stat st_cache;
+    if(stat(cachename,&st_cache)!=0) return NULL;
+    if((size_t)st_cache.st_size<network_cache_size(0,0,0)) return NULL;
+
+    int fd = open(cachename,O_RDONLY);
+    if(fd<0) return NULL;
+
+    size_t size = (size_t)st_cache.st_size;
+    void* mapped = mmap(NULL,size,PROT_READ,MAP_PRIVATE,fd,0);
+    close(fd);
+    if(mapped==MAP_FAILED) return NULL;
+
+    int* header = (int*)((char*)mapped+sizeof(network_cache_magic));
+    long long* recorded = (long long*)(header+4);
+    long long stamp[3];
+    network_cache_stamp(st_text,stamp);
+    if(memcmp(mapped,network_cache_magic,sizeof(network_cache_magic))!=0 ||
+       network_cache_size(header[0],header[1],header[2])!=size ||
+       memcmp(recorded,stamp,sizeof(stamp))!=0) {
+        munmap(mapped,size);
+        return NULL;
+    }
+
+    network* g = (network*)malloc(sizeof(network));
+    g->nnode = header[0];
+    g->nedge = header[1];
+    g->weight = NULL;
+    g->adjacency_weight = NULL;
+    g->recovery = NULL;
+
+    double* weights = (double*)(recorded+3);
+    if(header[2]) {
+        g->weight           = weights;
+        g->adjacency_weight = weights+(g->nedge);
+        weights += 3*(size_t)(g->nedge);
+    }
+    g->edges     = (int*)weights;
+    g->offset    = g->edges+2*(size_t)(g->nedge);
+    g->adjacency = g->offset+(g->nnode+1);
+    g->mapped      = mapped;
+    g->mapped_size = size;
+
+    return g;
+}
+
+static void network_cache_write(char* cachename, network* g, const struct stat* st_text) {
+    char tempname[1024+32];
+    snprintf(tempname,sizeof(tempname),"%s.%ld.tmp",cachename,(long)getpid());
+
+    FILE* fp = fopen(tempname,"wb");
+    if(fp==NULL) return;
+
+    int header[4] = {g->nnode,g->nedge,(g->weight!=NULL),0};
+    long long stamp[3];
+    network_cache_stamp(st_text,stamp);
+    size_t check = 0;
+    check += fwrite(network_cache_magic,sizeof(network_cache_magic),1,fp);
+    check += fwrite(header,sizeof(int),4,fp)==4;
+    check += fwrite(stamp,sizeof(long long),3,fp)==3;
+    if(g->weight!=NULL) {
+        check += fwrite(g->weight,sizeof(double),g->nedge,fp)==(size_t)(g->nedge);
+        check += fwrite(g->adjacency_weight,sizeof(double),2*(size_t)(g->nedge),fp)==2*(size_t)(g->nedge);
+    } else {
+        check += 2;
+    }
+    check += fwrite(g->edges,sizeof(int),2*(size_t)(g->nedge),fp)==2*(size_t)(g->nedge);
+    check += fwrite(g->offset,sizeof(int),g->nnode+1,fp)==(size_t)(g->nnode+1);
+    check += fwrite(g->adjacency,sizeof(int),2*(size_t)(g->nedge),fp)==2*(size_t)(g->nedge);
+
+    // publish the cache only once it is complete
+    if(fclose(fp)==0 && check==8) {
+        rename(tempname,cachename);
+    } else {
+        remove(tempname);
+    }
+}
+
+network* read_edgelist_cached(char* filename) {
+    char cachename[1024];
+    snprintf(cachename,sizeof(cachename),"%s.csr",filename);
+
+    // the edgelist is stated before it is parsed, a change while it is read leaves a cache that does not match
+    struct stat st_text;
+    if(stat(filename,&st_text)!=0) return read_edgelist(filename);
 
-    *nnode = nnode_temp+1;
+    network* g = network_cache_map(cachename,&st_text);
+    if(g!=NULL) return g;
+
+    g = read_edgelist(filename);
+    network_cache_write(cachename,g,&st_text);
+
+    return g;
+}
+
+network* load_network(char* filename) {
+#if NETWORK_CACHE
+    network* g = read_edgelist_cached(filename);
+#else
+    network* g = read_edgelist(filename);
+#endif
+    read_recovery(g,filename);
+
+    return g;
+}
+
+void read_recovery(network* g, char* filename) {
+    char name[1024];
+    snprintf(name,sizeof(name),"%s.recovery",filename);
+
+    FILE* fp = fopen(name,"r");
+    if(fp==NULL) return;
+
+    free(g->recovery);
+    g->recovery = (double*)malloc(sizeof(double)*(g->nnode));
+    for(int i=0;i<(g->nnode);i++) g->recovery[i] = 1.0;
+
+    int i;
+    double rate;
+    while(fscanf(fp,"%d %lf",&i,&rate)==2) {
+        if(i<0 || i>=(g->nnode)) {
+            printf("The node %d in %s is not in the network!\n",i,name);
+            exit(1);
+        }
+        g->recovery[i] = rate;
+    }
     fclose(fp);
+}
+
+// network of nnode nodes from the edges appended so far
+static network* network_from_edges(network* g, int nnode) {
+    free(g->weight);
+    g->weight = NULL;
+    g->nnode  = nnode;
+    network_build_csr(g);
+    return g;
+}
 
-    //nearest_nb_show();
+static network* network_empty() {
+    network* g = (network*)malloc(sizeof(network));
+    g->edges  = NULL;
+    g->weight = NULL;
+    g->recovery = NULL;
+    g->nedge  = 0;
+    g->mapped = NULL;
+    g->mapped_size = 0;
+    return g;
+}
+
+int* network_partition(network* g, int npart) {
+    int nnode  = g->nnode;
+    int* part  = (int*)malloc(sizeof(int)*nnode);
+    int* queue = (int*)malloc(sizeof(int)*nnode);
+    if(part==NULL || queue==NULL) {
+        printf("memory allocate error : network_partition\n");
+        exit(-1);
+    }
+    for(int i=0;i<nnode;i++) part[i] = -1;
+
+    // every part grows breadth-first from the lowest node left, a part that
+    // runs out of neighbours restarts from the next one
+    int next=0;
+    for(int p=0;p<npart;p++) {
+        int size = nnode/npart+(p<nnode%npart);
+        int n=0, head=0, tail=0;
+        while(n<size) {
+            if(head==tail) {
+                while(part[next]!=-1) next++;
+                part[next] = p;
+                queue[tail++] = next;
+                n++;
+                continue;
+            }
+
+            int i = queue[head++];
+            for(int k=g->offset[i];k<(g->offset[i+1]) && n<size;k++) {
+                int j = g->adjacency[k];
+                if(part[j]==-1) {
+                    part[j] = p;
+                    queue[tail++] = j;
+                    n++;
+                }
+            }
+        }
+    }
 
-    return edges;
+    free(queue);
+    return part;
 }
 
+network* network_halo(network* g, const int* part, int p, int* nown, int** node_map, int** edge_map) {
+    int nnode = g->nnode;
+    int* local = (int*)malloc(sizeof(int)*nnode);
+    if(local==NULL) {
+        printf("memory allocate error : network_halo\n");
+        exit(-1);
+    }
+
+    // the owned nodes, then the nodes of other parts next to them
+    int n=0;
+    for(int i=0;i<nnode;i++) local[i] = (part[i]==p) ? n++ : -1;
+    *nown = n;
+    for(int e=0;e<(g->nedge);e++) {
+        int a = g->edges[2*e+0];
+        int b = g->edges[2*e+1];
+        if(part[a]==p && part[b]!=p) local[b] = -2;
+        if(part[b]==p && part[a]!=p) local[a] = -2;
+    }
+    for(int i=0;i<nnode;i++) if(local[i]==-2) local[i] = n++;
+
+    int* map = (int*)malloc(sizeof(int)*(n>0 ? n : 1));
+    for(int i=0;i<nnode;i++) if(local[i]>=0) map[local[i]] = i;
+
+    int nedge=0;
+    for(int e=0;e<(g->nedge);e++) {
+        if(part[g->edges[2*e+0]]==p || part[g->edges[2*e+1]]==p) nedge++;
+    }
+    int* emap = (int*)malloc(sizeof(int)*(nedge>0 ? nedge : 1));
+
+    // an edge between two parts is sampled by the part of its first node
+    network* h = network_empty();
+    int cap=0;
+    for(int e=0;e<(g->nedge);e++) {
+        int a = g->edges[2*e+0];
+        int b = g->edges[2*e+1];
+        if(part[a]!=p && part[b]!=p) continue;
+        emap[h->nedge] = e;
+        append_edge(h,&cap,local[a],local[b],(part[a]==p) ? network_edge_weight(g,e) : 0.0);
+    }
+    h->nnode = n;
+    network_build_csr(h);
+
+    h->recovery = (double*)malloc(sizeof(double)*(n>0 ? n : 1));
+    for(int i=0;i<n;i++) h->recovery[i] = (i<(*nown)) ? network_node_recovery(g,map[i]) : 0.0;
+
+    free(local);
+    *node_map = map;
+    *edge_map = emap;
+    return h;
+}
+
+network* network_erdos_renyi(int nnode, double mean_degree, gsl_rng* rng) {
+    network* g = network_empty();
+    int cap = 0;
+
+    // G(n,M) with M = n*k/2 edges; a repeated pair is kept, which is rare on sparse graphs
+    long nedge = (long)(0.5*nnode*mean_degree);
+    for(long e=0;e<nedge;e++) {
+        int i = (int)gsl_rng_uniform_int(rng,nnode);
+        int j = (int)gsl_rng_uniform_int(rng,nnode);
+        if(i==j) {
+            e--;
+            continue;
+        }
+        append_edge(g,&cap,i,j,1.0);
+    }
+
+    return network_from_edges(g,nnode);
+}
+
+network* network_barabasi_albert(int nnode, int m, gsl_rng* rng) {
+    network* g = network_empty();
+    int cap = 0;
+
+    // every endpoint of an edge is one entry of targets, so a uniform entry
+    // is a node drawn with probability proportional to its degree
+    int* targets = (int*)malloc(sizeof(int)*2*(size_t)nnode*m);
+    int ntarget = 0;
+    for(int i=0;i<=m && i<nnode;i++) {
+        for(int j=0;j<i;j++) {
+            append_edge(g,&cap,i,j,1.0);
+            targets[ntarget++] = i;
+            targets[ntarget++] = j;
+        }
+    }
+    for(int i=m+1;i<nnode;i++) {
+        int nold = ntarget;
+        for(int k=0;k<m;k++) {
+            int j = targets[gsl_rng_uniform_int(rng,nold)];
+            append_edge(g,&cap,i,j,1.0);
+            targets[ntarget++] = i;
+            targets[ntarget++] = j;
+        }
+    }
+    free(targets);
+
+    return network_from_edges(g,nnode);
+}
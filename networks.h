@@ -3,12 +3,116 @@
 #ifndef networks_h
 #define networks_h
 
-int* read_edgelist(char* filename, int* nnode, int* nedge);
+/* Undirected network in compressed sparse row form. The neighbours of
+** node i are adjacency[offset[i]] ... adjacency[offset[i+1]-1], in the
+** order the edges appear in the edgelist. edges keeps the edgelist itself
+** as (i,j) pairs. If mapped is not NULL the arrays live in the memory
+** mapped binary cache and are released with it.
+** weight holds the infection rate of every edge relative to alpha, from
+** the third column of the edgelist, and adjacency_weight the same weight
+** in the order of adjacency; recovery holds the recovery rate of every node
+** relative to gamma. Each is NULL if all its rates are 1.
+*/
+typedef struct network {
+    int nnode;
+    int nedge;
+    int* edges;
+    int* offset;
+    int* adjacency;
+    double* weight;
+    double* adjacency_weight;
+    double* recovery;
+    void* mapped;
+    size_t mapped_size;
+} network;
 
-void nearest_nb_show();
+network* read_edgelist(char* filename);
 
-int nearest_nb_random_assign(int i, gsl_rng* rng);
+network* read_edgelist_cached(char* filename);
 
-int nearest_nb_arg_max_degree();
+/**
+ * Reads the recovery rates of the nodes, relative to gamma, from the file <filename>.recovery if it exists.
+ *
+ * Parameters:
+ *   g (network*): Network read from the edgelist filename.
+ *   filename (char*): Name of the edgelist.
+ *
+ * Behavior:
+ *   - Every line of the file is "i rate"; the nodes that are not listed keep the rate 1.
+ *   - Without the file g->recovery stays NULL.
+ */
+void read_recovery(network* g, char* filename);
+
+/* Load the network through the binary CSR cache (<edgelist>.csr) next to
+** the edgelist; build with -DNETWORK_CACHE=0 to always parse the text.
+*/
+#ifndef NETWORK_CACHE
+#define NETWORK_CACHE 1
+#endif
+
+/**
+ * Reads the network of an edgelist as the programs do: through the CSR cache (see NETWORK_CACHE), then the recovery
+ * rates of read_recovery.
+ */
+network* load_network(char* filename);
+
+// weight of edge e and recovery rate of node i, 1 without heterogeneous rates
+static inline double network_edge_weight(const network* g, int e) {
+    return (g->weight!=NULL) ? g->weight[e] : 1.0;
+}
+
+static inline double network_node_recovery(const network* g, int i) {
+    return (g->recovery!=NULL) ? g->recovery[i] : 1.0;
+}
+
+/**
+ * Synthetic networks for benchmarks and tests, without edge weights.
+ *
+ * Behavior:
+ *   - network_erdos_renyi draws nnode*mean_degree/2 edges between uniform pairs of distinct nodes.
+ *   - network_barabasi_albert starts from a clique of m+1 nodes and attaches every further node with m edges to
+ *     nodes drawn proportionally to their degree (a repeated neighbour is kept).
+ */
+network* network_erdos_renyi(int nnode, double mean_degree, gsl_rng* rng);
+
+network* network_barabasi_albert(int nnode, int m, gsl_rng* rng);
+
+/**
+ * Splits the nodes into npart parts of nnode/npart nodes (the first nnode%npart parts one more) for a
+ * domain-decomposed run.
+ *
+ * Behavior:
+ *   - Each part grows breadth-first from the lowest node not in a part yet, so a part is connected as far as its
+ *     size allows and the edges cut between parts stay few on networks with locality; it is not a METIS partition.
+ *
+ * Outputs:
+ *   - The part of every node, an array of nnode ints to free.
+ */
+int* network_partition(network* g, int npart);
+
+/**
+ * The network a part p of network_partition simulates: its nodes, the halo (the nodes of other parts next to them)
+ * and every edge with a node in p.
+ *
+ * Parameters:
+ *   g (network*): Network.
+ *   part (const int*), p (int): Parts of the nodes and the part.
+ *   nown (int*): Set to the number of nodes of p, the local nodes 0 ... nown-1; the halo nodes follow.
+ *   node_map (int**), edge_map (int**): Set to the node and edge of g of every local node and edge, to free.
+ *
+ * Behavior:
+ *   - Both kinds of local nodes and the edges keep the order of g. An edge between two parts is sampled by the
+ *     part of its first node: it keeps its weight there and gets the weight 0 on the other part; a halo node gets
+ *     the recovery rate 0. The model of the network then only draws the graphs its part owns.
+ */
+network* network_halo(network* g, const int* part, int p, int* nown, int** node_map, int** edge_map);
+
+void free_network(network* g);
+
+void nearest_nb_show(network* g);
+
+int nearest_nb_random_assign(network* g, int i, gsl_rng* rng);
+
+int nearest_nb_arg_max_degree(network* g);
 
 #endif
@@ -1,42 +1,31 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "norm.h"
 #include "dtype.h"
-
+#include "output.h"
 
 conf* malloc_conf(int size, int nsite) {
-    int* length = (int*)malloc(sizeof(int)*nsite);
-    int* sigma = (int*)malloc(sizeof(int)*nsite*size);
-    double* tau = (double*)malloc(sizeof(int)*nsite*size);
-    conf* c = (conf*)malloc(sizeof(conf));
-    
-    if(length==NULL) {
-       printf("memory allocate error : malloc_conf\n");
-       exit(-1); 
-    }
+    if(size<1) size=1;
 
-    if(sigma==NULL) {
-       printf("memory allocate error : malloc_conf\n");
-       exit(-1); 
-    }
+    int* offset = (int*)malloc(sizeof(int)*(nsite+1));
+    signed char* sigma = (signed char*)malloc(sizeof(signed char)*size);
+    double* tau = (double*)malloc(sizeof(double)*size);
+    conf* c = (conf*)malloc(sizeof(conf));
 
-    if(tau==NULL) {
-        printf("mempry allocate error : malloc_conf\n");
+    if(offset==NULL || sigma==NULL || tau==NULL || c==NULL) {
+        printf("memory allocate error : malloc_conf\n");
         exit(-1);
     }
 
-    if(c==NULL) {
-        printf("mempry allocate error : malloc_conf\n");
-        exit(-1);
-    }
-    
-    for(int i=0; i<nsite; i++) {
-        length[i]=0;
+    // every timeline is empty
+    for(int i=0; i<=nsite; i++) {
+        offset[i]=0;
     }
 
-    c->length = length;
+    c->offset = offset;
     c->sigma  = sigma;
     c->tau    = tau;
     c->size   = size;
@@ -46,59 +35,42 @@ conf* malloc_conf(int size, int nsite) {
 }
 
 void free_conf(conf* c) {
+    free(c->offset);
     free(c->sigma);
     free(c->tau);
     free(c);
 }
 
+// the entries are contiguous, growing only moves the two arrays
 void realloc_conf(conf* c, int size_new) {
     if(c->size >= size_new) {
         return;
     }
 
-    int nsite   = c->nsite;
-    int size    = c->size;
-    int* sigma  = c->sigma;
-    double* tau = c->tau;
-
-    int*  sigma_new = (int*)malloc(sizeof(int)*nsite*size_new);
-    double* tau_new = (double*)malloc(sizeof(double)*nsite*size_new);
+    int size = 2*(c->size);
+    if(size<size_new) size = size_new;
 
-    if(sigma_new == NULL) {
-       printf("memory allocate error : realloc_conf\n");
-       exit(-1);
-    }
+    signed char* sigma_new = (signed char*)realloc(c->sigma,sizeof(signed char)*size);
+    double* tau_new = (double*)realloc(c->tau,sizeof(double)*size);
 
-    if(tau_new == NULL) {
-        printf("mempry allocate error : realloc_conf\n");
+    if(sigma_new==NULL || tau_new==NULL) {
+        printf("memory allocate error : realloc_conf\n");
         exit(-1);
     }
 
-    for(int i_site = 0; i_site < nsite; i_site++) {
-        for(int i = 0; i < size; i++) {
-            sigma_new[i_site*size_new+i] = sigma[i_site*size+i];
-            tau_new[i_site*size_new+i] = tau[i_site*size+i];
-        }
-    }
-
-    free(sigma);
-    free(tau);
-
     c->sigma = sigma_new;
-    c->tau = tau_new;
-    c->size = size_new;
+    c->tau   = tau_new;
+    c->size  = size;
 }
 
 void show_conf(conf* c) {
     int nsite = c->nsite;
-    int size  = c->size;
 
     printf("--------------- show configuration --------------\n");
     printf("nsite = %d \n",nsite);
 
     printf("------------------------------\n");
     for(int i=0; i<nsite; i++) {
-        int length = c->length[i];
         if(i<10) {
             printf("%d    | ",i);
         } else if(i<100) {
@@ -109,96 +81,144 @@ void show_conf(conf* c) {
             printf("%d | ",i);
         }
 
-        for(int j=0; j<length; j++) {
-            int sigma = c->sigma[size*i+j];
-            double tau = c->tau[size*i+j];
-
-            //printf("%d ",sigma);
-            if(sigma==1) {
+        for(int k=c->offset[i]; k<c->offset[i+1]; k++) {
+            if(c->sigma[k]==1) {
                 printf("(+) ");
             } else {
                 printf("(-) ");
             }
-            printf("%.3f | ",tau);
+            printf("%.3f | ",c->tau[k]);
         }
         printf("\n");
     }
 }
 
-void inner_product(conf* c1, conf* c2) {
+double inner_product(conf* c1, conf* c2) {
     if(c1->nsite != c2->nsite) {
         printf("c1 and c2 should have the same nsite!\n");
-        return;
+        exit(1);
     }
 
     int nsite = c1->nsite;
     double z=0;
 
-    int length1, length2;
-    int size1, size2;
-    int sigma1, sigma2;
-    double tau1, tau2;
+    // both timelines are step functions on [0,1), merged segment by segment
     for(int i=0; i<nsite; i++) {
-        length1 = c1->length[i];
-        length2 = c2->length[i];
-
-        size1 = c1->size;
-        size2 = c2->size;
-
-        sigma1 = c1->sigma[size1*i+0];
-        sigma2 = c2->sigma[size2*i+0];
-
-        tau1 = c1->tau[size1*i+0];
-        tau2 = c2->tau[size2*i+0];
+        int k1 = c1->offset[i];
+        int k2 = c2->offset[i];
+        int end1 = c1->offset[i+1];
+        int end2 = c2->offset[i+1];
+        if(k1==end1 || k2==end2) continue;
+
+        double tau=0;
+        while(1) {
+            double tau1 = (k1+1<end1) ? c1->tau[k1+1] : 1.0;
+            double tau2 = (k2+1<end2) ? c2->tau[k2+1] : 1.0;
+            double next = (tau1<tau2) ? tau1 : tau2;
+
+            z += (c1->sigma[k1])*(c2->sigma[k2])*(next-tau);
+            tau = next;
+
+            if(k1+1>=end1 && k2+1>=end2) break;
+            if(tau1<=next && k1+1<end1) k1++;
+            if(tau2<=next && k2+1<end2) k2++;
+        }
     }
+
+    return z/nsite;
 }
 
 void world_line_to_conf(conf* c, world_line* w, model* m) {
     vertex* v;
-    int bond, hNspin, size;
-    //int index, type;
-    int* indices;
-    int* state;
-    double tau;
+    int hNspin, index;
 
-    int nsite  = w->nsite;
-    //int mnspin = w->mnspin;
+    int nsite   = w->nsite;
+    int* offset = c->offset;
 
     vertex* sequence = w->sequenceB;
     if(w->flag)
         sequence = w->sequenceA;
 
+    // number of entries of every site, the initial state and its changes
     for(int i=0; i<nsite; i++) {
-        size = c->size;
-
-        c->sigma[size*i+0] = w->istate[i];
-        c->tau[size*i+0] = 0;
-        c->length[i] = 1;
+        offset[i] = 1;
+    }
+    for(int n=0; n<(w->nvertices); n++) {
+        v      = &(sequence[n]);
+        hNspin = v->hNspin;
+        for(int j=0; j<hNspin; j++) {
+            if(vertex_state(v,j) != vertex_state(v,j+hNspin)) offset[bond_index(m,v->bond,j)]++;
+        }
     }
 
-    for(int i=0; i<(w->nvertices); i++) {
-        v       = &(sequence[i]);
-        bond    = v->bond;
-        hNspin  = v->hNspin;
-        tau     = v->tau;
-        state   = v->state;
-        indices = &(m->bond2index[bond*(m->mhnspin)]);
+    int total=0;
+    for(int i=0; i<nsite; i++) {
+        int count = offset[i];
+        offset[i] = total;
+        total += count;
+    }
+    offset[nsite] = total;
+    realloc_conf(c,total);
 
+    // offset[i] runs through the entries of site i, it ends at the start of site i+1
+    for(int i=0; i<nsite; i++) {
+        c->sigma[offset[i]] = w->istate[i];
+        c->tau[offset[i]]   = 0;
+        offset[i]++;
+    }
+    for(int n=0; n<(w->nvertices); n++) {
+        v      = &(sequence[n]);
+        hNspin = v->hNspin;
         for(int j=0; j<hNspin; j++) {
-            if(state[j] != state[j+hNspin]) {
-                size = c->size;
-                int length = c->length[indices[j]];
-
-                if((length+1)>size) {
-                    realloc_conf(c, size+1000);
-                    size = c->size;
-                }
-
-                c->sigma[size*indices[j]+length] = state[j+hNspin];
-                c->tau[size*indices[j]+length] = tau;
-                c->length[indices[j]] = length+1;
+            if(vertex_state(v,j) != vertex_state(v,j+hNspin)) {
+                index = bond_index(m,v->bond,j);
+                c->sigma[offset[index]] = vertex_state(v,j+hNspin);
+                c->tau[offset[index]]   = v->tau;
+                offset[index]++;
             }
-        }    
+        }
+    }
+    for(int i=nsite; i>0; i--) {
+        offset[i] = offset[i-1];
     }
+    offset[0] = 0;
+}
+
+void conf_write(FILE* fp, conf* c) {
+    int nsite = c->nsite;
+    int n = c->offset[nsite];
+
+    output_binary_header(fp,"CPMCPATH",&nsite,1);
+    fwrite(&n,sizeof(int),1,fp);
+    fwrite(c->offset,sizeof(int),nsite+1,fp);
+    fwrite(c->sigma,sizeof(signed char),n,fp);
+    fwrite(c->tau,sizeof(double),n,fp);
+}
+
+int conf_read_header(FILE* fp) {
+    char magic[8];
+    int ndim, nsite;
+
+    if(fread(magic,sizeof(char),8,fp)!=8 || memcmp(magic,"CPMCPATH",8)!=0) return -1;
+    if(fread(&ndim,sizeof(int),1,fp)!=1 || ndim!=1) return -1;
+    if(fread(&nsite,sizeof(int),1,fp)!=1) return -1;
+
+    return nsite;
 }
 
+int conf_read(FILE* fp, conf* c) {
+    int n;
+    int nsite = c->nsite;
+
+    if(fread(&n,sizeof(int),1,fp)!=1) return 0;
+    realloc_conf(c,n);
+
+    if(fread(c->offset,sizeof(int),nsite+1,fp)!=(size_t)(nsite+1) || c->offset[nsite]!=n ||
+       fread(c->sigma,sizeof(signed char),n,fp)!=(size_t)n ||
+       fread(c->tau,sizeof(double),n,fp)!=(size_t)n) {
+        printf("The configuration record is truncated or has another number of sites (nsite=%d)!\n",nsite);
+        exit(1);
+    }
+
+    return 1;
+}
@@ -1,14 +1,22 @@
 #ifndef norm_h
 #define norm_h
 
+#include <stdio.h>
+
 #include "dtype.h"
 
+/* A configuration as per-site timelines in CSR storage. The timeline of
+** site i is the entries offset[i] ... offset[i+1]-1: the state sigma
+** from tau on, the first entry being the initial state at tau=0 and every
+** other one a change of the state. size is the capacity of sigma and tau
+** in entries, grown by world_line_to_conf.
+*/
 typedef struct conf {
-    int* length;
-    int* sigma;
-    double* tau;
-    int size;
     int nsite;
+    int size;
+    int* offset;
+    signed char* sigma;
+    double* tau;
 } conf;
 
 conf* malloc_conf(int size, int nsite);
@@ -19,6 +27,49 @@ void realloc_conf(conf* c, int size_new);
 
 void show_conf(conf* c);
 
+/**
+ * Converts the active sequence of a world-line into per-site timelines.
+ *
+ * Parameters:
+ *   c (conf*): Configuration with w->nsite sites, grown if the timelines do not fit.
+ *   w (world_line*): World-line, its initial state and the vertices that change a state are kept.
+ *   m (model*): Model giving the sites of the bonds.
+ *
+ * Behavior:
+ *   - Counts the changes of every site, sets the offsets from the counts and then fills the timelines in a second
+ *     pass over the vertices, O(nsite + nvertices) with storage for nsite + number of changes entries.
+ */
 void world_line_to_conf(conf* c, world_line* w, model* m);
 
+/**
+ * Overlap of two configurations, (1/nsite) sum_i int_0^1 sigma1_i(tau) sigma2_i(tau) dtau.
+ *
+ * Behavior:
+ *   - 1 for the same configuration and -1 for its reverse; the timelines of a site are merged in
+ *     O(length1 + length2).
+ *   - Exits with an error if the configurations have a different number of sites.
+ */
+double inner_product(conf* c1, conf* c2);
+
+/**
+ * Appends a configuration to a binary stream, e.g. an output_stream opened with "ab".
+ *
+ * Behavior:
+ *   - An empty stream first gets the header "CPMCPATH", 1, nsite (see output_binary_header).
+ *   - A record is the number of entries n, the nsite+1 offsets, the n states as bytes and the n times as
+ *     doubles, all in the byte order of the machine.
+ */
+void conf_write(FILE* fp, conf* c);
+
+/**
+ * Reads the header of a stream written by conf_write, returns the number of sites or -1 if it is not one.
+ */
+int conf_read_header(FILE* fp);
+
+/**
+ * Reads the next record of a stream written by conf_write into c, grown if needed; returns 0 at the end of the
+ * stream and exits with an error for a truncated record or another number of sites.
+ */
+int conf_read(FILE* fp, conf* c);
+
 #endif
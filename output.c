@@ -0,0 +1,150 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "output.h"
+
+typedef struct output_entry {
+    char name[128];
+    FILE* fp;
+    char* buffer;
+} output_entry;
+
+static output_entry output_streams[OUTPUT_MAX_STREAMS];
+static int output_nstream=0;
+
+static FILE* output_open(const char* name, const char* mode) {
+    if(output_nstream==OUTPUT_MAX_STREAMS) {
+        printf("Too many output streams (%d) : %s\n",OUTPUT_MAX_STREAMS,name);
+        exit(1);
+    }
+
+    output_entry* e = &(output_streams[output_nstream]);
+    e->fp = fopen(name,mode);
+    if(e->fp==NULL) {
+        printf("Can not open the output file: %s\n",name);
+        exit(1);
+    }
+    e->buffer = (char*)malloc(OUTPUT_BUFFER_SIZE);
+    if(e->buffer!=NULL) setvbuf(e->fp,e->buffer,_IOFBF,OUTPUT_BUFFER_SIZE);
+    if(mode[0]=='a') fseek(e->fp,0,SEEK_END);
+
+    strncpy(e->name,name,sizeof(e->name)-1);
+    e->name[sizeof(e->name)-1] = '\0';
+    output_nstream++;
+
+    return e->fp;
+}
+
+FILE* output_stream(const char* name, const char* mode) {
+    FILE* fp=NULL;
+
+#ifdef _OPENMP
+#pragma omp critical (output)
+#endif
+    {
+        for(int i=0;i<output_nstream && fp==NULL;i++) {
+            if(strcmp(output_streams[i].name,name)==0) fp = output_streams[i].fp;
+        }
+        if(fp==NULL) fp = output_open(name,mode);
+    }
+
+    return fp;
+}
+
+void output_flush() {
+#ifdef _OPENMP
+#pragma omp critical (output)
+#endif
+    for(int i=0;i<output_nstream;i++) fflush(output_streams[i].fp);
+}
+
+int output_marks(output_mark* marks, int max) {
+    int n=0;
+
+#ifdef _OPENMP
+#pragma omp critical (output)
+#endif
+    {
+        if(output_nstream>max) {
+            printf("Too many output streams for a checkpoint (%d) : %d\n",max,output_nstream);
+            exit(1);
+        }
+        for(int i=0;i<output_nstream;i++) {
+            fflush(output_streams[i].fp);
+            strcpy(marks[i].name,output_streams[i].name);
+            marks[i].length = ftell(output_streams[i].fp);
+        }
+        n = output_nstream;
+    }
+
+    return n;
+}
+
+void output_truncate(const output_mark* marks, int nmark) {
+#ifdef _OPENMP
+#pragma omp critical (output)
+#endif
+    for(int k=0;k<nmark;k++) {
+        FILE* fp=NULL;
+        for(int i=0;i<output_nstream && fp==NULL;i++) {
+            if(strcmp(output_streams[i].name,marks[k].name)==0) fp = output_streams[i].fp;
+        }
+        if(fp!=NULL) fflush(fp);
+
+        // a file the run had opened but not written yet may not exist
+        struct stat st;
+        if(stat(marks[k].name,&st)!=0 && marks[k].length==0) continue;
+        if(stat(marks[k].name,&st)!=0 || (long)st.st_size<marks[k].length ||
+           truncate(marks[k].name,(off_t)marks[k].length)!=0) {
+            printf("Can not cut the output file %s back to %ld bytes!\n",marks[k].name,marks[k].length);
+            exit(1);
+        }
+        if(fp!=NULL) fseek(fp,0,SEEK_END);
+    }
+}
+
+void output_close() {
+#ifdef _OPENMP
+#pragma omp critical (output)
+#endif
+    {
+        for(int i=0;i<output_nstream;i++) {
+            fclose(output_streams[i].fp);
+            free(output_streams[i].buffer);
+        }
+        output_nstream=0;
+    }
+}
+
+void output_close_prefix(const char* prefix) {
+    size_t n = strlen(prefix);
+
+#ifdef _OPENMP
+#pragma omp critical (output)
+#endif
+    {
+        int k=0;
+        for(int i=0;i<output_nstream;i++) {
+            if(strncmp(output_streams[i].name,prefix,n)==0) {
+                fclose(output_streams[i].fp);
+                free(output_streams[i].buffer);
+            } else {
+                output_streams[k++] = output_streams[i];
+            }
+        }
+        output_nstream=k;
+    }
+}
+
+void output_binary_header(FILE* fp, const char* magic, int* dims, int ndim) {
+    if(ftell(fp)==0) {
+        fwrite(magic,sizeof(char),8,fp);
+        fwrite(&ndim,sizeof(int),1,fp);
+        fwrite(dims,sizeof(int),ndim,fp);
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef output_h
+#define output_h
+
+#include <stdio.h>
+
+/* Largest number of output streams open at a time. */
+#ifndef OUTPUT_MAX_STREAMS
+#define OUTPUT_MAX_STREAMS 256
+#endif
+
+/* Size of the stdio buffer of every output stream. */
+#ifndef OUTPUT_BUFFER_SIZE
+#define OUTPUT_BUFFER_SIZE (1<<20)
+#endif
+
+/**
+ * Returns the output stream of a file, opening it on first use.
+ *
+ * Parameters:
+ *   name (const char*): Name of the file, it identifies the stream.
+ *   mode (const char*): fopen mode used when the stream is opened ("a", "w", "ab", ...).
+ *
+ * Behavior:
+ *   - The stream stays open and fully buffered (OUTPUT_BUFFER_SIZE) until output_close, so writing a block costs
+ *     no open/close and reaches the file system in large writes.
+ *   - Safe to call from several OpenMP threads; writes to the same stream are serialized by stdio.
+ *   - Exits with an error if the file can not be opened.
+ *
+ * Outputs:
+ *   - The open stream, positioned at the end of the file for append modes.
+ */
+FILE* output_stream(const char* name, const char* mode);
+
+/**
+ * Flushes every open output stream, so the files are complete up to this point (e.g. before a checkpoint).
+ */
+void output_flush();
+
+/* A file of an output stream and its length, as a checkpoint records it. */
+typedef struct output_mark {
+    char name[128];
+    long length;
+} output_mark;
+
+/**
+ * Flushes the open output streams and records the name and length of each of their files.
+ *
+ * Parameters:
+ *   marks (output_mark*), max (int): Array of at most max marks that is filled.
+ *
+ * Outputs:
+ *   - The number of marks written; exits with an error if more than max streams are open.
+ */
+int output_marks(output_mark* marks, int max);
+
+/**
+ * Cuts every file of marks back to its recorded length, so what a run wrote after its checkpoint is not written a
+ * second time when it resumes.
+ *
+ * Behavior:
+ *   - A stream of the file that is already open is flushed first and positioned at the new end.
+ *   - Exits with an error if a file is shorter than its mark or can not be truncated.
+ */
+void output_truncate(const output_mark* marks, int nmark);
+
+/**
+ * Flushes and closes every open output stream.
+ */
+void output_close();
+
+/**
+ * Flushes and closes the open output streams whose names start with prefix, e.g. the files of a finished job.
+ */
+void output_close_prefix(const char* prefix);
+
+/**
+ * Writes a header for a binary output file if the stream is still empty.
+ *
+ * Parameters:
+ *   fp (FILE*): Stream returned by output_stream in a binary append mode.
+ *   magic (const char*): 8 characters identifying the content.
+ *   dims (int*), ndim (int): Dimensions of one record, written as ints after the magic.
+ */
+void output_binary_header(FILE* fp, const char* magic, int* dims, int ndim);
+
+#endif
@@ -0,0 +1,84 @@
+#include <stdint.h>
+#include <math.h>
+#include <gsl/gsl_rng.h>
+
+#include "rng.h"
+
+static inline uint64_t rotl(uint64_t x, int k) {
+    return (x<<k)|(x>>(64-k));
+}
+
+static uint64_t splitmix64(uint64_t* x) {
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z^(z>>30))*0xbf58476d1ce4e5b9ULL;
+    z = (z^(z>>27))*0x94d049bb133111ebULL;
+    return z^(z>>31);
+}
+
+// one step of every lane, the upper 53 bits mapped to the open interval (0,1)
+static void xoshiro_fill(rng_state* s, double* buffer) {
+    uint64_t (*q)[RNG_LANES] = s->s;
+    for(int i=0;i<RNG_BUFFER;i+=RNG_LANES) {
+        for(int l=0;l<RNG_LANES;l++) {
+            uint64_t x = q[0][l]+q[3][l];
+            uint64_t t = q[1][l]<<17;
+            q[2][l] ^= q[0][l];
+            q[3][l] ^= q[1][l];
+            q[1][l] ^= q[2][l];
+            q[0][l] ^= q[3][l];
+            q[2][l] ^= t;
+            q[3][l] = rotl(q[3][l],45);
+            buffer[i+l] = ((double)(x>>11)+0.5)*(1.0/9007199254740992.0);
+        }
+    }
+}
+
+void rng_refill_uniform(rng_state* s) {
+    xoshiro_fill(s,s->uniform);
+    s->nuniform = 0;
+}
+
+void rng_refill_exponential(rng_state* s) {
+    xoshiro_fill(s,s->exponential);
+    for(int i=0;i<RNG_BUFFER;i++) s->exponential[i] = -log(s->exponential[i]);
+    s->nexponential = 0;
+}
+
+static void xoshiro_set(void* state, unsigned long int seed) {
+    rng_state* s = (rng_state*)state;
+    uint64_t x = seed;
+    for(int k=0;k<4;k++)
+        for(int l=0;l<RNG_LANES;l++) s->s[k][l] = splitmix64(&x);
+    s->nuniform     = RNG_BUFFER;
+    s->nexponential = RNG_BUFFER;
+}
+
+static double xoshiro_get_double(void* state) {
+    rng_state* s = (rng_state*)state;
+    if(s->nuniform==RNG_BUFFER) rng_refill_uniform(s);
+    return s->uniform[s->nuniform++];
+}
+
+static unsigned long int xoshiro_get(void* state) {
+    return (unsigned long int)(xoshiro_get_double(state)*4294967296.0);
+}
+
+static const gsl_rng_type xoshiro_type = {
+    "xoshiro256+x4",
+    0xffffffffUL,
+    0,
+    sizeof(rng_state),
+    &xoshiro_set,
+    &xoshiro_get,
+    &xoshiro_get_double
+};
+
+const gsl_rng_type* rng_xoshiro = &xoshiro_type;
+
+const gsl_rng_type* rng_chain_type() {
+#ifdef RNG_MT19937
+    return gsl_rng_mt19937;
+#else
+    return rng_xoshiro;
+#endif
+}
@@ -0,0 +1,75 @@
+#ifndef rng_h
+#define rng_h
+
+#include <stdint.h>
+#include <math.h>
+#include <gsl/gsl_rng.h>
+
+/* Number of uniforms (and of exponential gaps) refilled at once. */
+#ifndef RNG_BUFFER
+#define RNG_BUFFER 4096
+#endif
+
+/* Independent xoshiro256+ streams advanced side by side, so the refill
+** loop runs over the lanes and vectorizes.
+*/
+#define RNG_LANES 4
+
+/* State of the buffered generator, a gsl_rng_type so that the chains keep
+** their gsl_rng streams (seeding, checkpoints, thread streams) unchanged.
+** s[k][l] is word k of lane l. uniform holds numbers in (0,1) and
+** exponential holds -log(u), both read from nuniform / nexponential on;
+** a buffer is refilled from the lanes once it is used up.
+*/
+typedef struct rng_state {
+    uint64_t s[4][RNG_LANES];
+    int nuniform;
+    int nexponential;
+    double uniform[RNG_BUFFER];
+    double exponential[RNG_BUFFER];
+} rng_state;
+
+extern const gsl_rng_type* rng_xoshiro;
+
+/**
+ * Returns the generator of the chain streams: rng_xoshiro, or gsl_rng_mt19937 if the program is built with
+ * RNG_MT19937 (make RNG=mt19937). Only the generator changes, the runs of the unbuffered code are not reproduced.
+ */
+const gsl_rng_type* rng_chain_type();
+
+void rng_refill_uniform(rng_state* s);
+
+void rng_refill_exponential(rng_state* s);
+
+/**
+ * Inline replacements of gsl_rng_uniform_pos / gsl_rng_uniform and of -log(gsl_rng_uniform_pos) for the hot loops.
+ *
+ * Behavior:
+ *   - For an rng_xoshiro stream the number is read from the buffer in the state, without the call through the
+ *     gsl_rng_type; the exponential gaps have their own buffer with the logarithms taken at the refill.
+ *   - Any other generator goes through GSL, drawing exactly the numbers the plain GSL calls would draw.
+ */
+static inline double rng_uniform_pos(const gsl_rng* r) {
+    if(r->type==rng_xoshiro) {
+        rng_state* s = (rng_state*)(r->state);
+        if(s->nuniform==RNG_BUFFER) rng_refill_uniform(s);
+        return s->uniform[s->nuniform++];
+    }
+    return gsl_rng_uniform_pos(r);
+}
+
+static inline double rng_uniform(const gsl_rng* r) {
+    if(r->type==rng_xoshiro) return rng_uniform_pos(r);
+    return gsl_rng_uniform(r);
+}
+
+static inline double rng_exponential(const gsl_rng* r) {
+    if(r->type==rng_xoshiro) {
+        rng_state* s = (rng_state*)(r->state);
+        if(s->nexponential==RNG_BUFFER) rng_refill_exponential(s);
+        return s->exponential[s->nexponential++];
+    }
+    return -log(gsl_rng_uniform_pos(r));
+}
+
+#endif
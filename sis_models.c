@@ -2,6 +2,8 @@
 #include <stdlib.h>
 
 #include "dtype.h"
+#include "networks.h"
+#include "models.h"
 
 /* graph name : same_state
 **     2    3
@@ -288,157 +290,44 @@ int insert_rule_all_type_frozen(int* state) {
     return 1;
 }
 
-
-
-
-static void create_cmf(double* cmf, double* weight, int length) {
-    int i=0;
-
-    cmf[0] = weight[i];
-    for(i=1;i<length;i++) {
-        cmf[i] = cmf[i-1]+weight[i];
-    }
+/* The SIS model: an infection of rate alpha per edge is split into the
+** graphs infect_1 ... infect_6 (and same_state on equal states), a recovery
+** of rate gamma per node into single_site_recover_1/2 and
+** susceptible_frozen. The graphs of a group act on the same states with the
+** same weight.
+*/
+static const graph_rule sis_graphs[] = {
+    {"same_state",               2, GRAPH_RATE_INFECTION, 2, 3, link_rule_same_state,               insert_rule_same_state,               -1},
+    {"infect_1",                 2, GRAPH_RATE_INFECTION, 1, 3, link_rule_infect_1,                 insert_rule_infect_1,                  0},
+    {"infect_2",                 2, GRAPH_RATE_INFECTION, 1, 3, link_rule_infect_2,                 insert_rule_infect_2,                  1},
+    {"infect_3",                 2, GRAPH_RATE_INFECTION, 1, 3, link_rule_infect_3,                 insert_rule_infect_3,                  0},
+    {"infect_4",                 2, GRAPH_RATE_INFECTION, 1, 3, link_rule_infect_4,                 insert_rule_infect_4,                  1},
+    {"infect_5",                 2, GRAPH_RATE_INFECTION, 1, 3, link_rule_infect_5,                 insert_rule_infect_5,                  0},
+    {"infect_6",                 2, GRAPH_RATE_INFECTION, 1, 3, link_rule_infect_6,                 insert_rule_infect_6,                  1},
+    {"single_site_recover_1",    1, GRAPH_RATE_RECOVERY,  1, 2, link_rule_single_site_recover_1,    insert_rule_single_site_recover_1,     2},
+    {"single_site_recover_2",    1, GRAPH_RATE_RECOVERY,  1, 2, link_rule_single_site_recover_2,    insert_rule_single_site_recover_2,     2},
+    {"susceptible_frozen",       1, GRAPH_RATE_RECOVERY,  1, 1, link_rule_susceptible_frozen,       insert_rule_susceptible_frozen,       -1},
+    {"all_type_frozen",          1, GRAPH_RATE_NONE,      0, 1, link_rule_all_type_frozen,          insert_rule_all_type_frozen,          -1},
+};
+
+const model_description sis_model = {"sis",(int)(sizeof(sis_graphs)/sizeof(sis_graphs[0])),sis_graphs};
+
+model* sis_model_uniform_infection(double alpha, double gamma, network* g) {
+    return model_build(&sis_model,alpha,gamma,g,0);
 }
 
-model* sis_model_uniform_infection(double alpha, double gamma, int nnode, int nedge, int* edges) {
-    int nsite = nnode;
-    int nbond = 7*nedge+3*nnode;
-    int mhnspin = 2;
-
-    printf("nnode=%d, nedge=%d\n",nnode,nedge);
-
-    model* m = malloc_model(nsite,nbond+nnode,mhnspin);
-
-    int n=0;
-    for(int i_type=0;i_type<7;i_type++){
-        for(int i_edge=0;i_edge<nedge;i_edge++) {
-            int i = edges[2*i_edge+0];
-            int j = edges[2*i_edge+1];
-
-            m->bond2type[n]   = i_type;
-            m->bond2hNspin[n] = 2;
-
-            if(i_type==0) {
-                m->bond2weight[n] = 2*alpha/3.0;
-                m->sweight += 2*alpha/3.0;
-            } else {
-                m->bond2weight[n] = alpha/3.0;
-                m->sweight += alpha/3.0;
-            }
-
-            m->bond2index[n*mhnspin+0] = i;
-            m->bond2index[n*mhnspin+1] = j;
-            n++;
-        }
-    }
-    for(int i=0;i<nnode;i++) {
-
-        m->bond2type[n]   = 7;
-        m->bond2hNspin[n] = 1;
-        m->bond2weight[n] = 0.5*gamma;
-        m->sweight += 0.5*gamma;
-        m->bond2index[n*mhnspin+0] = i;
-        m->bond2index[n*mhnspin+1] = -1;
-        n++;
-    }
-    for(int i=0;i<nnode;i++) {
-
-        m->bond2type[n]   = 8;
-        m->bond2hNspin[n] = 1;
-        m->bond2weight[n] = 0.5*gamma;
-        m->sweight += 0.5*gamma;
-        m->bond2index[n*mhnspin+0] = i;
-        m->bond2index[n*mhnspin+1] = -1;
-        n++;
-    }
-    for(int i=0;i<nnode;i++) {
-
-        m->bond2type[n]   = 9;
-        m->bond2hNspin[n] = 1;
-        m->bond2weight[n] = 1.0*gamma;
-        m->sweight += 1.0*gamma;
-        m->bond2index[n*mhnspin+0] = i;
-        m->bond2index[n*mhnspin+1] = -1;
-        n++;
-    }
-
-    /* type : 10
-    ** apply only one the boundary
-    */
-    for(int i=0;i<nnode;i++) {
-
-        m->bond2type[n]   = 10;
-        m->bond2hNspin[n] = 1;
-        m->bond2weight[n] = 0.0;
-        m->sweight += 0.0;
-        m->bond2index[n*mhnspin+0] = i;
-        m->bond2index[n*mhnspin+1] = -1;
-        n++;
-    }
-
-    for(int i=0;i<8;i++) {
-        m->link[0*4*mhnspin+i] = link_rule_same_state[i];
-        m->link[1*4*mhnspin+i] = link_rule_infect_1[i];
-        m->link[2*4*mhnspin+i] = link_rule_infect_2[i];
-        m->link[3*4*mhnspin+i] = link_rule_infect_3[i];
-        m->link[4*4*mhnspin+i] = link_rule_infect_4[i];
-        m->link[5*4*mhnspin+i] = link_rule_infect_5[i];
-        m->link[6*4*mhnspin+i] = link_rule_infect_6[i];
-    }
-    for(int i=0;i<4;i++) {
-        m->link[7*4*mhnspin+i] = link_rule_single_site_recover_1[i];
-        m->link[8*4*mhnspin+i] = link_rule_single_site_recover_2[i];
-        m->link[9*4*mhnspin+i] = link_rule_susceptible_frozen[i];
-        m->link[10*4*mhnspin+i] = link_rule_all_type_frozen[i];
-    }
-
-    m->insert[0] = insert_rule_same_state;
-    m->insert[1] = insert_rule_infect_1;
-    m->insert[2] = insert_rule_infect_2;
-    m->insert[3] = insert_rule_infect_3;
-    m->insert[4] = insert_rule_infect_4;
-    m->insert[5] = insert_rule_infect_5;
-    m->insert[6] = insert_rule_infect_6;
-    m->insert[7] = insert_rule_single_site_recover_1;
-    m->insert[8] = insert_rule_single_site_recover_2;
-    m->insert[9] = insert_rule_susceptible_frozen;
-    m->insert[10] = insert_rule_all_type_frozen;
-
-    m->nsite = nsite;
-    m->nbond = nbond;
-    m->mhnspin = mhnspin;
-    create_cmf(m->cmf,m->bond2weight,nbond);
-
-/*
-    for(int i=0;i<nedge;i++) {
-        int k[12];
-        k[0] = m->bond2index[(i+0*nedge)*mhnspin+0];
-        k[1] = m->bond2index[(i+0*nedge)*mhnspin+1];
-        k[2] = m->bond2index[(i+1*nedge)*mhnspin+0];
-        k[3] = m->bond2index[(i+1*nedge)*mhnspin+1];
-        k[4] = m->bond2index[(i+2*nedge)*mhnspin+0];
-        k[5] = m->bond2index[(i+2*nedge)*mhnspin+1];
-        k[6] = m->bond2index[(i+3*nedge)*mhnspin+0];
-        k[7] = m->bond2index[(i+3*nedge)*mhnspin+1];
-        k[8] = m->bond2index[(i+4*nedge)*mhnspin+0];
-        k[9] = m->bond2index[(i+4*nedge)*mhnspin+1];
-        k[10] = m->bond2index[(i+5*nedge)*mhnspin+0];
-        k[11] = m->bond2index[(i+5*nedge)*mhnspin+1];
-        printf("(%d,%d) (%d,%d) (%d,%d) (%d,%d) (%d,%d) (%d,%d)\n",k[0],k[1],k[2],k[3],k[4],k[5],k[6],k[7],k[8],k[9],k[10],k[11]);
-    }
+/* Same model as sis_model_uniform_infection with an implicit bond table:
+** every edge graph shares the endpoints in g->edges and every graph of a
+** type shares its weight, so the model stores no per-bond arrays.
 */
+model* sis_model_uniform_infection_implicit(double alpha, double gamma, network* g) {
+    return model_build(&sis_model,alpha,gamma,g,1);
+}
 
-    printf("--------------- check m->link ----------------\n");
-    for(int i=0;i<20;i++) {
-        for(int j=0;j<4*mhnspin;j++) {
-            if(m->link[i*4*mhnspin+j]<0) {
-                printf("%d ",m->link[i*4*mhnspin+j]);
-            } else {
-                printf(" %d ",m->link[i*4*mhnspin+j]);
-            }
-        }
-        printf("\n");
-    }
-
-    return m;
+model* sis_model_build(double alpha, double gamma, network* g) {
+#if IMPLICIT_BONDS
+    return sis_model_uniform_infection_implicit(alpha,gamma,g);
+#else
+    return sis_model_uniform_infection(alpha,gamma,g);
+#endif
 }
@@ -2,7 +2,26 @@
 #define sis_models_h
 
 #include "dtype.h"
+#include "networks.h"
+#include "models.h"
 
-model* sis_model_uniform_infection(double alpha, double gamma, int nnode, int nedge, int* edges);
+/* The SIS graphs, see sis_models.c. The builders below scale alpha and
+** gamma by the edge weights and node recovery rates of the network.
+*/
+extern const model_description sis_model;
+
+model* sis_model_uniform_infection(double alpha, double gamma, network* g);
+
+model* sis_model_uniform_infection_implicit(double alpha, double gamma, network* g);
+
+/* Build the model with an implicit bond table (-DIMPLICIT_BONDS=1), which
+** stores no per-bond arrays and decodes a bond from its number.
+*/
+#ifndef IMPLICIT_BONDS
+#define IMPLICIT_BONDS 0
+#endif
+
+// the SIS model of the programs, with the bond table chosen by IMPLICIT_BONDS
+model* sis_model_build(double alpha, double gamma, network* g);
 
 #endif
@@ -0,0 +1,333 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <gsl/gsl_rng.h>
+
+#include "dtype.h"
+#include "networks.h"
+#include "update.h"
+#include "measurement.h"
+#include "rng.h"
+#include "instrument.h"
+#include "ssa.h"
+
+ssa* malloc_ssa(model* m, double alpha, double gamma) {
+    network* g = m->network;
+    if(g==NULL) {
+        printf("The model has no network, there is no SSA of it!\n");
+        exit(1);
+    }
+
+    int nnode = g->nnode;
+    int nleaf = 1;
+    while(nleaf<nnode) nleaf *= 2;
+
+    ssa* s = (ssa*)malloc(sizeof(ssa));
+    int* state          = (int*)malloc(sizeof(int)*nnode);
+    int* ninfected_nb   = (int*)malloc(sizeof(int)*nnode);
+    double* pressure    = (double*)malloc(sizeof(double)*nnode);
+    double* tree        = (double*)calloc(2*nleaf,sizeof(double));
+    int* adjacency_edge = (int*)malloc(sizeof(int)*(2*(g->nedge)+1));
+    int* pos            = (int*)malloc(sizeof(int)*(nnode+1));
+
+    if(s==NULL || state==NULL || ninfected_nb==NULL || pressure==NULL || tree==NULL || adjacency_edge==NULL || pos==NULL) {
+        printf("memory allocate error : malloc_ssa\n");
+        exit(-1);
+    }
+
+    // the adjacency is filled edge by edge (see read_edgelist), so the
+    // edges are replayed in the same order
+    for(int i=0;i<nnode;i++) pos[i] = g->offset[i];
+    for(int e=0;e<(g->nedge);e++) {
+        adjacency_edge[pos[g->edges[2*e+0]]++] = e;
+        adjacency_edge[pos[g->edges[2*e+1]]++] = e;
+    }
+    free(pos);
+
+    // the edge graphs come first and share the endpoints of g->edges, block
+    // 0 is enough for the infections; the recoveries go on the first block
+    // of single-site graphs
+    int site_bond=-1;
+    for(int t=0;t<(m->ntype) && site_bond<0;t++) {
+        if(bond_hNspin(m,m->type2offset[t])==1) site_bond = m->type2offset[t];
+    }
+    if(site_bond<0 || bond_hNspin(m,0)!=2) {
+        printf("The model has no recovery or no infection graphs, there is no SSA of it!\n");
+        exit(1);
+    }
+
+    s->g = g;
+    s->alpha = alpha;
+    s->gamma = gamma;
+    s->nnode = nnode;
+    s->nleaf = nleaf;
+    s->site_bond = site_bond;
+    s->state = state;
+    s->ninfected_nb = ninfected_nb;
+    s->pressure = pressure;
+    s->tree = tree;
+    s->adjacency_edge = adjacency_edge;
+    s->ninfection = 0;
+    s->nrecover = 0;
+
+    return s;
+}
+
+void free_ssa(ssa* s) {
+    free(s->state);
+    free(s->ninfected_nb);
+    free(s->pressure);
+    free(s->tree);
+    free(s->adjacency_edge);
+    free(s);
+}
+
+// the inner nodes are recomputed from their children, so the sums do not drift
+static void ssa_set_rate(ssa* s, int i) {
+    double rate;
+    if(s->state[i]==1) {
+        rate = (s->gamma)*network_node_recovery(s->g,i);
+    } else {
+        rate = (s->ninfected_nb[i]>0) ? (s->alpha)*(s->pressure[i]) : 0.0;
+    }
+
+    double* tree = s->tree;
+    int k = (s->nleaf)+i;
+    tree[k] = rate;
+    for(k/=2;k>0;k/=2) {
+        tree[k] = tree[2*k]+tree[2*k+1];
+    }
+}
+
+// node with the rate u falls in, u in [0, tree[1])
+static int ssa_draw_node(ssa* s, double u) {
+    double* tree = s->tree;
+    int k=1;
+    while(k<(s->nleaf)) {
+        // a round-off past the left sum never lands on an empty subtree
+        if(u<tree[2*k] || tree[2*k+1]<=0) {
+            k = 2*k;
+        } else {
+            u -= tree[2*k];
+            k = 2*k+1;
+        }
+    }
+    return k-(s->nleaf);
+}
+
+// infected neighbour of i, drawn by the weights of the edges
+static int ssa_draw_infector(ssa* s, int i, gsl_rng* rng) {
+    network* g = s->g;
+    double u = rng_uniform(rng)*(s->pressure[i]);
+    int e=-1;
+
+    for(int k=g->offset[i];k<(g->offset[i+1]);k++) {
+        if(s->state[g->adjacency[k]]!=1) continue;
+        e = s->adjacency_edge[k];
+        u -= network_edge_weight(g,e);
+        if(u<0) break;
+    }
+
+    return e;
+}
+
+// node i changes its state, its rate and the pressure on its neighbours follow
+static void ssa_flip(ssa* s, int i) {
+    network* g = s->g;
+    int sign = -(s->state[i]);
+    s->state[i] = sign;
+
+    for(int k=g->offset[i];k<(g->offset[i+1]);k++) {
+        int j = g->adjacency[k];
+        s->ninfected_nb[j] += sign;
+        s->pressure[j] += sign*network_edge_weight(g,s->adjacency_edge[k]);
+        if(s->ninfected_nb[j]==0) s->pressure[j] = 0;
+        if(s->state[j]==-1) ssa_set_rate(s,j);
+    }
+    ssa_set_rate(s,i);
+}
+
+void ssa_trajectory(ssa* s, world_line* w, gsl_rng* rng) {
+    network* g = s->g;
+    int nnode  = s->nnode;
+    double beta = w->beta;
+
+    for(int i=0;i<nnode;i++) {
+        s->state[i] = w->istate[i];
+        s->ninfected_nb[i] = 0;
+        s->pressure[i] = 0;
+    }
+    for(int i=0;i<nnode;i++) {
+        if(s->state[i]!=1) continue;
+        for(int k=g->offset[i];k<(g->offset[i+1]);k++) {
+            s->ninfected_nb[g->adjacency[k]]++;
+            s->pressure[g->adjacency[k]] += network_edge_weight(g,s->adjacency_edge[k]);
+        }
+    }
+    for(int k=0;k<2*(s->nleaf);k++) s->tree[k] = 0;
+    for(int i=0;i<nnode;i++) ssa_set_rate(s,i);
+
+    // the trajectory is written into sequenceA, kept at the start of the arena when it grows
+    w->flag = 1;
+    w->nvertices = 0;
+    w->nlabel = 0;
+    s->ninfection = 0;
+    s->nrecover = 0;
+
+    double t=0;
+    while(s->tree[1]>0) {
+        t += rng_exponential(rng)/(s->tree[1]);
+        if(t>=beta) break;
+
+        int i = ssa_draw_node(s,rng_uniform(rng)*(s->tree[1]));
+
+        if(w->nvertices==w->length) realloc_world_line(w,2*(w->length));
+        vertex* v = &(w->sequenceA[w->nvertices]);
+        v->tau = t/beta;
+
+        if(s->state[i]==1) {
+            v->bond   = (s->site_bond)+i;
+            v->hNspin = 1;
+            vertex_set_state(v,0,1);
+            vertex_set_state(v,1,-1);
+            s->nrecover++;
+        } else {
+            int e = ssa_draw_infector(s,i,rng);
+            v->bond   = e;
+            v->hNspin = 2;
+            for(int j=0;j<2;j++) {
+                int site = g->edges[2*e+j];
+                vertex_set_state(v,j,s->state[site]);
+                vertex_set_state(v,j+2,(site==i) ? 1 : s->state[site]);
+            }
+            s->ninfection++;
+        }
+        w->nvertices++;
+
+        ssa_flip(s,i);
+    }
+
+    for(int i=0;i<nnode;i++) w->pstate[i] = s->state[i];
+}
+
+int ssa_sample(ssa* s, chain* c, world_line* w, int running_mode, int nif, gsl_rng* rng) {
+    int nnode = s->nnode;
+
+    if(running_mode==1 || running_mode==4) {
+        for(int i=0;i<nnode;i++) w->istate[i] = -1;
+        int i = (int)(rng_uniform(rng)*nnode);
+        if(i==nnode) i = nnode-1;
+        w->istate[i] = 1;
+    }
+
+    ssa_trajectory(s,w,rng);
+    // every site is set now, the next sweep counts them again
+    w->nunset = 0;
+    w->nunset_infected = 0;
+    w->ninitial = -1;
+    c->ninfection = s->ninfection;
+    c->nrecover   = s->nrecover;
+    c->obs_ready  = 0;
+
+    if(running_mode==2) return (ninfected_final_state(w)==0);
+    return (ninfected_initial_state(w)==1 && ninfected_final_state(w)>nif);
+}
+
+void method_pilot(model* m, double alpha, double gamma, double T, int running_mode, int nif, int thermal, int nskip,
+                  int nsweep, unsigned long int seed, double* cost_ssa, double* cost_cpmc) {
+    network* g = m->network;
+    double pnif = ((double)nif)/(g->nnode);
+    int initial_type=0;
+    int final_type=0;
+    int nocheck=0;
+
+    // SSA pilot
+    gsl_rng* rng = gsl_rng_alloc(rng_chain_type());
+    gsl_rng_set(rng,seed);
+    ssa* s = malloc_ssa(m,alpha,gamma);
+    chain* c = malloc_chain();
+    world_line* w = malloc_world_line(4*(m->nsite)+1024,2*(m->mhnspin),m->nsite);
+    running_mode_setup(w,g,running_mode,&initial_type,&final_type,&nocheck);
+    w->beta = T;
+
+    int naccept=0;
+    clock_t start = clock();
+    for(int i=0;i<SSA_PILOT;i++) naccept += ssa_sample(s,c,w,running_mode,nif,rng);
+    double t_trajectory = (double)(clock()-start)/CLOCKS_PER_SEC/SSA_PILOT;
+    *cost_ssa = (naccept>0) ? nsweep*t_trajectory*SSA_PILOT/naccept : HUGE_VAL;
+
+    free_world_line(w);
+    free_chain(c);
+    free_ssa(s);
+
+    // CPMC pilot, on a stream of its own
+    gsl_rng_set(rng,seed+1);
+    c = malloc_chain();
+    w = malloc_world_line(world_line_capacity(m,T),2*(m->mhnspin),m->nsite);
+    running_mode_setup(w,g,running_mode,&initial_type,&final_type,&nocheck);
+    w->beta = T;
+    if(running_mode==3 || running_mode==4) c->condition_nif = nif;
+
+    int npass=0;
+    start = clock();
+    for(int i=0;i<CPMC_PILOT;i++) {
+        sweep(c,w,m,initial_type,final_type,pnif,rng);
+        flip_cluster(c,w,rng);
+        if((ninfected_initial_state(w)==1 && ninfected_final_state(w)>nif) || nocheck) npass++;
+    }
+    double t_sweep = (double)(clock()-start)/CLOCKS_PER_SEC/CPMC_PILOT;
+    double fraction = (npass>0) ? (double)npass/CPMC_PILOT : 1.0/CPMC_PILOT;
+    *cost_cpmc = (thermal+(double)nsweep*nskip/fraction)*t_sweep;
+
+    free_world_line(w);
+    free_chain(c);
+    gsl_rng_free(rng);
+}
+
+void ssa_run(model* m, double alpha, double gamma, double T, int nif, int running_mode, int block_size, int nblock,
+             unsigned long int seed) {
+    int nsweep = nblock*block_size;
+    int initial_type=0;
+    int final_type=0;
+    int nocheck=0;
+
+    gsl_rng* rng = gsl_rng_alloc(rng_chain_type());
+    gsl_rng_set(rng,seed);
+    ssa* s = malloc_ssa(m,alpha,gamma);
+    chain* c = malloc_chain();
+    accumulator* a = malloc_accumulator();
+
+    // a trajectory has far fewer vertices than a sweep, the world-line grows if needed
+    world_line* w = malloc_world_line(4*(m->nsite)+1024,2*(m->mhnspin),m->nsite);
+    running_mode_setup(w,m->network,running_mode,&initial_type,&final_type,&nocheck);
+    w->beta = T;
+
+    double dt = T/100.0;
+    int ntime = (int)(T/dt+1);
+    double* time_list = (double*)malloc(sizeof(double)*ntime);
+    for(int i=0;i<ntime;i++) {
+        time_list[i] = (dt*i)/T;
+    }
+
+    int ntrial=0;
+    progress sample_progress;
+    progress_start(&sample_progress,"ssa",nsweep);
+    for(int i_sweep=0;i_sweep<nsweep;) {
+        ntrial++;
+        if(ssa_sample(s,c,w,running_mode,nif,rng)) {
+            a->ntrial_ave += ntrial;
+            ntrial=0;
+            measurement(c,a,w,m,time_list,ntime,block_size,rng);
+            i_sweep++;
+            progress_update(&sample_progress,i_sweep);
+        }
+    }
+
+    free(time_list);
+    free_world_line(w);
+    free_accumulator(a);
+    free_chain(c);
+    free_ssa(s);
+    gsl_rng_free(rng);
+}
@@ -0,0 +1,122 @@
+#ifndef ssa_h
+#define ssa_h
+
+#include <gsl/gsl_rng.h>
+
+#include "dtype.h"
+#include "networks.h"
+
+/* Number of trajectories of the SSA pilot and sweeps of the CPMC pilot
+** that estimate the cost of a sample for the automatic choice of method.
+*/
+#ifndef SSA_PILOT
+#define SSA_PILOT 1000
+#endif
+
+#ifndef CPMC_PILOT
+#define CPMC_PILOT 200
+#endif
+
+/* Method of a run of main.c: the CPMC chains, the SSA or the cheaper of the
+** two by method_pilot.
+*/
+#define METHOD_CPMC 0
+#define METHOD_SSA  1
+#define METHOD_AUTO 2
+
+/* Exact (Gillespie direct method) simulation of the SIS process of a model.
+** state is the current state of every node, ninfected_nb the number of its
+** infected neighbours and pressure their summed edge weights, so the rate
+** of node i is gamma*recovery_i if it is infected and alpha*pressure_i
+** otherwise. tree is a partial-sum tree over the node rates: leaf i is
+** tree[nleaf+i] and every inner node holds the sum of its two children, so
+** an event is drawn and a rate updated in O(log nnode). adjacency_edge is
+** the edge of every entry of g->adjacency, and site_bond the first bond of
+** the recovery graph, giving the bonds of the vertices of a trajectory.
+*/
+typedef struct ssa {
+    network* g;
+    double alpha;
+    double gamma;
+    int nnode;
+    int nleaf;
+    int site_bond;
+    int* state;
+    int* ninfected_nb;
+    double* pressure;
+    double* tree;
+    int* adjacency_edge;
+    int ninfection;
+    int nrecover;
+} ssa;
+
+ssa* malloc_ssa(model* m, double alpha, double gamma);
+
+void free_ssa(ssa* s);
+
+/**
+ * Simulates one trajectory of the SIS process over [0, w->beta] from the initial state w->istate.
+ *
+ * Parameters:
+ *   s (ssa*): Simulation of the model the world-line belongs to.
+ *   w (world_line*): World-line receiving the trajectory.
+ *   rng (gsl_rng*): Random number generator.
+ *
+ * Behavior:
+ *   - The waiting time is exponential with the total rate at the root of the tree; the node is found by descending
+ *     the tree, the infecting neighbour is drawn proportionally to the edge weights. An event updates the node and
+ *     its neighbours, O(degree log nnode).
+ *   - Every event is written as a vertex at tau = t/beta: an infection on the bond of its edge, the infecting node
+ *     keeping its state, and a recovery on the recovery bond of the node. The world-line grows as needed.
+ *
+ * Outputs:
+ *   - The active sequence of w holds the events in time order, w->pstate the final state; s->ninfection and
+ *     s->nrecover count the events.
+ */
+void ssa_trajectory(ssa* s, world_line* w, gsl_rng* rng);
+
+/**
+ * Draws the initial state of a running mode and simulates a trajectory; returns 1 if the trajectory is a sample
+ * of the conditioned process: a single initial and more than nif final infections (modes 0, 1, 3, 4) or every
+ * node recovered at the end (mode 2).
+ *
+ * Behavior:
+ *   - Patient zero is the node chosen by running_mode_setup in modes 0 and 3 and a uniform node in modes 1 and 4.
+ *   - c->ninfection and c->nrecover are set from the trajectory, so the sample can go through measurement().
+ */
+int ssa_sample(ssa* s, chain* c, world_line* w, int running_mode, int nif, gsl_rng* rng);
+
+/**
+ * Estimates the cost in seconds of a full run of nsweep samples by either method, from short pilots with their own
+ * random number streams.
+ *
+ * Behavior:
+ *   - SSA: SSA_PILOT trajectories give the time per trajectory and the acceptance; the cost is nsweep times their
+ *     ratio, and infinite if no trajectory was accepted.
+ *   - CPMC: CPMC_PILOT sweeps give the time per sweep and the fraction of sweeps that pass the check of main; the
+ *     cost is (thermal + nsweep*nskip/fraction) sweeps.
+ *   - The pilots start from the initial state of the running mode; the CPMC pilot is not thermalized, which
+ *     underestimates the fraction in the conditioned modes.
+ */
+void method_pilot(model* m, double alpha, double gamma, double T, int running_mode, int nif, int thermal, int nskip,
+                  int nsweep, unsigned long int seed, double* cost_ssa, double* cost_cpmc);
+
+/**
+ * Runs the SSA in place of the chains of main.c, with the same measurement.
+ *
+ * Parameters:
+ *   m (model*): Model of the network at (alpha, gamma), only its bond layout and network are used.
+ *   T, nif, running_mode, block_size, nblock, seed: As the arguments of main.c.
+ *
+ * Behavior:
+ *   - Trajectories are drawn until nblock*block_size of them are accepted by ssa_sample; each accepted one goes
+ *     through measurement(), the rejected ones are counted as trials.
+ *
+ * Outputs:
+ *   - The files of measurement() (series.txt, global.txt, ...) in the format of a CPMC run, the average number of
+ *     trials being the number of trajectories per sample.
+ */
+void ssa_run(model* m, double alpha, double gamma, double T, int nif, int running_mode, int block_size, int nblock,
+             unsigned long int seed);
+
+#endif
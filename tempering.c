@@ -0,0 +1,335 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gsl/gsl_rng.h>
+#ifdef USE_MPI
+#include <mpi.h>
+#endif
+
+#include "dtype.h"
+#include "networks.h"
+#include "measurement.h"
+#include "update.h"
+#include "tempering.h"
+
+void tempering_init(int* argc, char*** argv) {
+#ifdef USE_MPI
+    int provided;
+    MPI_Init_thread(argc,argv,MPI_THREAD_SERIALIZED,&provided);
+    if(provided<MPI_THREAD_SERIALIZED) {
+        printf("The MPI library does not support MPI_THREAD_SERIALIZED!\n");
+        MPI_Abort(MPI_COMM_WORLD,1);
+    }
+#endif
+}
+
+void tempering_finalize() {
+#ifdef USE_MPI
+    MPI_Finalize();
+#endif
+}
+
+int tempering_nrank() {
+    int nrank=1;
+#ifdef USE_MPI
+    MPI_Comm_size(MPI_COMM_WORLD,&nrank);
+#endif
+    return nrank;
+}
+
+static int tempering_rank() {
+    int rank=0;
+#ifdef USE_MPI
+    MPI_Comm_rank(MPI_COMM_WORLD,&rank);
+#endif
+    return rank;
+}
+
+// number of values in a comma separated list
+static int list_length(const char* list) {
+    int n=1;
+    for(const char* s=list;*s!='\0';s++) if(*s==',') n++;
+    return n;
+}
+
+// the i-th value of a comma separated list, a single value is shared
+static double list_value(const char* list, int i) {
+    if(list_length(list)==1) return atof(list);
+
+    const char* s=list;
+    for(int k=0;k<i;k++) s = strchr(s,',')+1;
+    return atof(s);
+}
+
+tempering* malloc_tempering(const char* alpha_list, const char* T_list, const char* nif_list, unsigned long int seed) {
+    int nalpha = list_length(alpha_list);
+    int nT     = list_length(T_list);
+    int nnif   = list_length(nif_list);
+    int n = nalpha;
+    if(nT>n) n = nT;
+    if(nnif>n) n = nnif;
+    if((nalpha>1 && nalpha!=n) || (nT>1 && nT!=n) || (nnif>1 && nnif!=n)) {
+        printf("The ladder has %d values of alpha, %d values of T and %d values of nif!\n",nalpha,nT,nnif);
+        exit(1);
+    }
+
+    tempering* t = (tempering*)malloc(sizeof(tempering));
+    t->nreplica = n;
+    t->rank     = tempering_rank();
+    t->nrank    = tempering_nrank();
+
+    t->alpha = (double*)malloc(sizeof(double)*(t->nreplica));
+    t->T     = (double*)malloc(sizeof(double)*(t->nreplica));
+    t->nif   = (int*)malloc(sizeof(int)*(t->nreplica));
+    for(int k=0;k<(t->nreplica);k++) {
+        t->alpha[k] = list_value(alpha_list,k);
+        t->T[k]     = list_value(T_list,k);
+        t->nif[k]   = (int)list_value(nif_list,k);
+    }
+    t->conditioned = 0;
+
+    // contiguous pieces, the first ranks take the remainder
+    n = (t->nreplica)/(t->nrank);
+    int r = (t->nreplica)%(t->nrank);
+    t->nlocal = n+((t->rank)<r);
+    t->offset = (t->rank)*n+(((t->rank)<r) ? (t->rank) : r);
+    if(t->nlocal==0) {
+        printf("The ladder of %d replicas is too short for %d ranks!\n",t->nreplica,t->nrank);
+        exit(1);
+    }
+
+    t->phase = 0;
+    t->nswap   = (unsigned long int*)calloc(t->nreplica,sizeof(unsigned long int));
+    t->naccept = (unsigned long int*)calloc(t->nreplica,sizeof(unsigned long int));
+
+    t->rng = gsl_rng_alloc(gsl_rng_mt19937);
+    gsl_rng_set(t->rng,seed+(t->nreplica)+(t->rank));
+
+    return t;
+}
+
+void free_tempering(tempering* t) {
+    free(t->alpha);
+    free(t->T);
+    free(t->nif);
+    free(t->nswap);
+    free(t->naccept);
+    gsl_rng_free(t->rng);
+    free(t);
+}
+
+int tempering_contains(tempering* t, int k, int ninitial, int nfinal) {
+    if(!(t->conditioned) || t->nif[k]<0) return 1;
+    return (ninitial==1 && nfinal>(t->nif[k]));
+}
+
+void path_statistic(world_line* w, model* m, double* stat) {
+    network* g = m->network;
+    int* pstate = w->pstate;
+    int nnode = w->nsite;
+
+    vertex* sequence = w->sequenceB;
+    if(w->flag)
+        sequence = w->sequenceA;
+
+    // the infected nodes and the edges between an infected and a susceptible
+    // node, counted with their recovery rates and weights on heterogeneous networks
+    double ninfected=0;
+    double nsi=0;
+    for(int i=0;i<nnode;i++) {
+        pstate[i] = w->istate[i];
+        if(pstate[i]==1) ninfected += network_node_recovery(g,i);
+    }
+    for(int e=0;e<(g->nedge);e++) {
+        if(pstate[g->edges[2*e+0]]!=pstate[g->edges[2*e+1]]) nsi += network_edge_weight(g,e);
+    }
+
+    for(int j=0;j<PATH_NSTAT;j++) stat[j]=0;
+
+    double tau_p=0;
+    for(int n=0;n<(w->nvertices);n++) {
+        vertex* v = &(sequence[n]);
+        for(int i_node=0;i_node<(v->hNspin);i_node++) {
+            int i = bond_index(m,v->bond,i_node);
+            int s = vertex_state(v,(v->hNspin)+i_node);
+            if(s==pstate[i]) continue;
+
+            stat[2] += ninfected*((v->tau)-tau_p);
+            stat[3] += nsi*((v->tau)-tau_p);
+            tau_p = v->tau;
+
+            if(s==1) {
+                stat[0]++;
+                ninfected += network_node_recovery(g,i);
+            } else {
+                stat[1]++;
+                ninfected -= network_node_recovery(g,i);
+            }
+            for(int k=(g->offset[i]);k<(g->offset[i+1]);k++) {
+                int j = g->adjacency[k];
+                double weight = (g->adjacency_weight!=NULL) ? g->adjacency_weight[k] : 1.0;
+                nsi += weight*((pstate[j]!=s)-(pstate[j]!=pstate[i]));
+            }
+            pstate[i] = s;
+        }
+    }
+    stat[2] += ninfected*(1.0-tau_p);
+    stat[3] += nsi*(1.0-tau_p);
+}
+
+double path_log_weight(const double* stat, double alpha, double gamma, double T) {
+    return stat[0]*log(alpha*T)+stat[1]*log(gamma*T)-T*(alpha*stat[3]+gamma*stat[2]);
+}
+
+// log of the Metropolis ratio of swapping the paths of the ladder points k and k+1
+static double swap_log_ratio(tempering* t, int k, const double* stat1, const double* stat2, double gamma) {
+    double a1 = t->alpha[k],   T1 = t->T[k];
+    double a2 = t->alpha[k+1], T2 = t->T[k+1];
+    return path_log_weight(stat2,a1,gamma,T1)+path_log_weight(stat1,a2,gamma,T2)
+          -path_log_weight(stat1,a1,gamma,T1)-path_log_weight(stat2,a2,gamma,T2);
+}
+
+#ifdef USE_MPI
+// replace the world-line of this rank by the one of the partner rank;
+// only the active vertices are sent, the next sweep drops the others anyway
+static void exchange_world_line(world_line* w, int partner) {
+    int nsite = w->nsite;
+
+    vertex* sequence = w->sequenceB;
+    if(w->flag)
+        sequence = w->sequenceA;
+
+    int nsend=0;
+    for(int i=0;i<(w->nvertices);i++) {
+        vertex* v = &(sequence[i]);
+        for(int j=0;j<(v->hNspin);j++) {
+            if(vertex_state(v,j)!=vertex_state(v,j+v->hNspin)) {
+                copy_vertex(&(sequence[nsend]),v);
+                nsend++;
+                break;
+            }
+        }
+    }
+
+    int nrecv;
+    MPI_Sendrecv(&nsend,1,MPI_INT,partner,0,&nrecv,1,MPI_INT,partner,0,MPI_COMM_WORLD,MPI_STATUS_IGNORE);
+
+    int* states = (int*)malloc(sizeof(int)*2*nsite);
+    vertex* buffer = (vertex*)malloc(sizeof(vertex)*(nrecv>0 ? nrecv : 1));
+    for(int i=0;i<nsite;i++) {
+        states[i]       = w->istate[i];
+        states[i+nsite] = w->pstate[i];
+    }
+    MPI_Sendrecv_replace(states,2*nsite,MPI_INT,partner,1,partner,1,MPI_COMM_WORLD,MPI_STATUS_IGNORE);
+    MPI_Sendrecv(sequence,nsend*sizeof(vertex),MPI_BYTE,partner,2,
+                 buffer,nrecv*sizeof(vertex),MPI_BYTE,partner,2,MPI_COMM_WORLD,MPI_STATUS_IGNORE);
+
+    w->nvertices = 0;
+    realloc_world_line(w,nrecv);
+    sequence = w->sequenceB;
+    if(w->flag)
+        sequence = w->sequenceA;
+
+    for(int i=0;i<nrecv;i++) copy_vertex(&(sequence[i]),&(buffer[i]));
+    for(int i=0;i<nsite;i++) {
+        w->istate[i] = states[i];
+        w->pstate[i] = states[i+nsite];
+    }
+    w->nvertices = nrecv;
+    w->ninitial  = -1;
+
+    free(states);
+    free(buffer);
+}
+
+// the pair (k,k+1) split over this rank and partner, lower is set on the rank holding k
+static void swap_remote(tempering* t, world_line* w, model* m, double gamma, int k, int partner, int lower) {
+    double stat[2*PATH_NSTAT];
+    int count[4];
+    int accept=0;
+
+    path_statistic(w,m,stat);
+    count[0] = ninfected_initial_state(w);
+    count[1] = ninfected_final_state(w);
+
+    MPI_Sendrecv(stat,PATH_NSTAT,MPI_DOUBLE,partner,3,stat+PATH_NSTAT,PATH_NSTAT,MPI_DOUBLE,partner,3,
+                 MPI_COMM_WORLD,MPI_STATUS_IGNORE);
+    MPI_Sendrecv(count,2,MPI_INT,partner,5,count+2,2,MPI_INT,partner,5,MPI_COMM_WORLD,MPI_STATUS_IGNORE);
+    if(lower) {
+        double r = swap_log_ratio(t,k,stat,stat+PATH_NSTAT,gamma);
+        accept = (r>=0 || gsl_rng_uniform_pos(t->rng)<exp(r));
+        accept = accept && tempering_contains(t,k+1,count[0],count[1]) && tempering_contains(t,k,count[2],count[3]);
+        t->nswap[k]++;
+        t->naccept[k] += accept;
+        MPI_Send(&accept,1,MPI_INT,partner,4,MPI_COMM_WORLD);
+    } else {
+        MPI_Recv(&accept,1,MPI_INT,partner,4,MPI_COMM_WORLD,MPI_STATUS_IGNORE);
+    }
+
+    if(accept) exchange_world_line(w,partner);
+}
+#endif
+
+void tempering_swap(tempering* t, world_line** ws, model** ms, double gamma) {
+    int first = t->offset;
+    int last  = t->offset+t->nlocal-1;
+
+    // the path statistics and the exchanges read the states of every site
+    for(int i=0;i<(t->nlocal);i++) world_line_settle(ws[i],t->rng);
+
+#ifdef USE_MPI
+    // the pair with the lower rank first, so the exchanges pass along the ranks
+    if(first>0 && (first-1)%2==(t->phase))
+        swap_remote(t,ws[0],ms[0],gamma,first-1,t->rank-1,0);
+#endif
+
+    double stat1[PATH_NSTAT],stat2[PATH_NSTAT];
+    for(int k=first+(((t->phase)+first)%2);k<last;k+=2) {
+        int i = k-first;
+        // path_statistic leaves pstate as the final state, which it is already
+        path_statistic(ws[i],ms[i],stat1);
+        path_statistic(ws[i+1],ms[i+1],stat2);
+
+        double r = swap_log_ratio(t,k,stat1,stat2,gamma);
+        int accept = (r>=0 || gsl_rng_uniform_pos(t->rng)<exp(r));
+        accept = accept && tempering_contains(t,k+1,ninfected_initial_state(ws[i]),ninfected_final_state(ws[i]))
+                        && tempering_contains(t,k,ninfected_initial_state(ws[i+1]),ninfected_final_state(ws[i+1]));
+        t->nswap[k]++;
+        if(accept) {
+            world_line* w = ws[i];
+            ws[i]   = ws[i+1];
+            ws[i+1] = w;
+            t->naccept[k]++;
+        }
+    }
+
+#ifdef USE_MPI
+    if(last<(t->nreplica)-1 && last%2==(t->phase))
+        swap_remote(t,ws[t->nlocal-1],ms[t->nlocal-1],gamma,last,t->rank+1,1);
+#endif
+
+    for(int i=0;i<(t->nlocal);i++) ws[i]->beta = t->T[first+i];
+    t->phase = !(t->phase);
+}
+
+int tempering_all_done(tempering* t, int done) {
+#ifdef USE_MPI
+    int all;
+    MPI_Allreduce(&done,&all,1,MPI_INT,MPI_LAND,MPI_COMM_WORLD);
+    return all;
+#else
+    return done;
+#endif
+}
+
+void tempering_report(tempering* t) {
+    int last = t->offset+t->nlocal-1;
+    if(last==(t->nreplica)-1) last--;
+    for(int k=(t->offset);k<=last;k++) {
+        double ratio = 0;
+        if(t->nswap[k]>0) ratio = ((double)(t->naccept[k]))/(t->nswap[k]);
+        printf("swap (alpha,T,nif) = (%.6lf,%.6lf,%d) <-> (%.6lf,%.6lf,%d) : %lu / %lu = %.6lf\n",
+               t->alpha[k],t->T[k],t->nif[k],t->alpha[k+1],t->T[k+1],t->nif[k+1],t->naccept[k],t->nswap[k],ratio);
+    }
+}
@@ -0,0 +1,145 @@
+#ifndef tempering_h
+#define tempering_h
+
+#include <gsl/gsl_rng.h>
+
+#include "dtype.h"
+
+/* Number of path statistics entering the weight of a world-line, see
+** path_statistic.
+*/
+#define PATH_NSTAT 4
+
+/* Ladder of (alpha, T, nif) replicas for parallel tempering. The ladder
+** points offset ... offset+nlocal-1 belong to this MPI rank, one world-line
+** each. Without MPI there is a single rank holding the whole ladder.
+** Neighbouring points k and k+1 propose to swap their world-lines, with the
+** even pairs and the odd pairs in turn (phase); nswap and naccept count the
+** proposals of pair k on the rank holding point k. With conditioned set
+** (running modes 3 and 4) point k only holds world-lines with a single
+** initial infection and more than nif[k] final ones, a negative nif[k]
+** holds any.
+*/
+typedef struct tempering {
+    int nreplica;
+    int nlocal;
+    int offset;
+    int rank;
+    int nrank;
+    double* alpha;
+    double* T;
+    int* nif;
+    int conditioned;
+    int phase;
+    unsigned long int* nswap;
+    unsigned long int* naccept;
+    gsl_rng* rng;
+} tempering;
+
+/**
+ * Starts MPI if the program is built with USE_MPI, otherwise does nothing.
+ *
+ * Parameters:
+ *   argc (int*), argv (char***): Arguments of main, passed to MPI_Init_thread.
+ *
+ * Behavior:
+ *   - MPI is started with MPI_THREAD_SERIALIZED; the exchanges between ranks are made by one OpenMP thread at a time.
+ */
+void tempering_init(int* argc, char*** argv);
+
+/**
+ * Stops MPI if the program is built with USE_MPI, otherwise does nothing.
+ */
+void tempering_finalize();
+
+/**
+ * Returns the number of MPI ranks, 1 without USE_MPI.
+ */
+int tempering_nrank();
+
+/**
+ * Sets up the ladder of replicas from the command-line values of alpha, T and nif.
+ *
+ * Parameters:
+ *   alpha_list (const char*): Comma separated values of alpha, e.g. "0.40,0.45,0.50".
+ *   T_list (const char*): Comma separated values of T.
+ *   nif_list (const char*): Comma separated thresholds of the final number of infections, e.g. "-1,10,20,30".
+ *   seed (unsigned long int): Seed of the run; the swap decisions of rank r use the stream seeded with seed+nreplica+r.
+ *
+ * Behavior:
+ *   - A single value is used for every point of the ladder, otherwise the lists need the same length.
+ *   - conditioned starts as 0, the caller sets it for the running modes 3 and 4.
+ *   - The ladder is split into contiguous pieces over the MPI ranks, the first nreplica%nrank ranks hold one point
+ *     more. Exits with an error if a rank would hold no point.
+ *
+ * Outputs:
+ *   - The ladder, released with free_tempering.
+ */
+tempering* malloc_tempering(const char* alpha_list, const char* T_list, const char* nif_list, unsigned long int seed);
+
+void free_tempering(tempering* t);
+
+/**
+ * Returns 1 if point k of the ladder holds a world-line with ninitial infected nodes in the initial and nfinal in the
+ * final state, see tempering.
+ */
+int tempering_contains(tempering* t, int k, int ninitial, int nfinal);
+
+/**
+ * Computes the statistics of a world-line that its weight depends on beyond the configuration itself.
+ *
+ * Parameters:
+ *   w (world_line*): World-line with its active sequence; w->pstate is used as scratch and ends as the final state.
+ *   m (model*): Model of the world-line, for the sites of the bonds and the network.
+ *   stat (double*): PATH_NSTAT values written by the function.
+ *
+ * Behavior:
+ *   - Walks the vertex sequence from istate and counts the infections (stat[0]) and recoveries (stat[1]), and
+ *     integrates the number of infected nodes (stat[2]) and of edges between an infected and a susceptible
+ *     node (stat[3]) over the time fraction 0 ... 1. On a network with heterogeneous rates the nodes count with
+ *     their recovery rate and the edges with their weight; the rates of the single events cancel in the swaps.
+ */
+void path_statistic(world_line* w, model* m, double* stat);
+
+/**
+ * Returns the logarithm of the weight of a path with the statistics stat at (alpha, gamma, T), up to the factors
+ * that do not depend on the parameters: the path has the infection rate alpha on every edge between an infected and
+ * a susceptible node and the recovery rate gamma on every infected node for the time T.
+ */
+double path_log_weight(const double* stat, double alpha, double gamma, double T);
+
+/**
+ * Proposes to swap the world-lines of the neighbouring ladder points of one phase and moves to the other phase.
+ *
+ * Parameters:
+ *   t (tempering*): Ladder of the run.
+ *   ws (world_line**): World-lines of the local ladder points; the pointers of accepted local swaps are exchanged.
+ *   ms (model**): Models of the local ladder points.
+ *   gamma (double): Recovery rate, shared by the ladder.
+ *
+ * Behavior:
+ *   - A swap of the points k and k+1 is accepted with the Metropolis probability of the path weights before and
+ *     after the swap. The conditioning of the running mode does not depend on (alpha, T) and cancels; with
+ *     conditioned set, a swap is rejected unless both world-lines are held by the points they move to
+ *     (tempering_contains). A ladder of nif thus passes the large outbreaks of the high thresholds down to the
+ *     low ones and back, instead of a single chain that can not leave them.
+ *   - For a pair split over two ranks the lower rank takes the decision, and an accepted swap sends the initial
+ *     and final states and the active vertices of the world-lines to the other rank.
+ *   - The sites the last flips left unset are drawn first with the swap stream (world_line_settle), the path
+ *     statistics need the state of every site.
+ *   - Sets beta of every world-line to T of the point it ends up at.
+ *   - Called by a single thread; with MPI, every rank has to call it the same number of times.
+ */
+void tempering_swap(tempering* t, world_line** ws, model** ms, double gamma);
+
+/**
+ * Returns 1 if done is set on every rank, for the end of the measurement of all ladder points.
+ */
+int tempering_all_done(tempering* t, int done);
+
+/**
+ * Prints the swap acceptance ratio of the pairs counted on this rank.
+ */
+void tempering_report(tempering* t);
+
+#endif
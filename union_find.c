@@ -8,6 +8,17 @@ int root(int* p, int v) {
     return v;
 }
 
+int root_count(int* p, int v, long long* steps) {
+    long long n=0;
+    while(p[v]!=v) {
+        v = p[v];
+        n++;
+    }
+    *steps += n;
+
+    return v;
+}
+
 static void compress(int* p, int v, int r) {
     int s;
     while(p[v]!=v)  {
@@ -3,6 +3,9 @@
 
 int root(int* p, int v);
 
+// root() that adds the number of parent steps it takes to steps
+int root_count(int* p, int v, long long* steps);
+
 void merge(int* p, int* w, int va, int vb);
 
 int root_parallel(int* p, int v);
@@ -2,133 +2,237 @@
 #include <stdlib.h>
 #include <math.h>
 #include <gsl/gsl_rng.h>
+#include <gsl/gsl_randist.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "dtype.h"
 #include "union_find.h"
-
-//#define weighted_sampling
-
-#ifdef weighted_sampling
-static int weighted_sampling(double* cmf, int length, gsl_rng* rng) {
-    double dis = gsl_rng_uniform_pos(rng)*cmf[length-1];
-
-    int i = -1;
-    int j = length;
-    int d = j-1;
-
-    while(d>1) {
-        if(dis>cmf[i+d/2]){
-            i = i+d/2;
-        } else {
-            j = i+d/2;
-        }
-        d = j-i;
-    }
-
-    return j;
+#include "networks.h"
+#include "output.h"
+#include "rng.h"
+#include "instrument.h"
+#include "update.h"
+
+// draw a bond with an implicit bond table from u uniform in [0, m->sweight):
+// the type from the cumulative weights of the ntype sampled types, then the
+// bond from what is left of u, as all bonds of a type carry the same weight
+static inline int implicit_bond_sampling(const model* m, int ntype, double u) {
+    int nedge      = m->nedge;
+    int ntype_edge = m->ntype_edge;
+    double* cmf    = m->type2cmf;
+
+    int t=0;
+    while((t<ntype-1) && (u>=cmf[t])) t++;
+
+    int count = (t<ntype_edge) ? nedge : m->nsite;
+    double base = (t>0) ? cmf[t-1] : 0.0;
+    int k = (int)((u-base)/(m->type2weight[t]));
+    if(k>=count) k=count-1;
+
+    if(t<ntype_edge) return t*nedge+k;
+    return ntype_edge*nedge+(t-ntype_edge)*(m->nsite)+k;
 }
-#endif
 
 /**
  * This function samples a sequence of times uniformly over the interval [0, 1), associating each time with a bond index
- * based on their weights. The sampling is adjusted by a scaling factor to account for variations in bond weights, optimizing
- * the distribution of sampling times within the given interval.
+ * drawn with probability proportional to its weight. The bonds are drawn from the alias table built with the model, so
+ * every sampled time produces a candidate and no draw is rejected.
  *
  * Parameters:
- *   m (model*): Pointer to the model structure containing bond weights and total number of bonds.
+ *   c (chain*): Pointer to the chain holding the insertion buffers.
+ *   m (model*): Pointer to the model structure containing the alias table and total number of bonds.
  *   lam (double): The average number of events expected in the interval, used to scale the number of samples.
  *   start (double): The starting point of the interval for sampling.
  *   rng (gsl_rng*): Pointer to a GSL random number generator used for generating random values.
  *
  * Behavior:
- *   - Initializes the maximum and average bond weights if they are not already set.
  *   - Resizes the sampling arrays if the capacity is exceeded, ensuring there is enough space for new samples.
- *   - Samples times and bond indices based on exponential distribution scaled by the maximum weight divided by the average weight.
+ *   - Samples times from the exponential distribution with rate lam (the gaps -log(u) come from rng_exponential), and for each time a bond from the alias table
+ *     using a single uniform number (its integer part picks the column, its fractional part decides the alias).
+ *   - With an implicit bond table the same uniform number picks the type from the cumulative type weights and then
+ *     the bond inside the type, see implicit_bond_sampling.
  *   - Continues sampling until the sum of sampled times exceeds 1.0 or the capacity of the array is reached.
  *   - Adjusts the capacity of the arrays if the number of generated samples exceeds their initial capacity.
  *
  * Outputs:
- *   - Fills the global arrays `insert_seq` and `insert_bond` with sampled times and bond indices respectively.
- *   - Updates the `insert_len` to reflect the number of entries added to the arrays during the sampling.
+ *   - Fills the chain's arrays `insert_seq` and `insert_bond` with sampled times and bond indices respectively.
+ *   - Updates the chain's `insert_len` to reflect the number of entries added to the arrays during the sampling.
  */
-static double* insert_seq;
-static int* insert_bond;
-static int insert_len=0;
-static int insert_cap=0;
-static double d_ave=-1;
-static double d_max=-1;
-static void uniform_sequence_sampling(model* m, double lam, double start, gsl_rng* rng) {
-    if(d_max<0){
-        d_max = 0;
-        d_ave = 0;
-        for(int i=0;i<(m->nbond);i++) {
-            d_ave += m->bond2weight[i];
-            if((m->bond2weight[i])>d_max)
-                d_max = m->bond2weight[i];
-        }
-        d_ave = d_ave/(m->nbond);
+void uniform_sequence_sampling(chain* c, model* m, double lam, double start, gsl_rng* rng) {
+    if(c->insert_cap==0) {
+        c->insert_cap = (int)(lam+sqrt(lam)*10+1024);
+        c->insert_seq  = (double*)malloc(sizeof(double)*c->insert_cap);
+        c->insert_bond = (int*)malloc(sizeof(int)*c->insert_cap);
     }
 
-    if(insert_cap==0) {
-        insert_cap = (int)(lam+sqrt(lam)*10+1024);
-        insert_seq  = (double*)malloc(sizeof(double)*insert_cap);
-        insert_bond = (int*)malloc(sizeof(int)*insert_cap);
-    }
-
-    lam = lam*d_max/d_ave;
+    int nbond = m->nbond;
+    double* prob = m->alias_prob;
+    int* alias   = m->alias;
+    int implicit = m->implicit;
+    int ntype    = 0;
+    if(implicit) ntype = m->ntype_edge+(nbond-(m->ntype_edge)*(m->nedge))/(m->nsite);
 
     double k=0;
     int n=0;
     int bond;
+    double u;
 
-    double dis = gsl_rng_uniform_pos(rng);
-    k -= log(dis)/lam;
-    while((k<1.0) && (n<insert_cap)) {
-        bond = gsl_rng_uniform_pos(rng)*(m->nbond);
-        if(gsl_rng_uniform_pos(rng)*d_max<(m->bond2weight[bond])){
-            insert_seq[n]  = k+start;
-            insert_bond[n] = bond;
-            n++;
+    k += rng_exponential(rng)/lam;
+    while((k<1.0) && (n<c->insert_cap)) {
+        if(implicit) {
+            bond = implicit_bond_sampling(m,ntype,rng_uniform(rng)*(m->sweight));
+        } else {
+            u    = rng_uniform(rng)*nbond;
+            bond = (int)u;
+            if((u-bond)>=prob[bond]) bond = alias[bond];
         }
 
-        dis = gsl_rng_uniform_pos(rng);
-        k -= log(dis)/lam;
+        c->insert_seq[n]  = k+start;
+        c->insert_bond[n] = bond;
+        n++;
+
+        k += rng_exponential(rng)/lam;
     }
     while(k<1.0) {
-        dis = gsl_rng_uniform_pos(rng);
-        k -= log(dis)/lam;
+        k += rng_exponential(rng)/lam;
         n++;
     }
-    insert_len = n;
-    if(n>insert_cap) {
+    c->insert_len = n;
+    if(n>c->insert_cap) {
         double* seq = (double*)malloc(sizeof(double)*n*2);
         int* bond   = (int*)malloc(sizeof(int)*n*2);
-        for(int i=0;i<insert_cap;i++){
-            seq[i]  = insert_seq[i];
-            bond[i] = insert_bond[i];
+        for(int i=0;i<c->insert_cap;i++){
+            seq[i]  = c->insert_seq[i];
+            bond[i] = c->insert_bond[i];
         }
-        free(insert_seq);
-        insert_seq  = seq;
-        insert_bond = bond;
-        insert_len = insert_cap;
-        insert_cap = n*2;
+        free(c->insert_seq);
+        free(c->insert_bond);
+        c->insert_seq  = seq;
+        c->insert_bond = bond;
+        c->insert_len = c->insert_cap;
+        c->insert_cap = n*2;
+        c->count.reallocs++;
     }
 }
 
-static int ninfection=0;
-static int nrecover=0;
+// the set sites infected in istate are the front of infected_order
+static inline void infected_set(world_line* w, int i, int s) {
+    int k = w->infected_slot[i];
+    int n = w->ninfected_set;
+    if(s==1 && k>=n) {
+        int j = w->infected_order[n];
+        w->infected_order[k] = j;
+        w->infected_slot[j]  = k;
+        w->infected_order[n] = i;
+        w->infected_slot[i]  = n;
+        w->ninfected_set = n+1;
+    } else if(s!=1 && k<n) {
+        int j = w->infected_order[n-1];
+        w->infected_order[k]   = j;
+        w->infected_slot[j]    = k;
+        w->infected_order[n-1] = i;
+        w->infected_slot[i]    = n-1;
+        w->ninfected_set = n-1;
+    }
+}
 
-double ninfection_value() {
-    return ninfection;
+// the unset site i gets the state s and moves in front of the unset sites
+static void site_settle_state(world_line* w, int i, int s) {
+    int a = (w->nsite)-(w->nunset);
+    int k = w->site_slot[i];
+    int j = w->site_order[a];
+    w->site_order[k] = j;
+    w->site_slot[j]  = k;
+    w->site_order[a] = i;
+    w->site_slot[i]  = a;
+
+    w->nunset--;
+    w->nunset_infected -= (s==1);
+    w->istate[i] = s;
+    w->pstate[i] = s;
+    infected_set(w,i,s);
 }
 
-double nrecover_value() {
-    return nrecover;
+// the unset site i is infected with the share of infected ones among them
+static void site_settle(world_line* w, int i, gsl_rng* rng) {
+    int n    = w->nunset;
+    int ninf = w->nunset_infected;
+    int s    = -1;
+    if(ninf==n || (ninf>0 && rng_uniform_pos(rng)*n<ninf)) s = 1;
+    site_settle_state(w,i,s);
 }
 
-void remove_vertices(world_line* w) {
+// the sites of a candidate on bond get their states before it reads them
+static inline void bond_settle(world_line* w, model* m, int bond, int hNspin, gsl_rng* rng) {
+    for(int j=0;j<hNspin;j++) {
+        int i = bond_index(m,bond,j);
+        if(site_is_unset(w,i)) site_settle(w,i,rng);
+    }
+}
+
+void world_line_settle(world_line* w, gsl_rng* rng) {
+    int n = w->nunset;
+    if(n==0) return;
+
+    // the infected ones are a uniform choice among the unset sites, a
+    // partial shuffle of the end of site_order picks them
+    int nsite  = w->nsite;
+    int a      = nsite-n;
+    int ninf   = w->nunset_infected;
+    int* order = w->site_order;
+    int* slot  = w->site_slot;
+    for(int k=0;k<ninf;k++) {
+        int r = a+k+(int)(rng_uniform_pos(rng)*(n-k));
+        if(r>=nsite) r = nsite-1;
+        int i = order[r];
+        order[r]   = order[a+k];
+        slot[order[r]] = r;
+        order[a+k] = i;
+        slot[i]    = a+k;
+    }
+    for(int k=a;k<nsite;k++) {
+        int i = order[k];
+        w->istate[i] = (k<a+ninf) ? 1 : -1;
+        w->pstate[i] = w->istate[i];
+        infected_set(w,i,w->istate[i]);
+    }
+    w->nunset = 0;
+    w->nunset_infected = 0;
+}
+
+// pstate starts from istate; an untouched site holds it already, so only the
+// active sites of the last world-line are copied. After the states were set
+// otherwise every site is copied and counted once.
+static void sweep_states_begin(world_line* w, gsl_rng* rng) {
+    int* istate = w->istate;
+    int* pstate = w->pstate;
+    if(w->ninitial<0) {
+        world_line_settle(w,rng);
+        int n=0;
+        for(int i=0;i<(w->nsite);i++) {
+            pstate[i] = istate[i];
+            infected_set(w,i,istate[i]);
+            n += (istate[i]==1);
+        }
+        w->ninitial = n;
+    } else {
+        for(int k=0;k<(w->nactive);k++) {
+            int i = w->site_order[k];
+            pstate[i] = istate[i];
+        }
+    }
+    w->nfinal = w->ninitial;
+}
+
+void remove_vertices(chain* c, world_line* w) {
     vertex* v;
 
+    // the boundaries do not change a state, they go with the idle vertices
+    w->nboundary_initial = 0;
+    w->nboundary_final = 0;
+
     vertex* sequence1 = w->sequenceB;
     vertex* sequence2 = w->sequenceA;
     if(w->flag) {
@@ -136,8 +240,9 @@ void remove_vertices(world_line* w) {
         sequence2 = w->sequenceB;
     }
 
-    ninfection=0;
-    nrecover=0;
+    c->ninfection=0;
+    c->nrecover=0;
+    c->obs_ready=0;
 
     int check_delete;
     int i,j,k;
@@ -147,7 +252,7 @@ void remove_vertices(world_line* w) {
         check_delete = 1;
 
         for(j=0;j<(v->hNspin);j++) {
-            if(v->state[j]!=v->state[j+v->hNspin])
+            if(vertex_state(v,j)!=vertex_state(v,j+v->hNspin))
                 check_delete = 0;
         }
 
@@ -156,72 +261,52 @@ void remove_vertices(world_line* w) {
             k++;
 
             if(v->hNspin==1) {
-                nrecover++;
+                c->nrecover++;
             } else if(v->hNspin==2) {
-                ninfection++;
+                c->ninfection++;
             }
         }
     }
+    c->count.removed += (w->nvertices)-k;
     w->nvertices = k;
     w->flag = !(w->flag);
 }
 
-void swapping_graphs(world_line* w, model* m, gsl_rng* rng) {
-    int nnode = m->nsite;
-    int nedge = (m->nbond-3*nnode)/7;
-    vertex* v;
+// redraw the type of v among the candidates of its type, on the same edge or site
+static void swap_graph(vertex* v, model* m, gsl_rng* rng) {
+    int type  = bond_type(m,v->bond);
+    int first = m->swap_offset[type];
+    int n     = m->swap_offset[type+1]-first;
+    if(n==0) return;
+
+    int k = (int)(rng_uniform_pos(rng)*n);
+    if(k>=n) k=n-1;
+    int type2 = m->swap_type[first+k];
+    v->bond += m->type2offset[type2]-m->type2offset[type];
+}
 
+void swapping_graphs(chain* c, world_line* w, model* m, gsl_rng* rng) {
     vertex* sequence = w->sequenceB;
     if(w->flag) 
         sequence = w->sequenceA;
 
     for(int i=0;i<(w->nvertices);i++) {
-        v = &(sequence[i]);
-
-        // swap between type (1,3,5) or (2,4,6)
-        int type = m->bond2type[v->bond];
-        if((type==1 || type==3) || type==5) {
-            int i_edge = (v->bond) % nedge;
-            double random_value = gsl_rng_uniform_pos(rng)*3.0;
-            if(random_value<1.0) {
-                v->bond = i_edge + nedge*1;
-            } else if(random_value<2.0) {
-                v->bond = i_edge + nedge*3;
-            } else {
-                v->bond = i_edge + nedge*5;
-            }
-        } else if((type==2 || type==4) || type==6) {
-            int i_edge = (v->bond) % nedge;
-            double random_value = gsl_rng_uniform_pos(rng)*3.0;
-            if(random_value<1.0) {
-                v->bond = i_edge + nedge*2;
-            } else if(random_value<2.0) {
-                v->bond = i_edge + nedge*4;
-            } else {
-                v->bond = i_edge + nedge*6;
-            }
-        }
-
-        // swap between type (7,8)
-        else if(type==7) {
-            if(gsl_rng_uniform_pos(rng)<0.5) {
-                v->bond += nnode;
-            }
-        } else if(type==8) {
-            if(gsl_rng_uniform_pos(rng)<0.5) {
-                v->bond -= nnode;
-            }
-        }
+        swap_graph(&(sequence[i]),m,rng);
     }
 
 }
 
-void insert_vertices(world_line* w, model* m, gsl_rng* rng) {
+void insert_vertices(chain* c, world_line* w, model* m, gsl_rng* rng) {
     double lam = (m->sweight)*(w->beta);
 
-    uniform_sequence_sampling(m,lam,0,rng);
+    uniform_sequence_sampling(c,m,lam,0,rng);
+
+    double* insert_seq = c->insert_seq;
+    int* insert_bond   = c->insert_bond;
+    int  insert_len    = c->insert_len;
 
-    int length = insert_cap+w->nvertices;
+    int length = c->insert_cap+w->nvertices;
+    if(length>(w->length)) c->count.reallocs++;
     realloc_world_line(w,length);
 
     vertex* sequence1 = w->sequenceB;
@@ -231,20 +316,22 @@ void insert_vertices(world_line* w, model* m, gsl_rng* rng) {
         sequence2 = w->sequenceB;
     }
 
+    sweep_states_begin(w,rng);
+
     int* pstate = w->pstate;
+#if INSTRUMENT_VALIDATE
     int  nsite = w->nsite;
-
-    for(int i=0;i<nsite;i++) pstate[i] = w->istate[i];
+#endif
 
     vertex* v;
     int n,i,k,i_site,index;
     double tau1,tau2;
 
-    int mhnspin = m->mhnspin;
-    int lstate[mhnspin];
+    int lstate[MHNSPIN];
 
     k=0;
     n=0;
+    c->count.candidates += insert_len;
 
     tau1 = 0;
     if(w->nvertices!=0) tau1 = (sequence1[0]).tau;
@@ -255,32 +342,34 @@ void insert_vertices(world_line* w, model* m, gsl_rng* rng) {
         while((tau1<tau2) && (k<(w->nvertices))) {
             v = &(sequence1[k]);
             for(i_site=0;i_site<(v->hNspin);i_site++) {
-                index = m->bond2index[v->bond*mhnspin+i_site];
-#if 0
+                index = bond_index(m,v->bond,i_site);
+#if INSTRUMENT_VALIDATE
                 if(index<0 || index>=nsite) {
                     printf("index = %d \n",index);
                     printf("------- vertex information ------- \n");
                     printf("tau    = %.16lf \n",v->tau);
                     printf("bond   = %d \n",v->bond);
                     printf("hNspin (w) = %d \n",v->hNspin);
-                    printf("hNspin (m) = %d \n",m->bond2hNspin[v->bond]);
+                    printf("hNspin (m) = %d \n",bond_hNspin(m,v->bond));
 
                     printf("state (");
                     for(int i_state=0;i_state<2*(v->hNspin);i_state++) {
-                        printf(" %d",v->state[i_state]);
+                        printf(" %d",vertex_state(v,i_state));
                     }
                     printf(")\n");
 
                     printf("indices (");
                     for(int i_state=0;i_state<(v->hNspin);i_state++) {
-                        printf(" %d",m->bond2index[v->bond*mhnspin+i_state]);
+                        printf(" %d",bond_index(m,v->bond,i_state));
                     }
                     printf(")\n");
 
                     exit(-1);
                 }
 #endif
-                pstate[index] = v->state[v->hNspin+i_site];
+                w->nfinal -= (pstate[index]==1);
+                pstate[index] = vertex_state(v,v->hNspin+i_site);
+                w->nfinal += (pstate[index]==1);
             }
 
             copy_vertex(&(sequence2[n]),v);
@@ -294,23 +383,26 @@ void insert_vertices(world_line* w, model* m, gsl_rng* rng) {
 
         if(tau1!=tau2) {
             int bond     = insert_bond[i];
-            int t        = m->bond2type[bond];
-            int hNspin   = m->bond2hNspin[bond];
-            insert_rule rule = m->insert[t];
+            int t        = bond_type(m,bond);
+            int hNspin   = bond_hNspin(m,bond);
+            int packed   = 0;
+            if(w->nunset>0) bond_settle(w,m,bond,hNspin,rng);
 
             for(i_site=0;i_site<hNspin;i_site++) { 
-                index = m->bond2index[bond*mhnspin+i_site];
+                index = bond_index(m,bond,i_site);
                 lstate[i_site] = pstate[index];
+                packed |= (lstate[i_site]==1)<<i_site;
             }
 
-            if(rule(lstate)) {
+            if(insert_accept(m,t,packed)) {
+                c->count.accepted++;
                 (sequence2[n]).tau    = tau2;
                 (sequence2[n]).bond   = bond;
                 (sequence2[n]).hNspin = hNspin;
 
                 for(i_site=0;i_site<hNspin;i_site++) {
-                    (sequence2[n]).state[i_site]        = lstate[i_site];
-                    (sequence2[n]).state[i_site+hNspin] = lstate[i_site];
+                    vertex_set_state(&(sequence2[n]),i_site,lstate[i_site]);
+                    vertex_set_state(&(sequence2[n]),i_site+hNspin,lstate[i_site]);
                 }
 
                 n++;
@@ -319,7 +411,15 @@ void insert_vertices(world_line* w, model* m, gsl_rng* rng) {
     }
 
     while(k<(w->nvertices)) {
-        copy_vertex(&(sequence2[n]),&(sequence1[k]));
+        v = &(sequence1[k]);
+        for(i_site=0;i_site<(v->hNspin);i_site++) {
+            index = bond_index(m,v->bond,i_site);
+            w->nfinal -= (pstate[index]==1);
+            pstate[index] = vertex_state(v,v->hNspin+i_site);
+            w->nfinal += (pstate[index]==1);
+        }
+
+        copy_vertex(&(sequence2[n]),v);
         n++;
         k++;
     }
@@ -328,56 +428,332 @@ void insert_vertices(world_line* w, model* m, gsl_rng* rng) {
     w->flag = !(w->flag);
 }
 
-void clustering(world_line* w, model* m) {
-    vertex* v;
-    int bond,hNspin,t,idn,idp;
-    int i,j,index;
-    int mnspin = w->mnspin;
-    int nsite = w->nsite;
-    int* rule;
-    int* indices;
+/* The pin at tau=0: type 0 pins every site, type 1 the susceptible sites
+** except a random neighbour of a single patient zero, and none without an
+** infected site. Only the pin is decided here, a site gets its boundary leg
+** with its first vertex (see site_pinned_initial), so this does not visit
+** the sites.
+*/
+static void initial_boundary_sites(world_line* w, model* m, int type, gsl_rng* rng) {
+    w->pin_initial = type;
+    w->pin_free    = -1;
+    if(type!=1) return;
+
+    if(w->ninitial==0) {
+        w->pin_free = -2;
+    } else if(w->ninitial==1) {
+        // patient zero may be unset, the other unset sites are susceptible then
+        if(w->ninfected_set==0) {
+            int n = w->nunset;
+            int r = (w->nsite)-n+(int)(rng_uniform_pos(rng)*n);
+            if(r>=(w->nsite)) r = (w->nsite)-1;
+            site_settle_state(w,w->site_order[r],1);
+        }
+        int i_node = w->infected_order[0];
+        int j;
+        do {
+            j = nearest_nb_random_assign(m->network,i_node,rng);
+        } while(j==i_node);
+        if(site_is_unset(w,j)) site_settle_state(w,j,-1);
+        w->pin_free = j;
+    }
+}
 
-    int* first = w->first;
-    int* last  = w->last;
+/* The pin at tau=1 by the final states: type 0 pins every site, type 1 the
+** infected sites as long as there are at most p*nnode of them, type 2 the
+** susceptible ones. The number of infected sites is counted by the sweep,
+** the legs are linked to the active sites only (see site_pinned_final).
+*/
+static void final_boundary_sites(world_line* w, model* m, double p, int type) {
+    w->pin_final = type;
+    w->pin_final_infected = (type==1) && ((w->nfinal)<=p*(m->nsite));
+}
+
+void boundary_condition_initial_state(chain* c, world_line* w, model* m, int type, gsl_rng* rng) {
+    initial_boundary_sites(w,m,type,rng);
+}
+
+void boundary_condition_final_state(chain* c, world_line* w, model* m, double p, int type, gsl_rng* rng) {
+    final_boundary_sites(w,m,p,type);
+}
+
+// site i gets its first leg, it moves from the untouched sites to the end of the active ones
+static inline void activate_site(world_line* w, int i) {
+    int k = w->site_slot[i];
+    int n = w->nactive;
+    int j = w->site_order[n];
+
+    w->site_order[k] = j;
+    w->site_slot[j]  = k;
+    w->site_order[n] = i;
+    w->site_slot[i]  = n;
+    w->nactive = n+1;
+}
+
+// unlink the active sites, the others have first = last = -1 already
+static void reset_sites(world_line* w) {
+    for(int k=0;k<(w->nactive);k++) {
+        int i = w->site_order[k];
+        w->first[i] = -1;
+        w->last[i]  = -1;
+    }
+    w->nactive = 0;
+    w->nboundary_initial = 0;
+    w->nboundary_final = 0;
+}
+
+// a boundary leg stands for the type-10 vertex of its site, a fixed
+// cluster with the weight of that vertex's root leg
+static int boundary_weight(model* m) {
+    int t = bond_type(m,m->nbond);
+    return m->link[4*(m->mhnspin)*t+2];
+}
+
+// site i gets its first leg id: it becomes active, and a site pinned at tau=0
+// starts with its boundary leg, which id is merged to
+static void site_first_leg(world_line* w, model* m, int i, int id) {
+    activate_site(w,i);
+    if(site_pinned_initial(w,i)) {
+        int idb = boundary_leg_initial(w,i);
+        w->cluster[idb] = idb;
+        w->weight[idb]  = boundary_weight(m);
+        w->boundary_site[w->nboundary_initial++] = i;
+        w->first[i] = idb;
+        merge(w->cluster,w->weight,idb,id);
+    } else {
+        w->first[i] = id;
+    }
+}
 
-    for(i=0;i<nsite;i++) {
-        last[i]  = -1;
-        first[i] = -1;
+// link the legs of the i-th vertex by the rules of its graph and attach
+// them to the end of the world-lines of its sites, as tracked by first/last
+static inline void link_vertex_legs(world_line* w, model* m, vertex* v, int i, int* first, int* last, int hNspin) {
+    int j,idn,idp,index;
+    int mnspin  = w->mnspin;
+    int bond    = v->bond;
+    int t       = bond_type(m,bond);
+    int* rule    = &(m->link[4*(m->mhnspin)*t]);
+
+    for(j=0;j<2*hNspin;j++) {
+        idn = i*mnspin+j;
+        idp = i*mnspin+rule[j];
+        w->cluster[idn] = idp;
+        w->weight[idn]  = rule[2*hNspin+j];
+    }
+
+    for(j=0;j<hNspin;j++) {
+        index = bond_index(m,bond,j);
+        idp = i*mnspin+j;
+        idn = i*mnspin+j+hNspin;
+        if(first[index]==-1) {
+            if(first==w->first) site_first_leg(w,m,index,idp);
+            else first[index] = idp;
+            last[index]  = idn;
+        } else {
+            merge(w->cluster,w->weight,last[index],idp);
+            last[index] = idn;
+        }
+    }
+}
+
+static void link_vertex(world_line* w, model* m, vertex* v, int i, int* first, int* last) {
+    VERTEX_KERNEL(v->hNspin,link_vertex_legs,w,m,v,i,first,last);
+}
+
+// the tau=1 boundary is linked after the vertices, to the active sites pinned there
+static void link_boundary_final(world_line* w, model* m) {
+    int weight = boundary_weight(m);
+    int* site  = &(w->boundary_site[w->nsite]);
+    int n = 0;
+    for(int k=0;k<(w->nactive);k++) {
+        int i = w->site_order[k];
+        if(!site_pinned_final(w,i)) continue;
+        int id = boundary_leg_final(w,i);
+        w->cluster[id] = id;
+        w->weight[id]  = weight;
+        merge(w->cluster,w->weight,w->last[i],id);
+        w->last[i] = id;
+        site[n++] = i;
+    }
+    w->nboundary_final = n;
+}
+
+void chain_threads(chain* c, int nthread, gsl_rng* rng) {
+    if(c->rngs!=NULL) {
+        for(int i=0;i<(c->nthread);i++) gsl_rng_free(c->rngs[i]);
+        free(c->rngs);
+    }
+    free(c->tfirst);
+    free(c->tlast);
+    free(c->tcount);
+
+    // the streams of the threads are seeded from the stream of the chain
+    c->rngs = (gsl_rng**)malloc(sizeof(gsl_rng*)*nthread);
+    for(int i=0;i<nthread;i++) {
+        c->rngs[i] = gsl_rng_alloc(rng_chain_type());
+        gsl_rng_set(c->rngs[i],gsl_rng_get(rng));
+    }
+
+    c->nthread = nthread;
+    c->tfirst  = NULL;
+    c->tlast   = NULL;
+    c->tcount  = (int*)malloc(sizeof(int)*(nthread+1));
+}
+
+/* The vertices are split into nthread chunks along tau. Each thread links
+** its chunk with the serial merge, keeping its own first/last per site;
+** the union-find trees it builds only contain legs of that chunk. The
+** chunks are then stitched pairwise, (0,1),(2,3),... then (0-1,2-3),...,
+** by merging the last leg of a site in the left region with its first leg
+** in the right one. Every merge still touches only legs of the pair being
+** stitched, so the serial merge and its signed weights stay valid without
+** atomics. Thread 0 works on w->first/w->last, which end up global.
+*/
+static void clustering_parallel(chain* c, world_line* w, model* m) {
+    int nsite = w->nsite;
+    int nvertices = w->nvertices;
+
+    if(c->tfirst==NULL) {
+        c->tfirst = (int*)malloc(sizeof(int)*nsite*(c->nthread));
+        c->tlast  = (int*)malloc(sizeof(int)*nsite*(c->nthread));
     }
 
     vertex* sequence = w->sequenceB;
     if(w->flag) 
         sequence = w->sequenceA;
 
-    for(i=0;i<(w->nvertices);i++) {
-        v       = &(sequence[i]);
-        bond    = v->bond;
-        hNspin  = v->hNspin;
-        t       = m->bond2type[bond];
-        rule    = &(m->link[4*(m->mhnspin)*t]);
-        indices = &(m->bond2index[bond*(m->mhnspin)]);
+#ifdef _OPENMP
+#pragma omp parallel num_threads(c->nthread)
+#endif
+    {
+        int t=0;
+        int nt=1;
+#ifdef _OPENMP
+        t  = omp_get_thread_num();
+        nt = omp_get_num_threads();
+#endif
+        int* first = w->first;
+        int* last  = w->last;
+        if(t!=0) {
+            first = &(c->tfirst[t*nsite]);
+            last  = &(c->tlast[t*nsite]);
+            for(int i=0;i<nsite;i++) {
+                last[i]  = -1;
+                first[i] = -1;
+            }
+        } else {
+            reset_sites(w);
+        }
 
-        for(j=0;j<2*hNspin;j++) {
-            idn = i*mnspin+j;
-            idp = i*mnspin+rule[j];
-            w->cluster[idn] = idp;
-            w->weight[idn]  = rule[2*hNspin+j];
+        int i0 = (int)(((long)nvertices*t)/nt);
+        int i1 = (int)(((long)nvertices*(t+1))/nt);
+        for(int i=i0;i<i1;i++) {
+            link_vertex(w,m,&(sequence[i]),i,first,last);
         }
 
-        for(j=0;j<hNspin;j++) {
-            index = indices[j];
-            idp = i*mnspin+j;
-            idn = i*mnspin+j+hNspin;
-            if(first[index]==-1) {
-                first[index] = idp;
-                last[index]  = idn;
-            } else {
-                merge(w->cluster,w->weight,last[index],idp);
-                last[index] = idn;
+        for(int step=1;step<nt;step*=2) {
+#ifdef _OPENMP
+#pragma omp barrier
+#endif
+            if((t%(2*step))==0 && (t+step)<nt) {
+                int* first_r = &(c->tfirst[(t+step)*nsite]);
+                int* last_r  = &(c->tlast[(t+step)*nsite]);
+                for(int i=0;i<nsite;i++) {
+                    if(first_r[i]==-1) continue;
+
+                    if(last[i]==-1) {
+                        if(first==w->first) site_first_leg(w,m,i,first_r[i]);
+                        else first[i] = first_r[i];
+                    } else {
+                        merge(w->cluster,w->weight,last[i],first_r[i]);
+                    }
+                    last[i] = last_r[i];
+                }
             }
         }
     }
 
+    link_boundary_final(w,m);
+}
+
+static inline void label_leg(world_line* w, int idv, int* nlabel, int* nfree, long long* steps) {
+    int* label = w->label;
+    int idr = root_count(w->cluster,idv,steps);
+    if(label[idr]==-1) {
+        label[idr] = *nlabel;
+        w->cweight[*nlabel] = w->weight[idr];
+        *nfree += (w->weight[idr]>0);
+        (*nlabel)++;
+    }
+    label[idv] = label[idr];
+}
+
+/* Flattens the union-find forest into dense labels, one root() walk per
+** leg here instead of one in every later pass over the clusters. The
+** clusters are numbered in the order their first leg appears, which is the
+** order the flips used to visit them, so the random numbers are drawn in
+** the same order. The tau=0 boundary legs come before the vertices and the
+** tau=1 legs after them, where their vertices used to be. The walks and
+** the clusters go to the counters of the chain.
+*/
+static void cluster_label(chain* c, world_line* w) {
+    int mnspin = w->mnspin;
+    int* label = w->label;
+    int* final = &(w->boundary_site[w->nsite]);
+    int nlabel = 0;
+    int nfree  = 0;
+    int nleg   = (w->nboundary_initial)+(w->nboundary_final);
+    long long steps = 0;
+
+    vertex* sequence = w->sequenceB;
+    if(w->flag) 
+        sequence = w->sequenceA;
+
+    for(int k=0;k<(w->nboundary_initial);k++) label[boundary_leg_initial(w,w->boundary_site[k])] = -1;
+    for(int k=0;k<(w->nboundary_final);k++) label[boundary_leg_final(w,final[k])] = -1;
+    for(int i=0;i<(w->nvertices);i++) {
+        int hNspin = sequence[i].hNspin;
+        for(int j=0;j<2*hNspin;j++) label[i*mnspin+j] = -1;
+    }
+
+    for(int k=0;k<(w->nboundary_initial);k++) label_leg(w,boundary_leg_initial(w,w->boundary_site[k]),&nlabel,&nfree,&steps);
+    for(int i=0;i<(w->nvertices);i++) {
+        int hNspin = sequence[i].hNspin;
+        for(int j=0;j<2*hNspin;j++) label_leg(w,i*mnspin+j,&nlabel,&nfree,&steps);
+        nleg += 2*hNspin;
+    }
+    for(int k=0;k<(w->nboundary_final);k++) label_leg(w,boundary_leg_final(w,final[k]),&nlabel,&nfree,&steps);
+
+    w->nlabel = nlabel;
+    c->count.legs          += nleg;
+    c->count.root_steps    += steps;
+    c->count.clusters      += nlabel;
+    c->count.free_clusters += nfree;
+}
+
+void clustering(chain* c, world_line* w, model* m) {
+    if(c->nthread>1) {
+        clustering_parallel(c,w,m);
+        cluster_label(c,w);
+        return;
+    }
+
+    int i;
+    int* first = w->first;
+    int* last  = w->last;
+
+    reset_sites(w);
+
+    vertex* sequence = w->sequenceB;
+    if(w->flag) 
+        sequence = w->sequenceA;
+
+    for(i=0;i<(w->nvertices);i++) {
+        link_vertex(w,m,&(sequence[i]),i,first,last);
+    }
+    link_boundary_final(w,m);
+    cluster_label(c,w);
+
 /*  disable for open boundary
 **  for(i=0;i<nsite;i++) {
 **      if(first[i]!=-1) {
@@ -387,77 +763,280 @@ void clustering(world_line* w, model* m) {
 */
 }
 
-int  cluster_statistic_length=0;
-int  cluster_statistic_counter=0;
-int* cluster_statistic_count=NULL;
-int* cluster_statistic_fcluster=NULL;
-int* cluster_statistic_infection=NULL;
-double* cluster_statistic_taus=NULL;
-double* cluster_statistic_infection_size=NULL;
-void cluster_statistic(world_line* w, model* m) {
-    int idv,idr,i,j,index;
+// a vertex is kept only if it changes the state of at least one leg
+static inline int vertex_changes_state(const vertex* v, int hNspin) {
+    for(int j=0;j<hNspin;j++) {
+        if(vertex_state(v,j)!=vertex_state(v,j+hNspin))
+            return 1;
+    }
+    return 0;
+}
+
+static int vertex_is_active(vertex* v) {
+    return VERTEX_KERNEL(v->hNspin,vertex_changes_state,v);
+}
+
+// the sites of a kept vertex take the states above it, it returns the change
+// of the number of infected sites
+static inline int vertex_advance_state(model* m, const vertex* v, int* pstate, int hNspin) {
+    int d=0;
+    for(int j=0;j<hNspin;j++) {
+        int index = bond_index(m,v->bond,j);
+        d -= (pstate[index]==1);
+        pstate[index] = vertex_state(v,hNspin+j);
+        d += (pstate[index]==1);
+    }
+    return d;
+}
+
+// a candidate on bond carries the current states of its sites on both sides,
+// returned packed as insert_accept reads them
+static inline int vertex_candidate_state(model* m, vertex* v, int bond, const int* pstate, int hNspin) {
+    int packed=0;
+    for(int j=0;j<hNspin;j++) {
+        int state = pstate[bond_index(m,bond,j)];
+        vertex_set_state(v,j,state);
+        vertex_set_state(v,j+hNspin,state);
+        packed |= (state==1)<<j;
+    }
+    return packed;
+}
+
+void sweep(chain* c, world_line* w, model* m, int initial_type, int final_type, double p, gsl_rng* rng) {
+#ifdef USE_PERF
+    if(c->perf_fd[0]==-2) counters_perf_open(c);
+#endif
+    uniform_sequence_sampling(c,m,(m->sweight)*(w->beta),0,rng);
+
+    double* insert_seq = c->insert_seq;
+    int* insert_bond   = c->insert_bond;
+    int  insert_len    = c->insert_len;
+
+    // the kept vertices and the candidates, the boundaries have legs of their own
+    int length = c->insert_cap+(w->nvertices);
+    if(length>(w->length)) c->count.reallocs++;
+    realloc_world_line(w,length);
+
+    vertex* sequence1 = w->sequenceB;
+    vertex* sequence2 = w->sequenceA;
+    if(w->flag) {
+        sequence1 = w->sequenceA;
+        sequence2 = w->sequenceB;
+    }
+
+    // the candidates settle the unset sites they read, the others stay unset
+    sweep_states_begin(w,rng);
+    int* pstate = w->pstate;
+    reset_sites(w);
+
+    c->ninfection=0;
+    c->nrecover=0;
+    c->obs_ready=0;
+
+    vertex* v;
+    int i,k;
+    int nvertices = w->nvertices;
+
+    // with several threads the clusters are built after the merge
+    int link = (c->nthread<=1);
+
+    int n = 0;
+    int naccepted = 0;
+    initial_boundary_sites(w,m,initial_type,rng);
+
+    // first kept vertex of the old sequence
+    k=0;
+    while(k<nvertices && !vertex_is_active(&(sequence1[k]))) k++;
+
+    double tau1 = 0;
+    if(k<nvertices) tau1 = (sequence1[k]).tau;
+
+    for(i=0;i<insert_len;i++) {
+        double tau2 = insert_seq[i];
+
+        while((tau1<tau2) && (k<nvertices)) {
+            v = &(sequence1[k]);
+            if(v->hNspin==1) {
+                c->nrecover++;
+            } else if(v->hNspin==2) {
+                c->ninfection++;
+            }
+
+            swap_graph(v,m,rng);
+            w->nfinal += VERTEX_KERNEL(v->hNspin,vertex_advance_state,m,v,pstate);
+
+            copy_vertex(&(sequence2[n]),v);
+            if(link) link_vertex(w,m,&(sequence2[n]),n,w->first,w->last);
+            n++;
+
+            k++;
+            while(k<nvertices && !vertex_is_active(&(sequence1[k]))) k++;
+            if(k<nvertices) tau1 = (sequence1[k]).tau;
+        }
+
+        if(tau1!=tau2) {
+            // the candidate is written in the next free slot, which a rejection leaves free
+            int bond     = insert_bond[i];
+            int hNspin   = bond_hNspin(m,bond);
+            v = &(sequence2[n]);
+            if(w->nunset>0) bond_settle(w,m,bond,hNspin,rng);
+            int packed   = VERTEX_KERNEL(hNspin,vertex_candidate_state,m,v,bond,pstate);
+
+            if(insert_accept(m,bond_type(m,bond),packed)) {
+                v->tau    = tau2;
+                v->bond   = bond;
+                v->hNspin = hNspin;
+
+                if(link) link_vertex(w,m,v,n,w->first,w->last);
+                n++;
+                naccepted++;
+            }
+        }
+    }
+
+    while(k<nvertices) {
+        v = &(sequence1[k]);
+        if(v->hNspin==1) {
+            c->nrecover++;
+        } else if(v->hNspin==2) {
+            c->ninfection++;
+        }
+
+        swap_graph(v,m,rng);
+        w->nfinal += VERTEX_KERNEL(v->hNspin,vertex_advance_state,m,v,pstate);
+
+        copy_vertex(&(sequence2[n]),v);
+        if(link) link_vertex(w,m,&(sequence2[n]),n,w->first,w->last);
+        n++;
+
+        k++;
+        while(k<nvertices && !vertex_is_active(&(sequence1[k]))) k++;
+    }
+
+    final_boundary_sites(w,m,p,final_type);
+
+    // the old vertices that are not kept are dropped by the merge
+    c->count.sweeps++;
+    c->count.candidates += insert_len;
+    c->count.accepted   += naccepted;
+    c->count.removed    += nvertices-(n-naccepted);
+
+    w->nvertices = n;
+    if(link) link_boundary_final(w,m);
+    w->flag = !(w->flag);
+
+    if(link) cluster_label(c,w);
+    else clustering(c,w,m);
+}
+
+// counts the cluster of leg idv the first time one of its legs is met
+static void cluster_statistic_leg(chain* c, world_line* w, int idv, int* ncluster, int* nfree, int* size, int* size_free) {
+    int idr = w->label[idv];
+    if(c->cstat_count[idr]) {
+        (*ncluster)++;
+
+        if(w->cweight[idr]>0) {
+            (*nfree)++;
+            *size_free += w->cweight[idr];
+            *size += w->cweight[idr];
+        } else {
+            *size -= w->cweight[idr];
+        }
+
+        c->cstat_count[idr]=0;
+    }
+}
+
+// the untouched sites are pinned without a boundary leg, their legs are
+// counted from the pins and the infected ones are infected all the time
+static void untouched_sites_pins(const world_line* w, int* npin_initial, int* npin_final, int* ninfected) {
+    int nuntouched = (w->nsite)-(w->nactive);
+    int infected = w->ninitial;
+    for(int k=0;k<(w->nactive);k++) infected -= (w->istate[w->site_order[k]]==1);
+    int susceptible = nuntouched-infected;
+
+    *npin_initial = 0;
+    if(w->pin_initial==0) *npin_initial = nuntouched;
+    if(w->pin_initial==1 && w->pin_free!=-2) {
+        *npin_initial = susceptible;
+        if(w->pin_free>=0 && w->site_slot[w->pin_free]>=(w->nactive)) (*npin_initial)--;
+    }
+
+    *npin_final = 0;
+    if(w->pin_final==0) *npin_final = nuntouched;
+    if(w->pin_final==1 && w->pin_final_infected) *npin_final = infected;
+    if(w->pin_final==2) *npin_final = susceptible;
+
+    *ninfected = infected;
+}
+
+FILE* cluster_statistic_stream() {
+    return output_stream("cluster_statistic.txt","a");
+}
+
+void cluster_statistic(chain* c, world_line* w, model* m) {
+    int idv,i,j,index;
     int bond,hNspin;
     double tau;
-    int* indices;
-    int* state;
     vertex* v = NULL;
 
     int nsite = w->nsite;
     int mnspin = w->mnspin;
-    int length = w->length;
+    int nleg = (w->length)*mnspin+2*nsite;
 
-    if(cluster_statistic_taus==NULL) {
-        cluster_statistic_taus = (double*)malloc(sizeof(double)*nsite);
+    if(c->cstat_taus==NULL) {
+        c->cstat_taus = (double*)malloc(sizeof(double)*nsite);
 
-        if(cluster_statistic_taus==NULL) {
+        if(c->cstat_taus==NULL) {
             printf("Memory Allocating Error : update.c (cluster_statistic)\n");
             exit(-1);
         }
 
-        cluster_statistic_infection_size = (double*)malloc(sizeof(double)*nsite);
+        c->cstat_infection_size = (double*)malloc(sizeof(double)*nsite);
 
-        if(cluster_statistic_infection_size==NULL) {
+        if(c->cstat_infection_size==NULL) {
             printf("Memory Allocating Error : update.c (cluster_statistic)\n");
             exit(-1);
         }
 
-        cluster_statistic_fcluster = (int*)malloc(sizeof(int)*nsite);
+        c->cstat_fcluster = (int*)malloc(sizeof(int)*nsite);
 
-        if(cluster_statistic_fcluster==NULL) {
+        if(c->cstat_fcluster==NULL) {
             printf("Memory Allocating Error : update.c (cluster_statistic)\n");
             exit(-1);
         }
 
-        cluster_statistic_infection = (int*)malloc(sizeof(int)*nsite);
+        c->cstat_infection = (int*)malloc(sizeof(int)*nsite);
 
-        if(cluster_statistic_infection==NULL) {
+        if(c->cstat_infection==NULL) {
             printf("Memory Allocating Error : update.c (cluster_statistic)\n");
             exit(-1);
         }
     }
 
-    int* fcluster = cluster_statistic_fcluster;
-    int* isize = cluster_statistic_infection;
-    for(i=0;i<nsite;i++) {
-        fcluster[i] = 0;
-        isize[i] = 0;
+    // only the sites with a leg are marked, the others are never read
+    int* fcluster = c->cstat_fcluster;
+    int* isize = c->cstat_infection;
+    for(i=0;i<(w->nactive);i++) {
+        fcluster[w->site_order[i]] = 0;
+        isize[w->site_order[i]] = 0;
     }
 
-    if(length*mnspin>cluster_statistic_length) {
-        cluster_statistic_length = length*mnspin;
-        if(cluster_statistic_count!=NULL)
-            free(cluster_statistic_count);
+    if(nleg>c->cstat_length) {
+        c->cstat_length = nleg;
+        if(c->cstat_count!=NULL)
+            free(c->cstat_count);
 
-        cluster_statistic_count = (int*)malloc(sizeof(int)*cluster_statistic_length);
+        c->cstat_count = (int*)malloc(sizeof(int)*c->cstat_length);
 
-        if(cluster_statistic_count==NULL) {
+        if(c->cstat_count==NULL) {
             printf("Memory Allocating Error : update.c (cluster_statistic)\n");
             exit(-1);
         }
     }
 
-    for(i=0;i<cluster_statistic_length;i++) {
-        cluster_statistic_count[i] = 1;
+    for(i=0;i<(w->nlabel);i++) {
+        c->cstat_count[i] = 1;
     }
 
     vertex* sequence = w->sequenceB;
@@ -470,133 +1049,582 @@ void cluster_statistic(world_line* w, model* m) {
     int size_of_cluster=0;
     double cluster_size_in_time=0;
     double infection_size_in_time=0;
+
+    // the tau=0 boundary legs are fixed, an infected pinned site starts its infection at 0
+    for(i=0;i<(w->nboundary_initial);i++) {
+        index = w->boundary_site[i];
+        cluster_statistic_leg(c,w,boundary_leg_initial(w,index),&number_of_cluster,&number_of_free_cluster,
+                              &size_of_cluster,&size_of_free_cluster);
+        if(w->istate[index]==1) {
+            c->cstat_infection_size[index] = 0;
+            isize[index] = 1;
+        }
+    }
+
     for(i=0;i<(w->nvertices);i++) {
         v       = &(sequence[i]);
         tau     = v->tau;
         bond    = v->bond;
         hNspin  = v->hNspin;
-        indices = &(m->bond2index[bond*(m->mhnspin)]);
-        state   = v->state;
 
         for(j=0;j<2*hNspin;j++) {
-            idv = i*mnspin+j;
-            idr = root(w->cluster,idv);
-            if(cluster_statistic_count[idr]) {
-                number_of_cluster++;
-
-                if(w->weight[idr]>0) {
-                    number_of_free_cluster++;
-                    size_of_free_cluster += w->weight[idr];
-                    size_of_cluster += w->weight[idr];
-                } else {
-                    size_of_cluster -= w->weight[idr];
-                }
-
-                cluster_statistic_count[idr]=0;
-            }
+            cluster_statistic_leg(c,w,i*mnspin+j,&number_of_cluster,&number_of_free_cluster,
+                                  &size_of_cluster,&size_of_free_cluster);
         }
 
         for(j=0;j<hNspin;j++) {
-            index = indices[j];
+            index = bond_index(m,bond,j);
             idv = i*mnspin+j+hNspin;
 
             if(fcluster[index]) {
-                cluster_size_in_time += (tau - cluster_statistic_taus[index]);
+                cluster_size_in_time += (tau - c->cstat_taus[index]);
                 fcluster[index] = 0;
             }
 
-            idr = root(w->cluster,idv);
-            if(w->weight[idr]>0) {
-                cluster_statistic_taus[index] = tau;
+            if(w->cweight[w->label[idv]]>0) {
+                c->cstat_taus[index] = tau;
                 fcluster[index] = 1;
             }
 
             if(isize[index]) {
-                infection_size_in_time += (tau - cluster_statistic_infection_size[index]);
+                infection_size_in_time += (tau - c->cstat_infection_size[index]);
                 isize[index] = 0;
             }
 
-            if(state[j+hNspin]==1) {
-                cluster_statistic_infection_size[index] = tau;
+            if(vertex_state(v,j+hNspin)==1) {
+                c->cstat_infection_size[index] = tau;
                 isize[index] = 1;
             }
         }
     }
     
+    // the tau=1 boundary legs close the segments of their sites
+    for(i=0;i<(w->nboundary_final);i++) {
+        index = w->boundary_site[nsite+i];
+        cluster_statistic_leg(c,w,boundary_leg_final(w,index),&number_of_cluster,&number_of_free_cluster,
+                              &size_of_cluster,&size_of_free_cluster);
+        if(fcluster[index]) {
+            cluster_size_in_time += (1.0 - c->cstat_taus[index]);
+            fcluster[index] = 0;
+        }
+        if(isize[index]) {
+            infection_size_in_time += (1.0 - c->cstat_infection_size[index]);
+            isize[index] = 0;
+        }
+    }
+    
+    int npin_initial,npin_final,ninfected_untouched;
+    untouched_sites_pins(w,&npin_initial,&npin_final,&ninfected_untouched);
+    infection_size_in_time += ninfected_untouched;
+
+    c->cstat_counter++;
+#if INSTRUMENT_DEBUG
     double ratio1 = ((double)number_of_free_cluster)/((double)number_of_cluster);
     double ratio2 = ((double)size_of_free_cluster)/((double)size_of_cluster);
-    cluster_statistic_counter++;
     printf("---------------------------------------------------\n");
-    printf("n = %d \n", cluster_statistic_counter);
+    printf("n = %d \n", c->cstat_counter);
     printf("number of cluster = %d, number of free cluster = %d, ratio = %.16lf \n",number_of_cluster,number_of_free_cluster,ratio1);
     printf("size of cluster = %d, size of free cluster = %d, ratio = %.16lf \n",size_of_cluster,size_of_free_cluster,ratio2);
     printf("size of cluster (t) = %lf\n",cluster_size_in_time);
     printf("infection size in time (t) = %lf\n",infection_size_in_time);
+#endif
+
+    FILE* sfile = cluster_statistic_stream();
+    // the boundaries are counted as the vertices they stand for
+    int nvertices = (w->nvertices)+(w->nboundary_initial)+(w->nboundary_final)+npin_initial+npin_final;
+    fprintf(sfile,"%.12e %.12e %d \n", cluster_size_in_time, infection_size_in_time, nvertices);
+}
+
+void running_mode_setup(world_line* w, network* g, int running_mode, int* initial_type, int* final_type, int* nocheck) {
+    if(running_mode==0 || running_mode==1 || running_mode==3 || running_mode==4) {
+        for(int i=0;i<(w->nsite);i++) w->istate[i] = -1;
+        w->istate[nearest_nb_arg_max_degree(g)]=1;
+        //w->istate[71]=1;
+    } else if(running_mode==2) {
+        for(int i=0;i<(w->nsite);i++) w->istate[i] = 1;
+    }
+    w->nunset   = 0;
+    w->ninitial = -1;
+
+    if(running_mode==0 || running_mode==3) {
+        *initial_type=0;
+        *final_type=1;
+        *nocheck=0;
+    } else if(running_mode==1 || running_mode==4) {
+        *initial_type=1;
+        *final_type=1;
+        *nocheck=0;
+    } else if(running_mode==2) {
+        *initial_type=0;
+        *final_type=2;
+        *nocheck=1;
+    } else {
+        printf("There is no such running mode %d!\n",running_mode);
+        exit(1);
+    }
+}
+
+void chain_observe(chain* c, model* m, double* time_list, int ntime) {
+    free(c->obs_state);
+    free(c->obs_since);
+    free(c->obs_ratio);
+
+    c->obs_model     = m;
+    c->obs_time_list = time_list;
+    c->obs_ntime = ntime;
+    c->obs_ready = 0;
+    c->obs_state = (int*)malloc(sizeof(int)*(m->nsite));
+    c->obs_since = (double*)malloc(sizeof(double)*(m->nsite));
+    c->obs_ratio = (double*)malloc(sizeof(double)*ntime);
+
+    if(c->obs_state==NULL || c->obs_since==NULL || c->obs_ratio==NULL) {
+        printf("Memory Allocating Error : update.c (chain_observe)\n");
+        exit(-1);
+    }
+}
+
+/* The observables of the flipped world-line, recorded while flip_cluster
+** goes through the vertices: obs_state is the state of every active site
+** from the initial state on, ninfected the number of infected sites, and the
+** infected time is added up leg by leg from obs_since, the time a site got
+** its current state. An untouched site keeps its state, each infected one
+** adds 1. I/N at slice k is ninfected/nsite when the first vertex after
+** time_list[k] is reached, as measurement() replayed it. w->ninitial has to
+** count the initial state istate already.
+*/
+static void observe_begin(chain* c, const world_line* w, const int* istate, int* slice, int* ninfected) {
+    int nactive_infected=0;
+    for(int k=0;k<(w->nactive);k++) {
+        int i = w->site_order[k];
+        c->obs_state[i] = istate[i];
+        c->obs_since[i] = 0;
+        nactive_infected += (istate[i]==1);
+    }
+    *slice = 0;
+    *ninfected = w->ninitial;
+    c->obs_infected_time = (w->ninitial)-nactive_infected;
+    c->obs_tau = 0;
+}
+
+// the sites of v change the states at tau, their infected times follow
+static inline void observe_legs(chain* c, const vertex* v, double tau, int* ninfected, int hNspin) {
+    int* state    = c->obs_state;
+    double* since = c->obs_since;
+    for(int j=0;j<hNspin;j++) {
+        int index = bond_index(c->obs_model,v->bond,j);
+        if(state[index]==1) {
+            c->obs_infected_time += (tau-since[index]);
+            (*ninfected)--;
+        }
+        state[index] = vertex_state(v,hNspin+j);
+        if(state[index]==1) {
+            since[index] = tau;
+            (*ninfected)++;
+        }
+    }
+}
+
+static inline void observe_vertex(chain* c, vertex* v, int nsite, int* slice, int* ninfected) {
+    if(*slice>=(c->obs_ntime)) return;
+
+    double tau = v->tau;
+    // the gap before a vertex can span several slices
+    while(*slice<(c->obs_ntime) && c->obs_time_list[*slice]<tau) {
+        c->obs_ratio[*slice] = (double)(*ninfected)/nsite;
+        (*slice)++;
+    }
+
+    VERTEX_KERNEL(v->hNspin,observe_legs,c,v,tau,ninfected);
+
+#if INSTRUMENT_VALIDATE
+    if((c->obs_tau)>tau) printf("tau_p > tau!\n");
+    else if(tau<0) printf("tau < 0!\n");
+    else if(tau>1) printf("tau > 1!\n");
+#endif
+    c->obs_tau = tau;
+}
+
+static void observe_end(chain* c, const world_line* w, int slice, int ninfected) {
+    for(int k=0;k<(w->nactive);k++) {
+        int i = w->site_order[k];
+        if(c->obs_state[i]==1) c->obs_infected_time += (1.0-c->obs_since[i]);
+    }
+    for(;slice<(c->obs_ntime);slice++) c->obs_ratio[slice] = (double)ninfected/(w->nsite);
+    c->obs_ready = 1;
+}
+
+// a separate pass for the flips that do not go through the vertices in order
+static void observe_world_line(chain* c, world_line* w) {
+    int slice=0,ninfected=0;
+    vertex* sequence = w->sequenceB;
+    if(w->flag) 
+        sequence = w->sequenceA;
+
+    observe_begin(c,w,w->istate,&slice,&ninfected);
+    for(int i=0;i<(w->nvertices);i++) observe_vertex(c,&(sequence[i]),w->nsite,&slice,&ninfected);
+    observe_end(c,w,slice,ninfected);
+}
+
+// the legs of a vertex in the clusters that flip (cweight 0) change their states
+static inline void vertex_flip_legs(vertex* v, const int* label, const int* cweight, int hNspin) {
+    for(int j=0;j<2*hNspin;j++) {
+        if(cweight[label[j]]==0) vertex_flip_state(v,j);
+    }
+}
+
+/* The untouched sites free at both ends by the pins of the last sweep get a
+** fresh state from tau=0 to tau=1: all of them without an infected site,
+** otherwise the free neighbour of patient zero and the infected sites that
+** are not pinned at tau=1. The states of the set ones are drawn into state
+** and listed in fresh_site, the unset ones only get their number of
+** infected sites, by a binomial draw. Returns the number of infected
+** untouched sites after the draw, untouched_infected before it; the world-
+** line takes them with untouched_sites_apply.
+*/
+static int untouched_sites_draw(world_line* w, int* state, int untouched_infected, gsl_rng* rng) {
+    int nactive = w->nactive;
+    w->nfresh = 0;
+    w->fresh_unset = w->nunset;
+    w->fresh_unset_infected = w->nunset_infected;
+    if(w->pin_initial!=1 || w->pin_final==0) return untouched_infected;
+
+    // no infected site: the untouched sites are susceptible, all of them unset afresh
+    if(w->pin_free==-2) {
+        if(w->pin_final==2) return untouched_infected;
+        int n = (w->nsite)-nactive;
+        w->fresh_unset = n;
+        w->fresh_unset_infected = (n>0) ? (int)gsl_ran_binomial(rng,0.5,n) : 0;
+        return w->fresh_unset_infected;
+    }
 
-    char filename[128] = "cluster_statistic.txt";
-    FILE* sfile = fopen(filename,"a");
-    fprintf(sfile,"%.12e %.12e %d \n", cluster_size_in_time, infection_size_in_time, w->nvertices);
-    fclose(sfile);
+    int ninfected = untouched_infected;
+    int u = w->pin_free;
+    if(u>=0 && w->site_slot[u]>=nactive && w->pin_final!=2) {
+        state[u] = (rng_uniform_pos(rng)<0.5) ? 1 : -1;
+        w->fresh_site[w->nfresh++] = u;
+        ninfected += (state[u]==1);
+    }
+
+    if(w->pin_final==2 || !(w->pin_final_infected)) {
+        for(int k=0;k<(w->ninfected_set);k++) {
+            int i = w->infected_order[k];
+            if(w->site_slot[i]<nactive) continue;
+            state[i] = (rng_uniform_pos(rng)<0.5) ? 1 : -1;
+            w->fresh_site[w->nfresh++] = i;
+            ninfected += (state[i]==1)-1;
+        }
+        int ninf = w->nunset_infected;
+        w->fresh_unset_infected = (ninf>0) ? (int)gsl_ran_binomial(rng,0.5,ninf) : 0;
+        ninfected += (w->fresh_unset_infected)-ninf;
+    }
+    return ninfected;
 }
 
-void flip_cluster(world_line* w, gsl_rng* rng) {
-    int* state;
-    int hNspin,idv,idr,id,p,i,j;
+static void untouched_sites_apply(world_line* w, const int* state) {
+    for(int k=0;k<(w->nfresh);k++) {
+        int i = w->fresh_site[k];
+        w->istate[i] = state[i];
+        w->pstate[i] = state[i];
+        infected_set(w,i,state[i]);
+    }
+    w->nunset = w->fresh_unset;
+    w->nunset_infected = w->fresh_unset_infected;
+}
 
+// the active sites after the flip: the infected ones are listed and
+// counted in the final state with the untouched ones
+static void active_sites_end(world_line* w) {
+    int nfinal = w->ninitial;
+    for(int k=0;k<(w->nactive);k++) {
+        int i = w->site_order[k];
+        infected_set(w,i,w->istate[i]);
+        nfinal += (w->pstate[i]==1)-(w->istate[i]==1);
+    }
+    w->nfinal = nfinal;
+}
+
+static void flip_cluster_parallel(chain* c, world_line* w) {
     int mnspin = w->mnspin;
-    int nsite  = w->nsite;
+    int nvertices = w->nvertices;
+    int nlabel = w->nlabel;
+    int* label   = w->label;
+    int* cweight = w->cweight;
+    int* order   = w->site_order;
+    int nactive  = w->nactive;
+    int nbefore  = 0;
+    int nafter   = 0;
 
     vertex* sequence = w->sequenceB;
     if(w->flag) 
         sequence = w->sequenceA;
 
-    for(i=0;i<(w->nvertices);i++) {
-        hNspin = (sequence[i]).hNspin;
-        state  = (sequence[i]).state;
+#ifdef _OPENMP
+#pragma omp parallel num_threads(c->nthread)
+#endif
+    {
+        int t=0;
+#ifdef _OPENMP
+        t = omp_get_thread_num();
+#endif
+        gsl_rng* rng = c->rngs[t];
+        vertex* v;
+        int id,p,i,j,k,l;
 
-        for(j=0;j<2*hNspin;j++) {
-            idv = i*mnspin+j;
-            idr = root(w->cluster,idv);
-            if(w->weight[idr]>0) {
-                if(gsl_rng_uniform_pos(rng)<1.0) {
-                    w->weight[idr] =  0;
+        // every free cluster is decided once, by the thread owning its label
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+        for(l=0;l<nlabel;l++) {
+            if(cweight[l]>0) {
+                if(rng_uniform_pos(rng)<1.0) {
+                    cweight[l] =  0;
                 } else {
-                    w->weight[idr] = -1;
+                    cweight[l] = -1;
                 }
             }
-            if(w->weight[idr]==0) {
-                state[j] = -state[j];
+        }
+
+#ifdef _OPENMP
+#pragma omp for schedule(static)
+#endif
+        for(i=0;i<nvertices;i++) {
+            v = &(sequence[i]);
+            VERTEX_KERNEL(v->hNspin,vertex_flip_legs,v,&(label[i*mnspin]),cweight);
+        }
+
+#ifdef _OPENMP
+#pragma omp for schedule(static) reduction(+:nbefore,nafter)
+#endif
+        for(k=0;k<nactive;k++) {
+            // a boundary leg is fixed, the pinned state stays
+            i  = order[k];
+            id = w->first[i];
+            nbefore += (w->istate[i]==1);
+            if(!is_boundary_leg(w,id)) {
+                p = id/mnspin;
+                j  =id%mnspin;
+                w->istate[i] = vertex_state(&(sequence[p]),j);
+            }
+            nafter += (w->istate[i]==1);
+
+            id = w->last[i];
+            if(!is_boundary_leg(w,id)) {
+                p = id/mnspin;
+                j  =id%mnspin;
+                w->pstate[i] = vertex_state(&(sequence[p]),j);
             }
         }
     }
 
-    for(i=0;i<nsite;i++) {
+    int untouched = untouched_sites_draw(w,w->istate,(w->ninitial)-nbefore,c->rngs[0]);
+    untouched_sites_apply(w,w->istate);
+    w->ninitial = nafter+untouched;
+    active_sites_end(w);
+}
+
+// the configuration satisfies the conditioning of the chain: a single
+// infected node in the initial state and more than condition_nif in the
+// final state, as counted by the sweep
+static int flip_cluster_is_conditioned(chain* c, world_line* w) {
+    return ((w->ninitial)==1 && (w->nfinal)>(c->condition_nif));
+}
+
+// flip every free cluster unless the result leaves the conditioned configurations,
+// the flip is its own inverse so rejecting keeps the conditioned distribution
+static void flip_cluster_conditioned(chain* c, world_line* w, gsl_rng* rng) {
+    vertex* v;
+    int id,p,i,j,k,l,s;
+
+    int mnspin = w->mnspin;
+    int nsite  = w->nsite;
+
+    if(c->condition_istate==NULL) {
+        c->condition_istate = (int*)malloc(sizeof(int)*nsite);
+    }
+    int* istate = c->condition_istate;
+
+    vertex* sequence = w->sequenceB;
+    if(w->flag) 
+        sequence = w->sequenceA;
+
+    int* label   = w->label;
+    int* cweight = w->cweight;
+    for(l=0;l<(w->nlabel);l++) {
+        if(cweight[l]>0) cweight[l]=0;
+    }
+
+    // initial and final state after the flip
+    int* order  = w->site_order;
+    int nactive = w->nactive;
+    int nbefore=0,ninitial=0,nfinal=0;
+    for(k=0;k<nactive;k++) {
+        i  = order[k];
         id = w->first[i];
-        if(id!=-1) {
-            p = id/mnspin;
-            j  =id%mnspin;
-            w->istate[i] = (sequence[p]).state[j];
-        } else if(gsl_rng_uniform_pos(rng)<0.5) {
-            w->istate[i] =  1;
+        nbefore += (w->istate[i]==1);
+        if(is_boundary_leg(w,id)) {
+            s = w->istate[i];
         } else {
-            w->istate[i] = -1;
+            s = vertex_state(&(sequence[id/mnspin]),id%mnspin);
+            if(cweight[label[id]]==0) s=-s;
         }
+        istate[i] = s;
+        ninitial += (s==1);
 
         id = w->last[i];
-        if(id!=-1) {
+        if(is_boundary_leg(w,id)) {
+            s = w->pstate[i];
+        } else {
+            s = vertex_state(&(sequence[id/mnspin]),id%mnspin);
+            if(cweight[label[id]]==0) s=-s;
+        }
+        nfinal += (s==1);
+    }
+    // an untouched site holds its state from tau=0 to tau=1, the fresh ones
+    // are drawn before the condition and kept only if the flip is
+    int untouched = untouched_sites_draw(w,istate,(w->ninitial)-nbefore,rng);
+    ninitial += untouched;
+    nfinal   += untouched;
+    int accept = (ninitial==1 && nfinal>(c->condition_nif));
+    c->count.condition_flips++;
+
+    if(!accept) {
+        c->count.condition_rejected++;
+        for(l=0;l<(w->nlabel);l++) {
+            if(cweight[l]==0) cweight[l]=-1;
+        }
+        if(c->obs_model!=NULL) observe_world_line(c,w);
+        return;
+    }
+
+    untouched_sites_apply(w,istate);
+    w->ninitial = ninitial;
+
+    int observe = (c->obs_model!=NULL);
+    int slice=0,ninfected=0;
+    if(observe) observe_begin(c,w,istate,&slice,&ninfected);
+
+    for(i=0;i<(w->nvertices);i++) {
+        v = &(sequence[i]);
+        VERTEX_KERNEL(v->hNspin,vertex_flip_legs,v,&(label[i*mnspin]),cweight);
+        if(observe) observe_vertex(c,v,nsite,&slice,&ninfected);
+    }
+    if(observe) observe_end(c,w,slice,ninfected);
+
+    for(k=0;k<nactive;k++) {
+        i = order[k];
+        w->istate[i] = istate[i];
+
+        if(!is_boundary_leg(w,w->last[i])) {
+            id = w->last[i];
             p = id/mnspin;
             j  =id%mnspin;
-            w->pstate[i] = (sequence[p]).state[j];
+            w->pstate[i] = vertex_state(&(sequence[p]),j);
         }
     }
+    active_sites_end(w);
 }
 
-void remove_only_fixed_vertices(world_line* w) {
-    int hNspin,idv,idr,i,j,k;
+void flip_cluster(chain* c, world_line* w, gsl_rng* rng) {
+    if(c->condition_nif>=0 && flip_cluster_is_conditioned(c,w)) {
+        flip_cluster_conditioned(c,w,rng);
+        return;
+    }
+    if(c->nthread>1) {
+        flip_cluster_parallel(c,w);
+        if(c->obs_model!=NULL) observe_world_line(c,w);
+        return;
+    }
+
+    vertex* v;
+    int id,p,i,j,k,l;
 
     int mnspin = w->mnspin;
+    int nsite  = w->nsite;
+    int* label   = w->label;
+    int* cweight = w->cweight;
 
-    vertex* v;
+    vertex* sequence = w->sequenceB;
+    if(w->flag) 
+        sequence = w->sequenceA;
+
+    for(l=0;l<(w->nlabel);l++) {
+        if(cweight[l]>0) {
+            if(rng_uniform_pos(rng)<1.0) {
+                cweight[l] =  0;
+            } else {
+                cweight[l] = -1;
+            }
+        }
+    }
+
+    // the initial state after the flip comes first, the observables start from it
+    int* order  = w->site_order;
+    int nactive = w->nactive;
+    int nbefore=0,nafter=0;
+    for(k=0;k<nactive;k++) {
+        i  = order[k];
+        id = w->first[i];
+        nbefore += (w->istate[i]==1);
+        if(!is_boundary_leg(w,id)) {
+            p = id/mnspin;
+            j  =id%mnspin;
+            w->istate[i] = vertex_state(&(sequence[p]),j);
+            if(cweight[label[id]]==0) w->istate[i] = -(w->istate[i]);
+        }
+        nafter += (w->istate[i]==1);
+    }
+    int untouched = untouched_sites_draw(w,w->istate,(w->ninitial)-nbefore,rng);
+    untouched_sites_apply(w,w->istate);
+    w->ninitial = nafter+untouched;
+
+    int observe = (c->obs_model!=NULL);
+    int slice=0,ninfected=0;
+    if(observe) observe_begin(c,w,w->istate,&slice,&ninfected);
+
+    for(i=0;i<(w->nvertices);i++) {
+        v = &(sequence[i]);
+        VERTEX_KERNEL(v->hNspin,vertex_flip_legs,v,&(label[i*mnspin]),cweight);
+        if(observe) observe_vertex(c,v,nsite,&slice,&ninfected);
+    }
+    if(observe) observe_end(c,w,slice,ninfected);
+
+    for(k=0;k<nactive;k++) {
+        i  = order[k];
+        id = w->last[i];
+        if(is_boundary_leg(w,id)) continue;
+        p = id/mnspin;
+        j  =id%mnspin;
+        w->pstate[i] = vertex_state(&(sequence[p]),j);
+    }
+    active_sites_end(w);
+}
+
+// a vertex is saved if it changes a state or one of its legs is in a flipped cluster
+static inline int vertex_saved_legs(const vertex* v, const int* label, const int* cweight, int hNspin) {
+    int check_save = vertex_changes_state(v,hNspin);
+
+    for(int j=0;j<2*hNspin;j++) {
+        if(cweight[label[j]]==0) {
+            check_save = 1;
+        }
+    }
+
+    return check_save;
+}
+
+static int vertex_is_saved(world_line* w, vertex* v, int i) {
+    return VERTEX_KERNEL(v->hNspin,vertex_saved_legs,v,&(w->label[i*(w->mnspin)]),w->cweight);
+}
+
+/* Each thread compacts its chunk of the sequence; the number of saved
+** vertices per chunk gives, by a prefix sum, where each chunk is written.
+*/
+static void remove_only_fixed_vertices_parallel(chain* c, world_line* w) {
+    int nvertices = w->nvertices;
+    int* tcount = c->tcount;
+    int ninfection=0;
+    int nrecover=0;
+    int nteam=1;
 
     vertex* sequence1 = w->sequenceB;
     vertex* sequence2 = w->sequenceA;
@@ -605,41 +1633,101 @@ void remove_only_fixed_vertices(world_line* w) {
         sequence2 = w->sequenceB;
     }
 
-    ninfection=0;
-    nrecover=0;
+#ifdef _OPENMP
+#pragma omp parallel num_threads(c->nthread) reduction(+:ninfection,nrecover)
+#endif
+    {
+        int t=0;
+        int nt=1;
+#ifdef _OPENMP
+        t  = omp_get_thread_num();
+        nt = omp_get_num_threads();
+#endif
+        int i0 = (int)(((long)nvertices*t)/nt);
+        int i1 = (int)(((long)nvertices*(t+1))/nt);
+        int i,k;
 
-    int check_save;
-    k=0;
-    for(i=0;i<w->nvertices;i++) {
-        v = &(sequence1[i]);
-        hNspin = v->hNspin;
-        check_save = 0;
+        k=0;
+        for(i=i0;i<i1;i++) {
+            if(vertex_is_saved(w,&(sequence1[i]),i)) k++;
+        }
+        tcount[t+1] = k;
 
-        for(j=0;j<hNspin;j++) {
-            if(v->state[j]!=v->state[j+v->hNspin]) {
-                check_save = 1;
-            } 
+#ifdef _OPENMP
+#pragma omp barrier
+#pragma omp single
+#endif
+        {
+            nteam = nt;
+            tcount[0] = 0;
+            for(i=0;i<nt;i++) tcount[i+1] += tcount[i];
         }
 
-        for(j=0;j<2*hNspin;j++) {
-            idv = i*mnspin+j;
-            idr = root(w->cluster,idv);
-            if(w->weight[idr]==0) {
-                check_save = 1;
+        k = tcount[t];
+        for(i=i0;i<i1;i++) {
+            vertex* v = &(sequence1[i]);
+            if(vertex_is_saved(w,v,i)) {
+                copy_vertex(&(sequence2[k]),v);
+                k++;
+
+                if(v->hNspin==1) {
+                    nrecover++;
+                } else if(v->hNspin==2) {
+                    ninfection++;
+                }
             }
         }
+    }
+
+    c->ninfection = ninfection;
+    c->nrecover   = nrecover;
+
+    c->count.removed += nvertices-tcount[nteam];
+    w->nvertices = tcount[nteam];
+    w->flag = !(w->flag);
+}
+
+void remove_only_fixed_vertices(chain* c, world_line* w) {
+    // the boundaries are fixed and do not change a state
+    w->nboundary_initial = 0;
+    w->nboundary_final = 0;
+
+    if(c->nthread>1) {
+        remove_only_fixed_vertices_parallel(c,w);
+        return;
+    }
+
+    int i,k;
+
+    vertex* v;
+
+    vertex* sequence1 = w->sequenceB;
+    vertex* sequence2 = w->sequenceA;
+    if(w->flag) {
+        sequence1 = w->sequenceA;
+        sequence2 = w->sequenceB;
+    }
+
+    c->ninfection=0;
+    c->nrecover=0;
+    c->obs_ready=0;
+
+    k=0;
+    for(i=0;i<w->nvertices;i++) {
+        v = &(sequence1[i]);
 
-        if(check_save) {
+        if(vertex_is_saved(w,v,i)) {
             copy_vertex(&(sequence2[k]),&(sequence1[i]));
             k++;
 
             if(v->hNspin==1) {
-                nrecover++;
+                c->nrecover++;
             } else if(v->hNspin==2) {
-                ninfection++;
+                c->ninfection++;
             }
         }
     }
+    c->count.removed += (w->nvertices)-k;
     w->nvertices = k;
     w->flag = !(w->flag);
 }
@@ -648,7 +1736,6 @@ void snapshot_show(world_line* w, model* m, FILE* file) {
     vertex* v;
     int idv,idr;
     int bond,hNspin,type,index;
-    int* indices;
     double tau;
 
     int nsite = w->nsite;
@@ -676,21 +1763,20 @@ void snapshot_show(world_line* w, model* m, FILE* file) {
         bond    = v->bond;
         hNspin  = v->hNspin;
         tau     = v->tau;
-        type    = m->bond2type[bond];
-        indices = &(m->bond2index[bond*(m->mhnspin)]);
+        type    = bond_type(m,bond);
 
         int check_condition = 0;
 
         for(int j=0;j<hNspin;j++) {
-            if(v->state[j]!=v->state[j+v->hNspin]) {
+            if(vertex_state(v,j)!=vertex_state(v,j+v->hNspin)) {
                 check_condition = 1;
             } 
         }
 
         for(int j=0;j<2*hNspin;j++) {
             idv = i*mnspin+j;
-            idr = root(w->cluster,idv);
-            if(w->weight[idr]==0) {
+            idr = w->label[idv];
+            if(w->cweight[idr]==0) {
                 check_condition = 1;
             }
         }
@@ -700,7 +1786,7 @@ void snapshot_show(world_line* w, model* m, FILE* file) {
             fprintf(file,"%d %f ",type,tau);
 
             for(int j=0;j<hNspin;j++) {
-                index = indices[j];
+                index = bond_index(m,bond,j);
                 printf("%d ",index);
                 fprintf(file,"%d ",index);
             }
@@ -708,8 +1794,8 @@ void snapshot_show(world_line* w, model* m, FILE* file) {
             int free_cluster=0;
             for(int j=0;j<2*hNspin;j++) {
                 idv = i*mnspin+j;
-                idr = root(w->cluster,idv);
-                if(w->weight[idr]==0) {
+                idr = w->label[idv];
+                if(w->cweight[idr]==0) {
                     free_cluster=1;
                 }
             }
@@ -722,8 +1808,8 @@ void snapshot_show(world_line* w, model* m, FILE* file) {
         int free_cluster=0;
         idv = w->last[i];
         if(idv!=-1) {
-            idr = root(w->cluster,idv);
-            if(w->weight[idr]==0) {
+            idr = w->label[idv];
+            if(w->cweight[idr]==0) {
                 free_cluster=1;
             }
         }
@@ -1,39 +1,95 @@
 #ifndef update_h
 #define update_h
+#include <stdio.h>
 #include <gsl/gsl_rng.h>
 
 #include "dtype.h"
+#include "networks.h"
 
-double ninfection_value();
+void chain_threads(chain* c, int nthread, gsl_rng* rng);
+/**
+ * This function sets the number of OpenMP threads used inside a single chain by clustering, flip_cluster,
+ * remove_only_fixed_vertices and the cluster construction of sweep.
+ *
+ * Parameters:
+ *   c (chain*): Pointer to the chain.
+ *   nthread (int): Number of threads; 1 keeps the serial kernels.
+ *   rng (gsl_rng*): Random number generator of the chain, used to seed one stream per thread.
+ *
+ * Outputs:
+ *   - Allocates the per-thread random number streams and the per-thread first/last arrays of the chain.
+ */
+
+void running_mode_setup(world_line* w, network* g, int running_mode, int* initial_type, int* final_type, int* nocheck);
+/**
+ * This function sets the initial state of a world-line and the boundary conditions of a running mode (see main.c).
+ *
+ * Parameters:
+ *   w (world_line*): Pointer to the world-line, its initial state is set.
+ *   g (network*): Network, patient zero is the neighbour of the node with the largest degree.
+ *   running_mode (int): 0 ... 4.
+ *   initial_type (int*), final_type (int*): Types of the boundary conditions passed to sweep.
+ *   nocheck (int*): 1 if every sample is measured, 0 if only those with one initial and more than nif final infections.
+ *
+ * Behavior:
+ *   - Exits with an error for an unknown running mode.
+ */
+
+void chain_observe(chain* c, model* m, double* time_list, int ntime);
+/**
+ * This function makes flip_cluster record the observables of measurement() while it flips the vertices.
+ *
+ * Parameters:
+ *   c (chain*): Pointer to the chain.
+ *   m (model*): Pointer to the model of the chain, giving the sites of the bonds.
+ *   time_list (double*): Array of the time slices of measurement(), kept by the chain until it is freed.
+ *   ntime (int): Number of time slices.
+ *
+ * Behavior:
+ *   - Every later flip_cluster keeps the state of every site from the new initial state on, a running infected count
+ *     updated by the legs that change a state, and the infected time; I/N is recorded in O(1) at each slice.
+ *   - measurement() then adds the recorded sample instead of replaying the world-line; the record is dropped by the
+ *     next sweep or remove_vertices.
+ *
+ * Outputs:
+ *   - Allocates the observable buffers of the chain (nsite states and times, ntime ratios).
+ */
+
+void uniform_sequence_sampling(chain* c, model* m, double lam, double start, gsl_rng* rng);
+/**
+ * This function draws the insertion candidates of a sweep into c->insert_seq and c->insert_bond (see update.c), for
+ * the sweeps that merge them into the world-line themselves, as the domain-decomposed sweep of domain.h does.
+ */
 
-double nrecover_value();
 
-void remove_vertices(world_line* w);
+void remove_vertices(chain* c, world_line* w);
 /** 
  * This function removes vertices from the world-line of the simulation that do not contribute to state changes.
  *
  * Parameters:
+ *   c (chain*): Pointer to the per-chain state (insertion buffers, vertex counters and statistic buffers).
  *   w (world_line*): Pointer to the world_line structure that represents the current state of the system.
  *
  * Behavior:
  *   - The function iterates over all vertices in the active sequence (either sequenceA or sequenceB, depending on the flag).
  *   - It checks each vertex to determine if it causes a change in the state of any spins. A vertex is retained if it changes the state
  *     of at least one spin; otherwise, it is removed.
- *   - Counters for the number of infection and recovery events (ninfection and nrecover) are updated based on the types of vertices
+ *   - The chain's counters for the number of infection and recovery events (ninfection and nrecover) are updated based on the types of vertices
  *     that are retained.
  *   - The function toggles the active sequence flag at the end, swapping the roles of sequenceA and sequenceB for the next operation.
  *
  * Outputs:
  *   - The function modifies the world_line structure in-place, reducing the number of vertices and potentially altering which sequence
- *     is active. It also updates global counters for the number of infections and recoveries observed.
+ *     is active. It also updates the chain's counters for the number of infections and recoveries observed.
  */
 
 
-void remove_only_fixed_vertices(world_line* w);
+void remove_only_fixed_vertices(chain* c, world_line* w);
 /**
  * This function removes fixed (unchanging) vertices from the world-line of a Monte Carlo simulation.
  *
  * Parameters:
+ *   c (chain*): Pointer to the per-chain state (insertion buffers, vertex counters and statistic buffers).
  *   w (world_line*): Pointer to the world_line structure representing the current state and configuration of the simulation.
  *
  * Behavior:
@@ -43,29 +99,29 @@ void remove_only_fixed_vertices(world_line* w);
  *   - Vertices that exhibit any change in state or are part of a dynamic cluster (non-zero weight) are copied to the other sequence for retention.
  *   - The count of infection-related and recovery-related vertices is updated based on the type of interaction they represent.
  *   - This process reduces the number of vertices in the sequence, potentially enhancing performance by focusing computational efforts on dynamic parts of the system.
+ *   - With c->nthread > 1 the chunks of the sequence are compacted in parallel.
  *
  * Outputs:
  *   - Modifies the world_line structure in-place, reducing the number of vertices and toggling the active sequence flag to switch between sequences.
- *   - Updates global counters for the number of infections and recoveries observed during the process.
+ *   - Updates the chain's counters for the number of infections and recoveries observed during the process.
  */
 
 
-void swapping_graphs(world_line* w, model* m, gsl_rng* rng);
+void swapping_graphs(chain* c, world_line* w, model* m, gsl_rng* rng);
 /**
  * This function performs random swaps of vertex types within a world-line according to specific rules based on the type of bond.
  * It's used in the simulation to introduce randomness and to explore different configurations in the phase space of the model.
  *
  * Parameters:
+ *   c (chain*): Pointer to the per-chain state (insertion buffers, vertex counters and statistic buffers).
  *   w (world_line*): Pointer to the world_line structure representing the simulation's current state.
  *   m (model*): Pointer to the model structure containing information about the simulation's sites and bonds.
  *   rng (gsl_rng*): Pointer to a GSL random number generator, used to introduce randomness into the graph swapping process.
  *
  * Behavior:
  *   - The function iterates through each vertex in the active sequence (sequenceA or sequenceB, depending on the flag).
- *   - For vertices associated with bonds of types 1, 3, and 5 or types 2, 4, and 6, it randomly assigns a new bond of the same general type
- *     (odd or even) based on a uniformly distributed random value.
- *   - For vertices associated with bond types 7 or 8, it randomly adjusts the bond by adding or subtracting the number of nodes,
- *     effectively swapping between these two types.
+ *   - Every vertex whose type belongs to a swap group of the model description (for SIS the groups (1,3,5), (2,4,6)
+ *     and (7,8)) gets a type of its group drawn uniformly, on the same edge or site (see m->swap_offset).
  *   - These swaps are designed to maintain the overall connectivity and type balance of the graph while exploring new configurations.
  *
  * Outputs:
@@ -74,12 +130,13 @@ void swapping_graphs(world_line* w, model* m, gsl_rng* rng);
  */
 
 
-void insert_vertices(world_line* w, model* m, gsl_rng* rng);
+void insert_vertices(chain* c, world_line* w, model* m, gsl_rng* rng);
 /**
  * This function inserts new vertices into the world-line of the simulation based on a sampling of a uniform sequence,
  * which is influenced by the model's site weight and the simulation's inverse temperature.
  *
  * Parameters:
+ *   c (chain*): Pointer to the per-chain state (insertion buffers, vertex counters and statistic buffers).
  *   w (world_line*): Pointer to the world_line structure representing the simulation's current state.
  *   m (model*): Pointer to the model structure containing information about the system's sites and bonds.
  *   rng (gsl_rng*): Pointer to a GSL random number generator, used for generating the random positions of new vertices.
@@ -101,18 +158,58 @@ void insert_vertices(world_line* w, model* m, gsl_rng* rng);
  */
 
 
-void clustering(world_line* w, model* m);
+void boundary_condition_initial_state(chain* c, world_line* w, model* m, int type, gsl_rng* rng);
+/**
+ * This function selects the sites whose initial state is pinned at tau=0, each by a boundary leg of its own.
+ *
+ * Parameters:
+ *   c (chain*): Pointer to the per-chain state (insertion buffers, vertex counters and statistic buffers).
+ *   w (world_line*): Pointer to the world_line structure representing the current state of the simulation.
+ *   m (model*): Pointer to the model structure; the boundary legs link by the rule of the type-10 bond nbond+i.
+ *   type (int): 0 pins every site, 1 pins the susceptible sites except one random neighbour of a single patient zero.
+ *   rng (gsl_rng*): Pointer to a GSL random number generator, used to choose the free neighbour for type 1.
+ *
+ * Outputs:
+ *   - Only the pins are recorded (w->pin_initial, w->pin_free, see site_pinned_initial); a site gets its boundary leg
+ *     when a vertex first acts on it and is listed in w->boundary_site[0 ... nboundary_initial-1] then. The free
+ *     neighbour and patient zero are the only sites settled here; the vertex sequences are not touched.
+ */
+
+
+void boundary_condition_final_state(chain* c, world_line* w, model* m, double p, int type, gsl_rng* rng);
+/**
+ * This function selects the sites whose final state is pinned at tau=1, each by a boundary leg of its own.
+ *
+ * Parameters:
+ *   c (chain*): Pointer to the per-chain state (insertion buffers, vertex counters and statistic buffers).
+ *   w (world_line*): Pointer to the world_line structure; `pstate` has to hold the final state of each site.
+ *   m (model*): Pointer to the model structure; the boundary legs link by the rule of the type-10 bond nbond+i.
+ *   p (double): Target infected fraction used by type 1.
+ *   type (int): 0 pins every site, 1 pins the infected sites if there are at most p*nnode of them, 2 pins the
+ *     susceptible sites.
+ *   rng (gsl_rng*): Pointer to a GSL random number generator, not drawn from.
+ *
+ * Outputs:
+ *   - Only the pins are recorded (w->pin_final, see site_pinned_final), from the number of final infections w->nfinal
+ *     the sweep counted; the active sites get their boundary legs when the legs are linked and are listed in
+ *     w->boundary_site[nsite ... nsite+nboundary_final-1] then. The vertex sequences are not touched.
+ */
+
+
+void clustering(chain* c, world_line* w, model* m);
 /**
  * This function implements the clustering algorithm for the world-line Monte Carlo simulation,
  * linking vertices based on their interactions to form clusters.
  *
  * Parameters:
+ *   c (chain*): Pointer to the per-chain state (insertion buffers, vertex counters and statistic buffers).
  *   w (world_line*): Pointer to the world_line structure representing the current state of the simulation.
  *   m (model*): Pointer to the model structure containing details about the bonds and rules for linking vertices.
  *
  * Behavior:
  *   - The function initializes the first and last indices for each site to track the start and end of clusters.
- *   - It iterates through each vertex in the active sequence (sequenceA or sequenceB, depending on the flag).
+ *   - It links the tau=0 boundary legs, then each vertex in the active sequence (sequenceA or sequenceB, depending on
+ *     the flag), then the tau=1 boundary legs; a boundary leg carries the fixed weight of the boundary rule.
  *   - For each vertex, it applies the linking rules defined in the model based on the type of bond associated with the vertex.
  *   - These rules determine how vertices are connected within the cluster framework, setting up the foundation for collective
  *     updates during the simulation.
@@ -120,19 +217,52 @@ void clustering(world_line* w, model* m);
  *     between vertices as dictated by the rules.
  *   - Optionally (as noted by commented code), it can handle open boundary conditions by linking the first and last vertices
  *     in each cluster, though this is disabled by default in the provided code snippet.
+ *   - With c->nthread > 1 the sequence is split into chunks along tau that are linked in parallel and then stitched together
+ *     pairwise through the first/last legs of each site.
+ *   - Ends with a serial pass that numbers the clusters densely (w->label, w->nlabel) and copies their weights to
+ *     w->cweight, in the order the first leg of each cluster appears; sweep does the same when it links the vertices itself.
  *
  * Outputs:
  *   - The function modifies the world_line structure in-place by setting up links between vertices based on the model's rules.
  *     These links are used in later steps of the simulation to perform updates across connected vertices simultaneously.
  */
 
-void cluster_statistic(world_line* w, model* m);
+void sweep(chain* c, world_line* w, model* m, int initial_type, int final_type, double p, gsl_rng* rng);
+/**
+ * This function performs one update of the world-line up to the cluster construction in a single streaming pass. It is
+ * equivalent to calling remove_vertices, swapping_graphs, insert_vertices, boundary_condition_initial_state,
+ * boundary_condition_final_state and clustering in turn, but reads the active sequence once and writes the other one once.
+ *
+ * Parameters:
+ *   c (chain*): Pointer to the per-chain state (insertion buffers, vertex counters and statistic buffers).
+ *   w (world_line*): Pointer to the world_line structure representing the current state of the simulation.
+ *   m (model*): Pointer to the model structure containing the bonds, insertion rules and linking rules.
+ *   initial_type (int): Type of the boundary condition at tau=0, see boundary_condition_initial_state.
+ *   final_type (int): Type of the boundary condition at tau=1, see boundary_condition_final_state.
+ *   p (double): Target infected fraction for the final boundary condition of type 1.
+ *   rng (gsl_rng*): Pointer to a GSL random number generator.
+ *
+ * Behavior:
+ *   - The insertion candidates are sampled first and the tau=0 boundary legs are linked.
+ *   - The kept vertices of the active sequence and the candidates are then merged in time order. Vertices that do not change
+ *     any state are dropped, kept vertices get their graph swapped and candidates are accepted by the insertion rules.
+ *   - Each vertex is linked into the clusters as soon as it is written, and the tau=1 boundary legs are linked last. The
+ *     boundaries are legs after the vertex legs (see world_line), so the sequences only hold the vertices.
+ *     With c->nthread > 1 the clusters are instead built by the parallel clustering once the merge is done.
+ *
+ * Outputs:
+ *   - The other sequence becomes active with its clusters built, ready for flip_cluster. The chain's infection and recovery
+ *     counters are updated as in remove_vertices.
+ */
+
+void cluster_statistic(chain* c, world_line* w, model* m);
 /**
  * This function computes statistics related to clusters within the world-line Monte Carlo simulation, tracking the distribution
  * and dynamics of clusters over time. It evaluates the ratio of free clusters to total clusters and their respective sizes,
  * as well as the temporal dynamics of infections.
  *
  * Parameters:
+ *   c (chain*): Pointer to the per-chain state (insertion buffers, vertex counters and statistic buffers).
  *   w (world_line*): Pointer to the world_line structure representing the simulation's current state and setup.
  *   m (model*): Pointer to the model structure providing details on bonds and their indices.
  *
@@ -146,29 +276,44 @@ void cluster_statistic(world_line* w, model* m);
  *   - Logs computed statistics to the console and appends detailed records to a file for further analysis.
  *
  * Outputs:
- *   - Modifies global and static variables to store and update statistical data.
+ *   - Modifies the chain's statistic buffers to store and update statistical data.
  *   - Outputs to the console for immediate observation of the simulation's state and progression.
  *   - Writes detailed cluster and infection statistics to a file named 'cluster_statistic.txt' for persistence and later analysis.
  */
 
+// the output stream of 'cluster_statistic.txt', opened by a checkpoint before the first sample
+FILE* cluster_statistic_stream();
 
-void flip_cluster(world_line* w, gsl_rng* rng);
+
+void flip_cluster(chain* c, world_line* w, gsl_rng* rng);
 /**
  * This function performs the flip operation on clusters within a world-line Monte Carlo simulation.
  * It determines whether each cluster will flip its state based on random choices and the cluster's
  * associated weight.
  *
  * Parameters:
+ *   c (chain*): Pointer to the per-chain state (insertion buffers, vertex counters and statistic buffers).
  *   w (world_line*): Pointer to the world_line structure representing the current state of the simulation.
  *   rng (gsl_rng*): Pointer to a GSL random number generator used to introduce randomness in the flip decision.
  *
  * Behavior:
- *   - The function iterates through all vertices in the active sequence (sequenceA or sequenceB, depending on the flag).
- *   - For each vertex, it processes each leg, determining the root of its cluster and deciding if the cluster's state will flip.
- *   - The decision to flip is based on the cluster's weight and a random value generated for each cluster.
- *   - If a cluster is determined to flip, all states in the cluster are inverted.
- *   - After processing the vertices, it updates the initial and final states of each site in the simulation based on the active sequence
- *     or random values if no active vertex influences the site.
+ *   - The decision to flip is taken once per cluster label, based on the cluster's weight (w->cweight) and a random value
+ *     generated for each free cluster; a flipped cluster gets the weight 0.
+ *   - The function then iterates through all vertices in the active sequence (sequenceA or sequenceB, depending on the flag)
+ *     and inverts every leg whose label is flipped.
+ *   - After processing the vertices, it updates the initial and final states of each site in the simulation based on the active sequence.
+ *     A site no vertex acts on keeps its state unless the pins of the sweep leave it free at both ends; then it holds a
+ *     fresh random state from tau=0 to tau=1. The set ones among them are the free neighbour of patient zero and the
+ *     infected sites, so they are found through w->infected_order; of the unset ones only the number of infected
+ *     sites is drawn, with a single binomial draw, and they stay unset until a reader needs them (see
+ *     world_line_settle). The observables count them by that number, and w->ninitial, w->nfinal are kept up to date.
+ *   - With c->nthread > 1 the loops run in parallel with the per-thread streams of the chain instead of rng; the labels are
+ *     split between the threads, so no atomics are needed.
+ *   - With c->condition_nif >= 0 and a configuration with a single initial infection and more than condition_nif final
+ *     infections, the flip is rejected if it would leave these configurations, and the clusters become fixed instead.
+ *     This pass is serial. The test reads w->ninitial and w->nfinal of the sweep.
+ *   - After chain_observe the observables of measurement() are recorded with the flips, in the same pass; the parallel
+ *     flip records them in a serial pass over the flipped world-line.
  *
  * Outputs:
  *   - The function modifies the state arrays within the world-line structure directly, affecting the simulation's subsequent behavior.
@@ -176,6 +321,22 @@ void flip_cluster(world_line* w, gsl_rng* rng);
  *     reflects the changes made during this operation.
  */
 
+void world_line_settle(world_line* w, gsl_rng* rng);
+/**
+ * Draws the states of the sites a flip left unset.
+ *
+ * Parameters:
+ *   w (world_line*): World-line after flip_cluster, with w->nunset unset sites of which w->nunset_infected are infected.
+ *   rng (gsl_rng*): Stream of the draw.
+ *
+ * Behavior:
+ *   - Picks which of the unset sites are the infected ones, uniformly, with nunset_infected draws; the others recover.
+ *     Their initial and final states are set and the world-line has no unset site afterwards.
+ *   - sweep and insert_vertices settle only the sites of a bond they read (site_settle), measurement() calls it before
+ *     it writes or replays the states of the single sites; anything else reading istate or pstate of single sites
+ *     after a flip (a checkpoint, a swap of a tempering ladder) calls it too.
+ *   - Does nothing if no site is unset.
+ */
 
 //int check_periodic(world_line* w, model* m);
 